@@ -25,9 +25,12 @@
 #include <config.h>
 #endif
 
+#define _GNU_SOURCE
 #include <stdlib.h>
 #include <unistd.h>
 #include <errno.h>
+#include <pthread.h>
+#include <sys/socket.h>
 
 #include "src/shared/io.h"
 #include "src/shared/queue.h"
@@ -47,6 +50,15 @@
 /* Length of signature in write signed packet */
 #define BT_ATT_SIGNATURE_LEN		12
 
+#ifndef MAX
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+#endif
+
+/* PDUs read or written with one system call, and read per wakeup */
+#define ATT_RX_BATCH			8
+#define ATT_TX_BATCH			8
+#define ATT_RX_MAX_BATCHES		4
+
 struct att_send_op;
 
 struct bt_att_chan {
@@ -64,13 +76,14 @@ struct bt_att_chan {
 
 	bool in_req;			/* There's a pending incoming request */
 
-	uint8_t *buf;
+	uint8_t *buf;			/* ATT_RX_BATCH PDUs of mtu bytes */
 	uint16_t mtu;
 };
 
 struct bt_att {
 	int ref_count;
 	bool close_on_unref;
+	bool split_bearers;		/* Writes and requests apart */
 	struct queue *chans;
 	uint8_t enc_size;
 	uint16_t mtu;			/* Biggest possible MTU */
@@ -206,8 +219,129 @@ struct att_send_op {
 	bt_att_response_func_t callback;
 	bt_att_destroy_func_t destroy;
 	void *user_data;
+
+	/* PDU buffer allocated after the operation, see op_alloc() */
+	uint8_t pool;
+	uint16_t size;
+	struct att_send_op *next;
+};
+
+/*
+ * Operations are allocated with their PDU buffer, and kept in a shared list
+ * by size class when they are done: PDUs up to the default MTU, and PDUs up
+ * to the negotiated MTU. The lists are shared between the threads, the file
+ * transfer thread sends the PDUs that the mainloop frees.
+ */
+#define ATT_OP_POOL_MAX 16
+
+enum {
+	ATT_OP_POOL_DEFAULT_MTU,
+	ATT_OP_POOL_MTU,
+	ATT_OP_POOL_COUNT
 };
 
+static struct att_send_op *op_pool[ATT_OP_POOL_COUNT];
+static unsigned int op_pool_len[ATT_OP_POOL_COUNT];
+static pthread_mutex_t op_pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static unsigned int op_allocs;
+static unsigned int op_reuses;
+
+static struct att_send_op *op_alloc(uint16_t pdu_len, uint16_t mtu)
+{
+	struct att_send_op *op, *small = NULL;
+	uint8_t pool;
+	uint16_t size;
+
+	if (pdu_len <= BT_ATT_DEFAULT_LE_MTU) {
+		pool = ATT_OP_POOL_DEFAULT_MTU;
+		size = BT_ATT_DEFAULT_LE_MTU;
+	} else {
+		pool = ATT_OP_POOL_MTU;
+		size = MAX(pdu_len, mtu);
+	}
+
+	pthread_mutex_lock(&op_pool_mutex);
+
+	/* A buffer of a smaller MTU is released */
+	while ((op = op_pool[pool]) && op->size < pdu_len) {
+		op_pool[pool] = op->next;
+		op_pool_len[pool]--;
+		op->next = small;
+		small = op;
+	}
+
+	if (op) {
+		op_pool[pool] = op->next;
+		op_pool_len[pool]--;
+	}
+
+	pthread_mutex_unlock(&op_pool_mutex);
+
+	while (small) {
+		struct att_send_op *next = small->next;
+
+		free(small);
+		small = next;
+	}
+
+	if (op) {
+		size = op->size;
+		__sync_fetch_and_add(&op_reuses, 1);
+	} else {
+		op = malloc(sizeof(*op) + size);
+		if (!op)
+			return NULL;
+		__sync_fetch_and_add(&op_allocs, 1);
+	}
+
+	memset(op, 0, sizeof(*op));
+	op->pdu = op + 1;
+	op->pool = pool;
+	op->size = size;
+
+	return op;
+}
+
+static void op_free(struct att_send_op *op)
+{
+	pthread_mutex_lock(&op_pool_mutex);
+
+	if (op_pool_len[op->pool] >= ATT_OP_POOL_MAX) {
+		pthread_mutex_unlock(&op_pool_mutex);
+		free(op);
+		return;
+	}
+
+	op->next = op_pool[op->pool];
+	op_pool[op->pool] = op;
+	op_pool_len[op->pool]++;
+
+	pthread_mutex_unlock(&op_pool_mutex);
+}
+
+static unsigned int io_syscalls;
+static unsigned int io_pdus;
+static bool mmsg_unsupported;
+
+void bt_att_get_io_stats(unsigned int *syscalls, unsigned int *pdus)
+{
+	if (syscalls)
+		*syscalls = __sync_fetch_and_add(&io_syscalls, 0);
+
+	if (pdus)
+		*pdus = __sync_fetch_and_add(&io_pdus, 0);
+}
+
+void bt_att_get_op_stats(unsigned int *allocs, unsigned int *reuses)
+{
+	if (allocs)
+		*allocs = __sync_fetch_and_add(&op_allocs, 0);
+
+	if (reuses)
+		*reuses = __sync_fetch_and_add(&op_reuses, 0);
+}
+
 static void destroy_att_send_op(void *data)
 {
 	struct att_send_op *op = data;
@@ -218,8 +352,7 @@ static void destroy_att_send_op(void *data)
 	if (op->destroy)
 		op->destroy(op->user_data);
 
-	free(op->pdu);
-	free(op);
+	op_free(op);
 }
 
 static void cancel_att_send_op(struct att_send_op *op)
@@ -284,26 +417,31 @@ static bool match_disconn_id(const void *a, const void *b)
 	return disconn->id == id;
 }
 
-static bool encode_pdu(struct bt_att *att, struct att_send_op *op,
+static uint16_t get_pdu_len(struct bt_att *att, uint8_t opcode,
 					const void *pdu, uint16_t length)
 {
 	uint16_t pdu_len = 1;
-	struct sign_info *sign = att->local_sign;
-	uint32_t sign_cnt;
 
-	if (sign && (op->opcode & ATT_OP_SIGNED_MASK))
+	if (att->local_sign && (opcode & ATT_OP_SIGNED_MASK))
 		pdu_len += BT_ATT_SIGNATURE_LEN;
 
 	if (length && pdu)
 		pdu_len += length;
 
-	if (pdu_len > att->mtu)
+	return pdu_len;
+}
+
+static bool encode_pdu(struct bt_att *att, struct att_send_op *op,
+					const void *pdu, uint16_t length)
+{
+	uint16_t pdu_len = get_pdu_len(att, op->opcode, pdu, length);
+	struct sign_info *sign = att->local_sign;
+	uint32_t sign_cnt;
+
+	if (pdu_len > att->mtu || pdu_len > op->size)
 		return false;
 
 	op->len = pdu_len;
-	op->pdu = malloc(op->len);
-	if (!op->pdu)
-		return false;
 
 	((uint8_t *) op->pdu)[0] = op->opcode;
 	if (pdu_len > 1)
@@ -323,7 +461,6 @@ static bool encode_pdu(struct bt_att *att, struct att_send_op *op,
 					"ATT unable to generate signature");
 
 fail:
-	free(op->pdu);
 	return false;
 }
 
@@ -358,7 +495,10 @@ static struct att_send_op *create_att_send_op(struct bt_att *att,
 	if (!callback && (type == ATT_OP_TYPE_REQ || type == ATT_OP_TYPE_IND))
 		return NULL;
 
-	op = new0(struct att_send_op, 1);
+	op = op_alloc(get_pdu_len(att, opcode, pdu, length), att->mtu);
+	if (!op)
+		return NULL;
+
 	op->type = type;
 	op->opcode = opcode;
 	op->callback = callback;
@@ -366,13 +506,52 @@ static struct att_send_op *create_att_send_op(struct bt_att *att,
 	op->user_data = user_data;
 
 	if (!encode_pdu(att, op, pdu, length)) {
-		free(op);
+		op_free(op);
 		return NULL;
 	}
 
 	return op;
 }
 
+/*
+ * With split bearers, the write queue (commands, notifications) is sent on
+ * the fixed ATT bearer and the requests and indications on the EATT bearers,
+ * as long as the connection has both kinds. EATT channels are at the head of
+ * att->chans and the fixed one at the tail.
+ */
+static bool chan_sends_writes(struct bt_att_chan *chan)
+{
+	struct bt_att *att = chan->att;
+	struct bt_att_chan *fixed;
+
+	if (!att->split_bearers || chan->type != BT_ATT_EATT)
+		return true;
+
+	fixed = queue_peek_tail(att->chans);
+	return fixed->type == BT_ATT_EATT;
+}
+
+static bool chan_sends_reqs(struct bt_att_chan *chan)
+{
+	struct bt_att *att = chan->att;
+	struct bt_att_chan *eatt;
+
+	if (!att->split_bearers || chan->type == BT_ATT_EATT)
+		return true;
+
+	eatt = queue_peek_head(att->chans);
+	return eatt->type != BT_ATT_EATT;
+}
+
+/* Exchange MTU is not allowed on EATT, it stays on the fixed bearer */
+static bool chan_sends_req(struct bt_att_chan *chan, struct att_send_op *op)
+{
+	if (chan->att->split_bearers && op->opcode == BT_ATT_OP_MTU_REQ)
+		return chan->type != BT_ATT_EATT;
+
+	return chan_sends_reqs(chan);
+}
+
 static struct att_send_op *pick_next_send_op(struct bt_att_chan *chan)
 {
 	struct bt_att *att = chan->att;
@@ -384,23 +563,25 @@ static struct att_send_op *pick_next_send_op(struct bt_att_chan *chan)
 		return op;
 
 	/* See if any operations are already in the write queue */
-	op = queue_peek_head(att->write_queue);
-	if (op && op->len <= chan->mtu)
-		return queue_pop_head(att->write_queue);
+	if (chan_sends_writes(chan)) {
+		op = queue_peek_head(att->write_queue);
+		if (op && op->len <= chan->mtu)
+			return queue_pop_head(att->write_queue);
+	}
 
 	/* If there is no pending request, pick an operation from the
 	 * request queue.
 	 */
 	if (!chan->pending_req) {
 		op = queue_peek_head(att->req_queue);
-		if (op && op->len <= chan->mtu)
+		if (op && op->len <= chan->mtu && chan_sends_req(chan, op))
 			return queue_pop_head(att->req_queue);
 	}
 
 	/* There is either a request pending or no requests queued. If there is
 	 * no pending indication, pick an operation from the indication queue.
 	 */
-	if (!chan->pending_ind) {
+	if (!chan->pending_ind && chan_sends_reqs(chan)) {
 		op = queue_peek_head(att->ind_queue);
 		if (op && op->len <= chan->mtu)
 			return queue_pop_head(att->ind_queue);
@@ -492,21 +673,153 @@ static ssize_t bt_att_chan_write(struct bt_att_chan *chan, uint8_t opcode,
 		return ret;
 	}
 
+	__sync_fetch_and_add(&io_syscalls, 1);
+	__sync_fetch_and_add(&io_pdus, 1);
 	util_hexdump('<', pdu, ret, att->debug_callback, att->debug_data);
 
 	return ret;
 }
 
+static bool op_needs_rsp(struct att_send_op *op)
+{
+	return op->type == ATT_OP_TYPE_REQ || op->type == ATT_OP_TYPE_IND;
+}
+
+/* Next PDU that does not wait for a response, in the same order as
+ * pick_next_send_op().
+ */
+static struct att_send_op *pick_next_write_op(struct bt_att_chan *chan,
+							struct queue **origin)
+{
+	struct bt_att *att = chan->att;
+	struct att_send_op *op;
+
+	op = queue_peek_head(chan->queue);
+	if (op) {
+		if (op_needs_rsp(op))
+			return NULL;
+
+		*origin = chan->queue;
+		return queue_pop_head(chan->queue);
+	}
+
+	if (!chan_sends_writes(chan))
+		return NULL;
+
+	op = queue_peek_head(att->write_queue);
+	if (op && op->len <= chan->mtu && !op_needs_rsp(op)) {
+		*origin = att->write_queue;
+		return queue_pop_head(att->write_queue);
+	}
+
+	return NULL;
+}
+
+static void write_op_done(struct bt_att_chan *chan, struct att_send_op *op)
+{
+	/* Set in_req to false to indicate that no request is pending */
+	if (op->type == ATT_OP_TYPE_RSP)
+		chan->in_req = false;
+
+	destroy_att_send_op(op);
+}
+
+static bool write_single(struct bt_att_chan *chan, struct att_send_op *op)
+{
+	bt_att_chan_write(chan, op->opcode, op->pdu, op->len);
+	write_op_done(chan, op);
+
+	return true;
+}
+
+/* Send with one sendmmsg() the PDUs queued that do not wait for a response,
+ * the first one given by pick_next_send_op() came from origin.
+ */
+static bool write_batch(struct bt_att_chan *chan, struct att_send_op *first,
+							struct queue *origin)
+{
+	struct bt_att *att = chan->att;
+	struct att_send_op *ops[ATT_TX_BATCH];
+	struct queue *origins[ATT_TX_BATCH];
+	struct mmsghdr msgs[ATT_TX_BATCH];
+	struct iovec iov[ATT_TX_BATCH];
+	int count = 1, sent, i;
+
+	ops[0] = first;
+	origins[0] = origin;
+	while (!mmsg_unsupported && count < ATT_TX_BATCH &&
+			(ops[count] = pick_next_write_op(chan, &origins[count])))
+		count++;
+
+	if (count == 1)
+		return write_single(chan, first);
+
+	memset(msgs, 0, sizeof(msgs));
+	for (i = 0; i < count; i++) {
+		iov[i].iov_base = ops[i]->pdu;
+		iov[i].iov_len = ops[i]->len;
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	sent = sendmmsg(chan->fd, msgs, count, MSG_DONTWAIT);
+	__sync_fetch_and_add(&io_syscalls, 1);
+	if (sent < 0) {
+		switch (errno) {
+		case EAGAIN:
+			/* Sent on the next wakeup */
+			sent = 0;
+			goto requeue;
+		case ENOSYS:
+			mmsg_unsupported = true;
+			for (i = count - 1; i > 0; i--)
+				queue_push_head(origins[i], ops[i]);
+			return write_single(chan, first);
+		default:
+			util_debug(att->debug_callback, att->debug_data,
+					"(chan %p) write failed: %s",
+					chan, strerror(errno));
+
+			/* Nothing waits for a response, drop them */
+			for (i = 0; i < count; i++)
+				destroy_att_send_op(ops[i]);
+			return true;
+		}
+	}
+
+	__sync_fetch_and_add(&io_pdus, sent);
+	for (i = 0; i < sent; i++) {
+		util_debug(att->debug_callback, att->debug_data,
+					"(chan %p) ATT op 0x%02x",
+					chan, ops[i]->opcode);
+		util_hexdump('<', ops[i]->pdu, ops[i]->len,
+					att->debug_callback, att->debug_data);
+		write_op_done(chan, ops[i]);
+	}
+
+requeue:
+	for (i = count - 1; i >= sent; i--)
+		queue_push_head(origins[i], ops[i]);
+
+	return true;
+}
+
 static bool can_write_data(struct io *io, void *user_data)
 {
 	struct bt_att_chan *chan = user_data;
 	struct att_send_op *op;
 	struct timeout_data *timeout;
+	struct queue *origin;
 
+	origin = queue_isempty(chan->queue) ? chan->att->write_queue :
+								chan->queue;
 	op = pick_next_send_op(chan);
 	if (!op)
 		return false;
 
+	if (!op_needs_rsp(op))
+		return write_batch(chan, op, origin);
+
 	if (!bt_att_chan_write(chan, op->opcode, op->pdu, op->len)) {
 		if (op->callback)
 			op->callback(BT_ATT_OP_ERROR_RSP, NULL, 0,
@@ -553,6 +866,7 @@ static void wakeup_chan_writer(void *data, void *user_data)
 {
 	struct bt_att_chan *chan = data;
 	struct bt_att *att = chan->att;
+	struct att_send_op *req;
 
 	if (chan->writer_active)
 		return;
@@ -560,9 +874,12 @@ static void wakeup_chan_writer(void *data, void *user_data)
 	/* Set the write handler only if there is anything that can be sent
 	 * at all.
 	 */
-	if (queue_isempty(chan->queue) && queue_isempty(att->write_queue)) {
-		if ((chan->pending_req || queue_isempty(att->req_queue)) &&
-			(chan->pending_ind || queue_isempty(att->ind_queue)))
+	if (queue_isempty(chan->queue) && (!chan_sends_writes(chan) ||
+					queue_isempty(att->write_queue))) {
+		req = queue_peek_head(att->req_queue);
+		if ((chan->pending_req || !req || !chan_sends_req(chan, req)) &&
+			(chan->pending_ind || queue_isempty(att->ind_queue) ||
+						!chan_sends_reqs(chan)))
 			return;
 	}
 
@@ -631,10 +948,13 @@ static bool disconnect_cb(struct io *io, void *user_data)
 	/* Dettach channel */
 	queue_remove(att->chans, chan);
 
-	/* Notify request callbacks */
-	queue_remove_all(att->req_queue, NULL, NULL, disc_att_send_op);
-	queue_remove_all(att->ind_queue, NULL, NULL, disc_att_send_op);
-	queue_remove_all(att->write_queue, NULL, NULL, disc_att_send_op);
+	/* Notify request callbacks, unless other channels can send them */
+	if (queue_isempty(att->chans)) {
+		queue_remove_all(att->req_queue, NULL, NULL, disc_att_send_op);
+		queue_remove_all(att->ind_queue, NULL, NULL, disc_att_send_op);
+		queue_remove_all(att->write_queue, NULL, NULL,
+							disc_att_send_op);
+	}
 
 	if (chan->pending_req) {
 		disc_att_send_op(chan->pending_req);
@@ -648,9 +968,13 @@ static bool disconnect_cb(struct io *io, void *user_data)
 
 	bt_att_chan_free(chan);
 
-	/* Don't run disconnect callback if there are channels left */
-	if (!queue_isempty(att->chans))
+	/* Don't run disconnect callback if there are channels left, they
+	 * take over what this one would have sent.
+	 */
+	if (!queue_isempty(att->chans)) {
+		wakeup_writer(att);
 		return false;
+	}
 
 	bt_att_ref(att);
 
@@ -822,7 +1146,11 @@ done:
 	destroy_att_send_op(op);
 	chan->pending_req = NULL;
 
-	wakeup_chan_writer(chan, NULL);
+	/* The request sent may have held back the other bearers */
+	if (att->split_bearers)
+		wakeup_writer(att);
+	else
+		wakeup_chan_writer(chan, NULL);
 }
 
 static void handle_conf(struct bt_att_chan *chan, uint8_t *pdu, ssize_t pdu_len)
@@ -982,33 +1310,24 @@ not_supported:
 	bt_att_unref(att);
 }
 
-static bool can_read_data(struct io *io, void *user_data)
+static bool handle_pdu(struct bt_att_chan *chan, uint8_t *pdu,
+							ssize_t bytes_read)
 {
-	struct bt_att_chan *chan = user_data;
 	struct bt_att *att = chan->att;
 	uint8_t opcode;
-	uint8_t *pdu;
-	ssize_t bytes_read;
-
-	bytes_read = read(chan->fd, chan->buf, chan->mtu);
-	if (bytes_read < 0)
-		return false;
 
 	util_debug(att->debug_callback, att->debug_data,
 				"(chan %p) ATT received: %zd",
 				chan, bytes_read);
 
-	util_hexdump('>', chan->buf, bytes_read,
+	util_hexdump('>', pdu, bytes_read,
 				att->debug_callback, att->debug_data);
 
 	if (bytes_read < ATT_MIN_PDU_LEN)
 		return true;
 
-	pdu = chan->buf;
 	opcode = pdu[0];
 
-	bt_att_ref(att);
-
 	/* Act on the received PDU based on the opcode type */
 	switch (get_op_type(opcode)) {
 	case ATT_OP_TYPE_RSP:
@@ -1035,7 +1354,6 @@ static bool can_read_data(struct io *io, void *user_data)
 					"another is pending: 0x%02x",
 					chan, opcode);
 			io_shutdown(chan->io);
-			bt_att_unref(chan->att);
 
 			return false;
 		}
@@ -1058,9 +1376,93 @@ static bool can_read_data(struct io *io, void *user_data)
 		break;
 	}
 
+	return true;
+}
+
+/* Read up to ATT_RX_BATCH PDUs of mtu bytes in buf, with one recvmmsg() */
+static int read_pdus(struct bt_att_chan *chan, uint8_t *buf, uint16_t mtu,
+							struct mmsghdr *msgs)
+{
+	struct iovec iov[ATT_RX_BATCH];
+	ssize_t bytes_read;
+	int count, i;
+
+	if (!mmsg_unsupported) {
+		memset(msgs, 0, ATT_RX_BATCH * sizeof(*msgs));
+		for (i = 0; i < ATT_RX_BATCH; i++) {
+			iov[i].iov_base = buf + i * mtu;
+			iov[i].iov_len = mtu;
+			msgs[i].msg_hdr.msg_iov = &iov[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
+		}
+
+		count = recvmmsg(chan->fd, msgs, ATT_RX_BATCH, MSG_DONTWAIT,
+									NULL);
+		__sync_fetch_and_add(&io_syscalls, 1);
+		if (count >= 0 || errno != ENOSYS) {
+			if (count > 0)
+				__sync_fetch_and_add(&io_pdus, count);
+			return count;
+		}
+
+		mmsg_unsupported = true;
+	}
+
+	bytes_read = recv(chan->fd, buf, mtu, MSG_DONTWAIT);
+	__sync_fetch_and_add(&io_syscalls, 1);
+	if (bytes_read < 0)
+		return -1;
+
+	__sync_fetch_and_add(&io_pdus, 1);
+	msgs[0].msg_len = bytes_read;
+
+	return 1;
+}
+
+/* All the PDUs received are handled, not only one per wakeup */
+static bool can_read_data(struct io *io, void *user_data)
+{
+	struct bt_att_chan *chan = user_data;
+	struct bt_att *att = chan->att;
+	struct mmsghdr msgs[ATT_RX_BATCH];
+	int batches = 0, count, i;
+	uint16_t mtu = chan->mtu;
+	uint8_t *buf = chan->buf;
+	bool ret = true;
+
+	bt_att_ref(att);
+
+	/* bt_att_set_mtu() gives a new buffer to the channel while the PDUs
+	 * of this one are handled.
+	 */
+	chan->buf = NULL;
+
+	do {
+		count = read_pdus(chan, buf, mtu, msgs);
+		if (count < 0) {
+			/* EAGAIN once everything was read */
+			ret = (errno == EAGAIN);
+			break;
+		}
+
+		for (i = 0; i < count; i++) {
+			if (!handle_pdu(chan, buf + i * mtu, msgs[i].msg_len)) {
+				ret = false;
+				goto done;
+			}
+		}
+	} while (count == ATT_RX_BATCH && !chan->buf &&
+					++batches < ATT_RX_MAX_BATCHES);
+
+done:
+	if (chan->buf)
+		free(buf);
+	else
+		chan->buf = buf;
+
 	bt_att_unref(att);
 
-	return true;
+	return ret;
 }
 
 static bool is_io_l2cap_based(int fd)
@@ -1180,7 +1582,7 @@ static struct bt_att_chan *bt_att_chan_new(int fd, uint8_t type)
 	if (chan->mtu < BT_ATT_DEFAULT_LE_MTU)
 		goto fail;
 
-	chan->buf = malloc(chan->mtu);
+	chan->buf = malloc(ATT_RX_BATCH * chan->mtu);
 	if (!chan->buf)
 		goto fail;
 
@@ -1283,6 +1685,17 @@ bool bt_att_set_close_on_unref(struct bt_att *att, bool do_close)
 	return true;
 }
 
+bool bt_att_set_split_bearers(struct bt_att *att, bool split)
+{
+	if (!att)
+		return false;
+
+	att->split_bearers = split;
+	wakeup_writer(att);
+
+	return true;
+}
+
 int bt_att_attach_fd(struct bt_att *att, int fd)
 {
 	struct bt_att_chan *chan;
@@ -1346,6 +1759,26 @@ uint16_t bt_att_get_mtu(struct bt_att *att)
 	return att->mtu;
 }
 
+/* Largest MTU of the bearers that carry the Write Commands */
+uint16_t bt_att_get_write_mtu(struct bt_att *att)
+{
+	const struct queue_entry *entry;
+	uint16_t mtu = 0;
+
+	if (!att)
+		return 0;
+
+	for (entry = queue_get_entries(att->chans); entry;
+						entry = entry->next) {
+		struct bt_att_chan *chan = entry->data;
+
+		if (chan_sends_writes(chan) && chan->mtu > mtu)
+			mtu = chan->mtu;
+	}
+
+	return mtu;
+}
+
 bool bt_att_set_mtu(struct bt_att *att, uint16_t mtu)
 {
 	struct bt_att_chan *chan;
@@ -1362,7 +1795,7 @@ bool bt_att_set_mtu(struct bt_att *att, uint16_t mtu)
 	if (!chan)
 		return -ENOTCONN;
 
-	buf = malloc(mtu);
+	buf = malloc(ATT_RX_BATCH * mtu);
 	if (!buf)
 		return false;
 
@@ -1503,8 +1936,7 @@ unsigned int bt_att_send(struct bt_att *att, uint8_t opcode,
 	}
 
 	if (!result) {
-		free(op->pdu);
-		free(op);
+		op_free(op);
 		return 0;
 	}
 
@@ -1530,8 +1962,7 @@ unsigned int bt_att_chan_send(struct bt_att_chan *chan, uint8_t opcode,
 		return -EINVAL;
 
 	if (!queue_push_tail(chan->queue, op)) {
-		free(op->pdu);
-		free(op);
+		op_free(op);
 		return 0;
 	}
 
@@ -39,6 +39,7 @@ bool bt_att_set_close_on_unref(struct bt_att *att, bool do_close);
 int bt_att_get_fd(struct bt_att *att);
 
 int bt_att_attach_fd(struct bt_att *att, int fd);
+bool bt_att_set_split_bearers(struct bt_att *att, bool split);
 
 int bt_att_get_channels(struct bt_att *att);
 
@@ -58,6 +59,7 @@ bool bt_att_set_debug(struct bt_att *att, bt_att_debug_func_t callback,
 				void *user_data, bt_att_destroy_func_t destroy);
 
 uint16_t bt_att_get_mtu(struct bt_att *att);
+uint16_t bt_att_get_write_mtu(struct bt_att *att);
 bool bt_att_set_mtu(struct bt_att *att, uint16_t mtu);
 uint8_t bt_att_get_link_type(struct bt_att *att);
 
@@ -107,3 +109,6 @@ bool bt_att_set_local_key(struct bt_att *att, uint8_t sign_key[16],
 bool bt_att_set_remote_key(struct bt_att *att, uint8_t sign_key[16],
 			bt_att_counter_func_t func, void *user_data);
 bool bt_att_has_crypto(struct bt_att *att);
+
+void bt_att_get_op_stats(unsigned int *allocs, unsigned int *reuses);
+void bt_att_get_io_stats(unsigned int *syscalls, unsigned int *pdus);
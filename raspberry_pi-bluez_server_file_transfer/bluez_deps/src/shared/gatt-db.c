@@ -41,6 +41,10 @@
 #define MAX(a, b) ((a) > (b) ? (a) : (b))
 #endif
 
+#ifndef MIN
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#endif
+
 #define MAX_CHAR_DECL_VALUE_LEN 19
 #define MAX_INCLUDED_VALUE_LEN 6
 #define ATTRIBUTE_TIMEOUT 5000
@@ -65,6 +69,10 @@ struct gatt_db {
 	uint16_t next_handle;
 	struct queue *services;
 
+	/* Attributes of the services indexed by handle, for the lookups */
+	struct gatt_db_attribute **attributes;
+	uint32_t attributes_len;
+
 	struct queue *notify_list;
 	unsigned int next_notify_id;
 
@@ -216,6 +224,43 @@ failed:
 	return NULL;
 }
 
+static bool db_index_attribute(struct gatt_db *db,
+					struct gatt_db_attribute *attribute)
+{
+	struct gatt_db_attribute **attributes;
+	uint32_t len;
+
+	if (attribute->handle >= db->attributes_len) {
+		len = MAX(db->attributes_len, 32);
+		while (len <= attribute->handle)
+			len *= 2;
+		len = MIN(len, UINT16_MAX + 1);
+
+		attributes = realloc(db->attributes, len * sizeof(*attributes));
+		if (!attributes)
+			return false;
+
+		memset(attributes + db->attributes_len, 0,
+			(len - db->attributes_len) * sizeof(*attributes));
+		db->attributes = attributes;
+		db->attributes_len = len;
+	}
+
+	db->attributes[attribute->handle] = attribute;
+
+	return true;
+}
+
+static void db_unindex_attribute(struct gatt_db *db,
+					struct gatt_db_attribute *attribute)
+{
+	if (!db || !attribute || attribute->handle >= db->attributes_len)
+		return;
+
+	if (db->attributes[attribute->handle] == attribute)
+		db->attributes[attribute->handle] = NULL;
+}
+
 struct gatt_db *gatt_db_ref(struct gatt_db *db)
 {
 	if (!db)
@@ -384,8 +429,10 @@ static void gatt_db_service_destroy(void *data)
 	if (service->active)
 		notify_service_changed(service->db, service, false);
 
-	for (i = 0; i < service->num_handles; i++)
+	for (i = 0; i < service->num_handles; i++) {
+		db_unindex_attribute(service->db, service->attributes[i]);
 		attribute_destroy(service->attributes[i]);
+	}
 
 	free(service->attributes);
 	free(service);
@@ -409,6 +456,7 @@ static void gatt_db_destroy(struct gatt_db *db)
 		timeout_remove(db->hash_id);
 
 	queue_destroy(db->services, gatt_db_service_destroy);
+	free(db->attributes);
 	free(db);
 }
 
@@ -688,6 +736,11 @@ struct gatt_db_attribute *gatt_db_insert_service(struct gatt_db *db,
 	service->attributes[0]->handle = handle;
 	service->num_handles = num_handles;
 
+	if (!db_index_attribute(db, service->attributes[0])) {
+		queue_remove(db->services, service);
+		goto fail;
+	}
+
 	/* Fast-forward next_handle if the new service was added to the end */
 	db->next_handle = MAX(handle + num_handles, db->next_handle);
 
@@ -796,7 +849,7 @@ service_insert_characteristic(struct gatt_db_service *service,
 {
 	uint8_t value[MAX_CHAR_DECL_VALUE_LEN];
 	uint16_t len = 0;
-	int i;
+	int i, j;
 
 	/* Check if handle is in within service range */
 	if (handle && handle <= service->attributes[0]->handle)
@@ -840,15 +893,26 @@ service_insert_characteristic(struct gatt_db_service *service,
 	i++;
 
 	service->attributes[i] = new_attribute(service, handle, uuid, NULL, 0);
-	if (!service->attributes[i]) {
-		free(service->attributes[i - 1]);
-		return NULL;
-	}
+	if (!service->attributes[i])
+		goto fail;
+
+	if (!db_index_attribute(service->db, service->attributes[i - 1]) ||
+			!db_index_attribute(service->db, service->attributes[i]))
+		goto fail;
 
 	set_attribute_data(service->attributes[i], read_func, write_func,
 							permissions, user_data);
 
 	return service->attributes[i];
+
+fail:
+	/* Remove both the declaration and the value */
+	for (j = i - 1; j <= i; j++) {
+		db_unindex_attribute(service->db, service->attributes[j]);
+		attribute_destroy(service->attributes[j]);
+		service->attributes[j] = NULL;
+	}
+	return NULL;
 }
 
 struct gatt_db_attribute *
@@ -936,6 +1000,12 @@ service_insert_descriptor(struct gatt_db_service *service,
 	if (!service->attributes[i])
 		return NULL;
 
+	if (!db_index_attribute(service->db, service->attributes[i])) {
+		attribute_destroy(service->attributes[i]);
+		service->attributes[i] = NULL;
+		return NULL;
+	}
+
 	set_attribute_data(service->attributes[i], read_func, write_func,
 							permissions, user_data);
 
@@ -1043,6 +1113,12 @@ service_insert_included(struct gatt_db_service *service, uint16_t handle,
 	if (!service->attributes[index])
 		return NULL;
 
+	if (!db_index_attribute(service->db, service->attributes[index])) {
+		attribute_destroy(service->attributes[index]);
+		service->attributes[index] = NULL;
+		return NULL;
+	}
+
 	/* The Attribute Permissions shall be read only and not require
 	 * authentication or authorization. Vol 2. Part G. 3.2
 	 *
@@ -1473,6 +1549,10 @@ struct gatt_db_attribute *gatt_db_get_service(struct gatt_db *db,
 	if (!db || !handle)
 		return NULL;
 
+	if (handle < db->attributes_len && db->attributes[handle])
+		return db->attributes[handle]->service->attributes[0];
+
+	/* Handle not used by an attribute, but maybe within a service */
 	service = queue_find(db->services, find_service_for_handle,
 						UINT_TO_PTR(handle));
 	if (!service)
@@ -1484,25 +1564,10 @@ struct gatt_db_attribute *gatt_db_get_service(struct gatt_db *db,
 struct gatt_db_attribute *gatt_db_get_attribute(struct gatt_db *db,
 							uint16_t handle)
 {
-	struct gatt_db_attribute *attrib;
-	struct gatt_db_service *service;
-	int i;
-
-	attrib = gatt_db_get_service(db, handle);
-	if (!attrib)
+	if (!db || !handle || handle >= db->attributes_len)
 		return NULL;
 
-	service = attrib->service;
-
-	for (i = 0; i < service->num_handles; i++) {
-		if (!service->attributes[i])
-			continue;
-
-		if (service->attributes[i]->handle == handle)
-			return service->attributes[i];
-	}
-
-	return NULL;
+	return db->attributes[handle];
 }
 
 static bool find_service_with_uuid(const void *data, const void *user_data)
@@ -1900,6 +1965,18 @@ bool gatt_db_attribute_write(struct gatt_db_attribute *attrib, uint16_t offset,
 			return true;
 		}
 
+		/*
+		 * A Write Command has no response: it is completed right away,
+		 * without a pending write and its timeout, and write_func gets
+		 * id 0, for which gatt_db_attribute_write_result does nothing.
+		 */
+		if (opcode == BT_ATT_OP_WRITE_CMD) {
+			func(attrib, 0, user_data);
+			attrib->write_func(attrib, 0, offset, value, len,
+						opcode, att, attrib->user_data);
+			return true;
+		}
+
 		p = new0(struct pending_write, 1);
 		p->attrib = attrib;
 		p->id = ++attrib->write_id;
@@ -69,8 +69,15 @@ struct async_write_op {
 	struct bt_att_chan *chan;
 	struct bt_gatt_server *server;
 	uint8_t opcode;
+	struct async_write_op *next;
 };
 
+/* Write operations done, kept for the next Write Request/Command */
+#define WRITE_OP_POOL_MAX 4
+
+static __thread struct async_write_op *write_op_pool;
+static __thread unsigned int write_op_pool_len;
+
 struct prep_write_data {
 	struct bt_gatt_server *server;
 	uint8_t *value;
@@ -775,12 +782,33 @@ error:
 	bt_att_chan_send_error_rsp(chan, opcode, ehandle, data.ecode);
 }
 
+static struct async_write_op *async_write_op_new(void)
+{
+	struct async_write_op *op = write_op_pool;
+
+	if (!op)
+		return new0(struct async_write_op, 1);
+
+	write_op_pool = op->next;
+	write_op_pool_len--;
+	memset(op, 0, sizeof(*op));
+
+	return op;
+}
+
 static void async_write_op_destroy(struct async_write_op *op)
 {
 	if (op->server)
 		op->server->pending_write_op = NULL;
 
-	free(op);
+	if (write_op_pool_len >= WRITE_OP_POOL_MAX) {
+		free(op);
+		return;
+	}
+
+	op->next = write_op_pool;
+	write_op_pool = op;
+	write_op_pool_len++;
 }
 
 static void write_complete_cb(struct gatt_db_attribute *attr, int err,
@@ -859,7 +887,7 @@ static void write_cb(struct bt_att_chan *chan, uint8_t opcode, const void *pdu,
 		goto error;
 	}
 
-	op = new0(struct async_write_op, 1);
+	op = async_write_op_new();
 	op->chan = chan;
 	op->server = server;
 	op->opcode = opcode;
@@ -25,6 +25,8 @@
 #include <config.h>
 #endif
 
+#include <pthread.h>
+
 #include "src/shared/util.h"
 #include "src/shared/queue.h"
 
@@ -35,6 +37,20 @@ struct queue {
 	unsigned int entries;
 };
 
+/*
+ * Entries removed from a queue are kept in a shared list for the next pushes,
+ * instead of a malloc/free for each of them. The list is shared between the
+ * threads: the entries pushed by one thread are often popped by another.
+ */
+#define QUEUE_ENTRY_CACHE 64
+
+static struct queue_entry *free_entries;
+static unsigned int free_count;
+static pthread_mutex_t free_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static unsigned int entry_allocs;
+static unsigned int entry_reuses;
+
 static struct queue *queue_ref(struct queue *queue)
 {
 	if (!queue)
@@ -79,12 +95,53 @@ static struct queue_entry *queue_entry_new(void *data)
 {
 	struct queue_entry *entry;
 
-	entry = new0(struct queue_entry, 1);
+	pthread_mutex_lock(&free_mutex);
+	entry = free_entries;
+	if (entry) {
+		free_entries = entry->next;
+		free_count--;
+	}
+	pthread_mutex_unlock(&free_mutex);
+
+	if (entry) {
+		entry->next = NULL;
+		__sync_fetch_and_add(&entry_reuses, 1);
+	} else {
+		entry = new0(struct queue_entry, 1);
+		__sync_fetch_and_add(&entry_allocs, 1);
+	}
+
 	entry->data = data;
 
 	return entry;
 }
 
+static void queue_entry_free(struct queue_entry *entry)
+{
+	pthread_mutex_lock(&free_mutex);
+
+	if (free_count >= QUEUE_ENTRY_CACHE) {
+		pthread_mutex_unlock(&free_mutex);
+		free(entry);
+		return;
+	}
+
+	entry->next = free_entries;
+	free_entries = entry;
+	free_count++;
+
+	pthread_mutex_unlock(&free_mutex);
+}
+
+void queue_get_entry_stats(unsigned int *allocs, unsigned int *reuses)
+{
+	if (allocs)
+		*allocs = __sync_fetch_and_add(&entry_allocs, 0);
+
+	if (reuses)
+		*reuses = __sync_fetch_and_add(&entry_reuses, 0);
+}
+
 bool queue_push_tail(struct queue *queue, void *data)
 {
 	struct queue_entry *entry;
@@ -178,7 +235,7 @@ void *queue_pop_head(struct queue *queue)
 
 	data = entry->data;
 
-	free(entry);
+	queue_entry_free(entry);
 	queue->entries--;
 
 	return data;
@@ -266,7 +323,7 @@ bool queue_remove(struct queue *queue, void *data)
 		if (!entry->next)
 			queue->tail = prev;
 
-		free(entry);
+		queue_entry_free(entry);
 		queue->entries--;
 
 		return true;
@@ -302,7 +359,7 @@ void *queue_remove_if(struct queue *queue, queue_match_func_t function,
 
 			data = entry->data;
 
-			free(entry);
+			queue_entry_free(entry);
 			queue->entries--;
 
 			return data;
@@ -353,7 +410,7 @@ unsigned int queue_remove_all(struct queue *queue, queue_match_func_t function,
 			if (destroy)
 				destroy(tmp->data);
 
-			free(tmp);
+			queue_entry_free(tmp);
 			count++;
 		}
 	}
@@ -62,3 +62,5 @@ const struct queue_entry *queue_get_entries(struct queue *queue);
 
 unsigned int queue_length(struct queue *queue);
 bool queue_isempty(struct queue *queue);
+
+void queue_get_entry_stats(unsigned int *allocs, unsigned int *reuses);
@@ -0,0 +1,27 @@
+#ifndef H_ALLOWLIST
+#define H_ALLOWLIST
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <bluetooth/bluetooth.h>
+
+/* Maximum number of SLATE addresses accepted in the allowlist */
+#define ALLOWLIST_MAX_ENTRIES 8192
+
+/* Number of slots of the hash table (power of 2, load factor <= 0.5) */
+#define ALLOWLIST_TABLE_BITS 14
+#define ALLOWLIST_TABLE_SIZE (1 << ALLOWLIST_TABLE_BITS)
+
+typedef void (*allowlist_func_t)(const bdaddr_t *addr, void *user_data);
+
+int allowlist_init(const char *source);
+int allowlist_reload(void);
+void allowlist_request_reload(void);
+int allowlist_reload_if_requested(void);
+bool allowlist_contains(const bdaddr_t *addr);
+uint32_t allowlist_count(void);
+uint32_t allowlist_generation(void);
+void allowlist_foreach(allowlist_func_t func, void *user_data);
+uint64_t allowlist_addr_to_key(const bdaddr_t *addr);
+
+#endif
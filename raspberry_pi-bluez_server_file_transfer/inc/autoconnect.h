@@ -0,0 +1,15 @@
+#ifndef H_AUTOCONNECT
+#define H_AUTOCONNECT
+
+#include <stdint.h>
+#include <bluetooth/bluetooth.h>
+
+typedef void (*autoconnect_func_t)(const bdaddr_t *addr, uint8_t addr_type, void *user_data);
+typedef void (*autoconnect_done_func_t)(void *user_data);
+
+int autoconnect_start(int dev_id, autoconnect_func_t func, void *user_data);
+void autoconnect_update(void);
+void autoconnect_check(void);
+void autoconnect_stop(autoconnect_done_func_t func, void *user_data);
+
+#endif
@@ -32,11 +32,18 @@ static const uint8_t BLE_SPS_MISC_CHAR_VALUE[BLE_SPS_MISC_CHAR_VALUE_LENGTH] = {
 
 /*MLDP SERVICE*/
 #define BLE_MLDP_MAX_DATA_LEN 20
+#define BLE_MLDP_MAX_WRITE_LEN 244 //longest MLDP write, ATT MTU of 247 bytes
 #define MLDP_DATA_CHARAC_UUID "00035b03-58e6-07dd-021a-08123a000301"
 #define MLDP_SERVICE_UUID "00035b03-58e6-07dd-021a-08123a000300"
 #define MLDP_CTRL_CHARAC_UUID "00035b03-58e6-07dd-021a-08123a0003ff"
 
 #define ATT_CID 4
+#define EATT_PSM 0x0027
+/* EATT bearers are LE credit based channels, from lib/bluetooth.h of BlueZ 5.55 */
+#ifndef BT_MODE
+#define BT_MODE 15
+#define BT_MODE_EXT_FLOWCTL 0x04
+#endif
 #define BDADDR_LE_PUBLIC 0x01
 #define BT_SECURITY_LOW 1
 
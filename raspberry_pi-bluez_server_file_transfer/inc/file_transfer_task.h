@@ -2,27 +2,42 @@
 #define FILE_TRANSFER_H__
 
 #include <stdint.h>
+#include <stdbool.h>
 #include "libfile_transfer.h"
 #include "unixio_rpi.h"
 #include <pthread.h>
 
+/* Sessions that can wait for the file transfer thread */
+#define FT_QUEUE_LEN 4
+
 /** ft_t -- File transfer structure
- * task_id -- identifier of the thread
  * kermit_handler_s -- Used to declare functions that make the link between Bluetooth and Kermit
  * condition -- thread condition
  * attr -- attribute of the thread condition, used to initialize the condition
  * mutex -- used to properly manage data access by each thread
+ * user_data -- session owning the structure
+ * batch -- serve all the transactions of the client in one Kermit session
+ * err -- error that ended the session, 0 if none
+ * stats -- statistics of the last transaction of the session with file data, nfiles counts the whole session
+ * busy_ms -- time spent in the transactions served, without the final idle wait
  **/
 typedef struct
 {
-  pthread_t ft_task_id;
   unixio_rpi_t kermit_handler_s;
   pthread_cond_t condition;
   pthread_condattr_t attr;
   pthread_mutex_t mutex;
+  void *user_data;
+  bool batch;
+  unsigned char err;
+  ft_stats_t stats;
+  uint32_t busy_ms;
 } ft_t;
 
+int file_transfer_init_thread(void);
 int file_transfer_start_server(ft_t *p_ft_s);
-void *ft_task();
+ft_t *file_transfer_get_done(int fd);
+ft_t *file_transfer_current(void);
+void *ft_task(void *arg);
 
 #endif // FILE_TRANSFER_H__
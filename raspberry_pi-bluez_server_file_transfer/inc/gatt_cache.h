@@ -0,0 +1,22 @@
+#ifndef H_GATT_CACHE
+#define H_GATT_CACHE
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <bluetooth/bluetooth.h>
+
+struct gatt_db;
+
+/* Default directory of the GATT database files, one file per SLATE */
+#define GATT_CACHE_DIR "/var/cache/bluez_server_file_transfer"
+
+/* Size of the Database Hash characteristic value */
+#define GATT_CACHE_HASH_LEN 16
+
+int gatt_cache_init(const char *dir);
+int gatt_cache_load(struct gatt_db *db, const bdaddr_t *addr, uint8_t hash[GATT_CACHE_HASH_LEN]);
+int gatt_cache_store(struct gatt_db *db, const bdaddr_t *addr);
+void gatt_cache_remove(const bdaddr_t *addr);
+bool gatt_cache_get_peer_hash(struct gatt_db *db, uint8_t hash[GATT_CACHE_HASH_LEN]);
+
+#endif
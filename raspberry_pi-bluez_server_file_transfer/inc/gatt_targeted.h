@@ -0,0 +1,25 @@
+#ifndef H_GATT_TARGETED
+#define H_GATT_TARGETED
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "uuid.h"
+
+struct bt_att;
+struct gatt_db;
+
+/* Same as bt_gatt_client_callback_t */
+typedef void (*gatt_targeted_func_t)(bool success, uint8_t att_ecode, void *user_data);
+
+/* Maximum number of service UUIDs given to gatt_targeted_discover() */
+#define GATT_TARGETED_MAX_SERVICES 4
+
+bool gatt_targeted_discover(struct bt_att *att, struct gatt_db *db, const bt_uuid_t *uuids, unsigned int count,
+                            gatt_targeted_func_t func, void *user_data);
+void gatt_targeted_cancel(void);
+unsigned int gatt_targeted_write(struct bt_att *att, uint16_t handle, const uint8_t *value, uint16_t length,
+                                 gatt_targeted_func_t func, void *user_data);
+unsigned int gatt_targeted_write_cmd(struct bt_att *att, uint16_t handle, const uint8_t *value, uint16_t length);
+
+#endif
@@ -54,7 +54,7 @@
 
 /* Feature Selection */
 
-#define P_WSLOTS 1
+#define P_WSLOTS 8
 #define P_PKTLEN 1000
 #undef NO_CTRLC     // allow 3 ctrl-c chars to terminate
 #define NO_SCAN     // we have no file system
@@ -71,6 +71,10 @@
 #define F_SCAN /* Scan files for text/binary */
 #endif         /* NO_SCAN */
 
+#define F_RS /* Recovery, see CAP2_RS, offered when crcf is set */
+#define F_CZ /* Compression of the file data, see CAP2_CZ */
+#define F_CA /* Cumulative ACKs, see CAP2_CA */
+
 #ifdef COMMENT /* None of the following ... */
 /*
   + = It works if selected
@@ -78,7 +82,6 @@
   0 = Not implemented
 */
 #define F_LS /* 0 Locking shifts */
-#define F_RS /* 0 Recovery */
 
 #endif /* COMMENT */
 
@@ -179,7 +182,19 @@
 #define P_S_TIMO 1        /* Timeout to tell other Kermit  */
 #define P_R_TIMO 1        /* Default timeout for me to use */
 #define P_RETRY 3         /* Per-packet resend limit    */
+#define P_RTO_MIN 50      /* Lower bound of the adaptive timeout, ms */
+#define P_RTO_MAX 8000    /* Upper bound of the adaptive timeout, ms */
+#define P_FASTRT 2        /* ACKs of later packets before a fast retransmit */
+#define P_ACKDELAY 20     /* Idle link before the ACK held back is sent, ms */
+#define P_AT_MINLEN 60    /* Smallest packet length of the autotuning */
+#define P_AT_PERIOD 250   /* Shortest goodput measure of the autotuning, ms */
+#define P_AT_WRITES 8     /* Link writes per packet at the start */
+#define P_AT_PDUS 4       /* Link writes per connection interval, guessed */
+#define P_AT_TURN 10      /* Time the receiver takes to ACK a packet, ms, guessed */
 #define P_PARITY PAR_NONE /* Default parity        */
+#define P_PFXSAMPLE 16384 /* File bytes read to choose the prefixes */
+#define P_GETFILES 8      /* Files of one GET, sent in one batch */
+#define P_GETLEN 128      /* Names of one GET, separated by spaces */
 #define P_R_SOH SOH       /* Incoming packet start */
 #define P_S_SOH SOH       /* Outbound packet start */
 #define P_R_EOM CR        /* Incoming packet end   */
@@ -187,11 +202,73 @@
 
 /* Capability bits */
 
-#define CAP_LP 2  /* Long packet capability */
-#define CAP_SW 4  /* Sliding windows capability */
-#define CAP_AT 8  /* Attribute packet capability */
-#define CAP_RS 16 /* Resend capability */
-#define CAP_LS 32 /* Locking shift capability */
+#define CAP_MORE 1 /* Another capas byte follows */
+#define CAP_LP 2   /* Long packet capability */
+#define CAP_SW 4   /* Sliding windows capability */
+#define CAP_AT 8   /* Attribute packet capability */
+#define CAP_RS 16  /* Resend capability */
+#define CAP_LS 32  /* Locking shift capability */
+
+/* Capability bits of the second capas byte */
+
+#define CAP2_CZ 2 /* Compression capability */
+#define CAP2_CA 4 /* Cumulative ACK capability */
+#define CAP2_RS 8 /* CRC-checked recovery capability */
+
+/* WHATAMI bits, sent after the checkpoint fields of the S packet and its ACK */
+
+#define WMI_FLAG 32  /* WHATAMI field is valid */
+#define WMI_CLEAR 16 /* Clear channel, trusted link profile */
+#define WMI_STREAM 8 /* Streaming capability */
+
+/* Recovery: when CAP2_RS is negotiated, the A packet of a binary file
+   asks for it with the '+' (disposition) attribute 'R', the receiver ACKs with the length ('1') and CRC-32 (AT_CRC) of the
+   partial file it keeps, the sender answers with a second A packet with
+   the offset it resumes from (AT_OFFSET), 0 if the CRC does not match.
+   It is not the RESEND of CAP_RS, which peers without CAP2_RS may offer */
+
+#define AT_CRC 'C'    /* CRC-32 of the partial file, in hex */
+#define AT_OFFSET 'O' /* Offset the data starts from */
+
+#define RS_NONE 0   /* No recovery for this file */
+#define RS_ASKED 1  /* Recovery asked in the A packet */
+#define RS_OFFSET 2 /* Offset sent in the second A packet */
+
+/* Compression: when CAP2_CZ is negotiated, the sender may send the
+   compressed variant of a file (openf mode 4) instead of the file, and
+   says so with the AT_CZ attribute. Its data is LZSS: each group of 8
+   items starts with a flag byte, least significant bit first, 1 for a
+   literal byte, 0 for a reference to the P_CZ_WINDOW bytes decoded before
+   it, 2 bytes big endian with distance - 1 in the high P_CZ_DBITS bits
+   and length - P_CZ_MINLEN in the others. Repeat counts still apply to
+   the packets, they are all the compression a peer without CAP2_CZ gets */
+
+#define AT_CZ 'Z'   /* Data is compressed, value is the format */
+#define CZ_LZSS 'L' /* LZSS, see above */
+
+#define P_CZ_DBITS 10                 /* Distance bits of a reference */
+#define P_CZ_WINDOW (1 << P_CZ_DBITS) /* Bytes a reference can reach */
+#define P_CZ_MINLEN 3                 /* Shortest reference */
+#define P_CZ_MAXLEN (P_CZ_MINLEN + (1 << (16 - P_CZ_DBITS)) - 1)
+
+/* Cumulative ACKs: when CAP2_CA is negotiated with sliding windows, the
+   receiver may hold back the ACKs of the D packets that arrive in
+   sequence, up to half the window, and send one ACK for the last of them
+   with ACK_CUM as data: it also ACKs every packet of the window sent
+   before it. The ACKs held back are sent as soon as anything else
+   arrives, or after P_ACKDELAY ms without input. Other ACKs are sent as
+   before, they only ACK their own packet */
+
+#define ACK_CUM 'C' /* Data of a cumulative ACK */
+
+/* Causes of the resends and of the NAKs, index of nresend_why and nsnak_why */
+
+#define RT_TIMEOUT 0 /* Nothing received in time */
+#define RT_NAK 1     /* NAK received for the packet */
+#define RT_FAST 2    /* Later packets ACK'd, fast retransmit */
+#define RT_BAD 3     /* Damaged or unexpected packet received */
+#define RT_GAP 4     /* Missing packets before the one received */
+#define RT_N 5
 
 /* Actions */
 
@@ -243,6 +320,7 @@
 #define K_SYNC 8     /* to reset server */
 #define K_DIR 9      /* Begin Dir sequence */
 #define K_REINIT 10  /* Re-initialize */
+#define K_NEXT 11    /* Next transaction, keeping what was measured */
 
 /* Kermit module return codes */
 
@@ -267,6 +345,14 @@
 #error Too much dir entries, it overflows the size of a packet !!!
 #endif
 
+struct k_link
+{               /* Link facts given by linkf, for the autotuning */
+  int mtu;      /* Payload of one link write, 0 = unknown */
+  int itv;      /* Connection interval, ms */
+  int maxlen;   /* Packet length learned on this link, 0 = none */
+  int window;   /* Window learned on this link, 0 = none */
+};
+
 struct packet
 {
   int len;    /* Length */
@@ -277,6 +363,8 @@ struct packet
   USHORT crc;
   short flg; /* Flags */
   UCHAR *buf;
+  long tim;  /* Time sent, ms, from clockf */
+  short ooo; /* ACKs of later packets received */
 };
 
 struct k_data
@@ -307,6 +395,9 @@ struct k_data
   int p_maxlen;
   short wslots_max; // max window slots to negotiate
   short wslots;     /* current window slots */
+  short cwnd;       /* window slots used when sending, autotuned */
+  short streamok;   /* offer streaming when sending */
+  short streaming;  /* streaming negotiated */
   long send_pause_us;
   short parity;         /* 0 = none, nonzero = some */
   short retry;          /* retry limit */
@@ -321,7 +412,23 @@ struct k_data
   short rptflg;         /* flag for repeat counts negotiated */
   short bct;            /* Block-check type 1..3 */
   short bcta3;          /* force block check type always 3 */
+  short bcta3_cfg;      /* bcta3 as set by the caller */
+  short trustok;        /* offer the trusted link profile */
+  short trusted;        /* trusted link negotiated */
+  long n_esc;           /* Prefixes added to the file data */
+  long n_dat;           /* Data field bytes of the file */
+  short rs;             /* Recovery state of the file, RS_xxx */
+  long rs_len;          /* Length of the partial file kept */
+  long rs_off;          /* Offset from the AT_OFFSET attribute */
   unsigned short capas; /* Capability bits */
+  unsigned short capas2; /* ... of the second capas byte */
+  short cz;             /* File data is compressed */
+  short cz_flags;       /* Flag byte of the current LZSS group */
+  short cz_nflags;      /* Items left in the group */
+  short cz_hi;          /* First byte of a reference, -1 if none */
+  int cz_pos;           /* Next position in czwin */
+  int cz_len;           /* Bytes decoded in czwin, up to P_CZ_WINDOW */
+  UCHAR czwin[P_CZ_WINDOW]; /* Last bytes decoded, for the references */
   USHORT crcta[16];     /* CRC generation table A */
   USHORT crctb[16];     /* CRC generation table B */
   UCHAR s_remain[6];    /* Send data leftovers */
@@ -357,6 +464,9 @@ struct k_data
   int (*dbf)(int, UCHAR *, UCHAR *, long);         /* debug function */
   int (*getdirdata)(struct k_data *k, UCHAR *pdf); /* To make the result of command dir */
   int (*accessf)(struct k_data *k, UCHAR *s);      /* to check if the file exists */
+  long (*crcf)(struct k_data *, UCHAR *, long, ULONG *); /* CRC-32 of the first bytes of a file */
+  long (*clockf)(struct k_data *);                 /* Monotonic clock in ms, for the timeout */
+  int (*linkf)(struct k_data *, struct k_link *);  /* Link facts, for the autotuning */
   UCHAR *zinbuf;                                   /* Input file buffer itself */
   int zincnt;                                      /* Input buffer position */
   int zinlen;                                      /* Length of input file buffer */
@@ -368,8 +478,10 @@ struct k_data
   short anseq;
 
   int nresend;
+  int nresend_why[RT_N]; /* nresend by cause, RT_xxx */
   int nspkt;
   int nsnak;
+  int nsnak_why[RT_N]; /* nsnak by cause, RT_xxx */
   int nsack;
   int nepkt;
   int nbchk;
@@ -378,12 +490,33 @@ struct k_data
   int ndiscard2;
   int ndiscard3;
   int nnaa;
-  int rtt;
+  int rtt;    /* Last round trip time measured, ms */
+  long srtt;   /* Smoothed round trip time, ms << 3 */
+  long rttvar; /* Round trip time variation, ms << 2 */
+  long rto;    /* Adaptive timeout, ms, 0 = r_timo */
+  struct k_link link; /* link.mtu 0 = no autotuning */
+  int at_maxlen;    /* Negotiated s_maxlen, bound of the autotuning */
+  long at_t0;       /* Start of the goodput measure, ms */
+  long at_bytes;    /* Bytes ACK'd since at_t0 */
+  int at_nresend;   /* nresend at at_t0 */
+  long at_bps;      /* Best goodput measured, bytes/s */
+  int at_bestlen;   /* s_maxlen of the best goodput */
+  short at_bestwin; /* cwnd of the best goodput */
+  short ackpend;    /* D packets received whose ACK is held back */
+  short ackseq;     /* Last of them */
+  short acknext;    /* Next D packet in sequence, -1 = unknown */
+  long dp_tack;     /* Last D packet ACK'd or received, ms, -1 = none */
+  long dp_ms;       /* Data phase of the transaction, ms */
+  long dp_bytes;    /* D packet bytes ACK'd or received in it */
+  int dp_npkt;      /* D packets ACK'd or received in it */
   int Bps;
 
   int dummy;
   UCHAR rootpath[K_ROOTPATH_LEN]; /* Rooth path for all the access files */
-  UCHAR *filelistptr[2];
+  UCHAR *filelistptr[P_GETFILES + 1];
+  UCHAR getlist[P_GETLEN]; /* Names of the files of a GET */
+  short nfiles;            /* Files sent by the transaction */
+  short batch;             /* Several files per GET, separated by spaces */
   UCHAR dirname[DN_MAX]; /* directory name extracted when a dir command is received */
   int recvdir;
   int recvget;
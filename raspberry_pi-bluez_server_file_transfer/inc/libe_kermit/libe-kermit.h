@@ -24,12 +24,31 @@ typedef enum {
 	ek_type_other
 } ek_transaction_type_e;
 
+/* Counters of the last transaction, by cause */
+typedef struct {
+	int nresend;					/* Packets resent */
+	int nresend_timeout;	/* ... after a timeout */
+	int nresend_nak;			/* ... after a NAK */
+	int nresend_fast;			/* ... after ACKs of later packets */
+	int nresend_bad;			/* ... after a damaged packet */
+	int nnak;							/* NAKs sent */
+	int nnak_gap;					/* ... for missing packets */
+	int nnak_bad;					/* ... for damaged packets */
+	int maxlen;						/* Packet length that gave the best goodput */
+	int window;						/* ... and window */
+	int nfiles;						/* Files sent */
+	long dbytes;					/* File data bytes ACK'd or received */
+	long dms;							/* ... during the data phase, ms */
+	int dpkts;						/* ... in D packets */
+} ek_stats_t;
+
 int _EK_init(char* root_path, void* priv);
 int _EK_deinit(void);
-uint8_t _EK_start_server(ek_transaction_type_e *type, char **arg, int *nresend);
+uint8_t _EK_start_server(ek_transaction_type_e *type, char **arg, int *nresend, int batch);
 int _EK_get(char *filename);
 int _EK_send(char *filename);
 int _EK_dir(char **result);
 int _EK_init_memory(char *root_path, void* priv);
+void _EK_get_stats(ek_stats_t *stats);
 
 #endif /* __LIBEKERMIT_H__ */
@@ -23,6 +23,9 @@ ULONG kfileinfo(struct k_data *k, UCHAR *filename, UCHAR *buf, int buflen, short
 int kreadfile(struct k_data *k);
 int kwritefile(struct k_data *k, UCHAR *s, int n);
 int kclosefile(struct k_data *k, UCHAR c, int mode);
+long kcrcfile(struct k_data *k, UCHAR *s, long len, ULONG *crc);
+long kclock(struct k_data *k);
+int klinkinfo(struct k_data *k, struct k_link *link);
 int ktx_data(struct k_data *k, UCHAR *p, int n);
 int kreadpkt(struct k_data *k, UCHAR *p, int len);
 int kinchk(struct k_data *k);
@@ -9,6 +9,10 @@ typedef struct unixio_rpi
   int (*ble_mldp_send_bytes)(const uint8_t *p_string, uint32_t length);
   int (*ble_mldp_get_byte)(uint8_t *p_byte);
   void (*ft_wait_ms)(uint32_t timeMS);
+  uint16_t link_mtu;         /* bytes of one ble_mldp_send_bytes() write on the link, 0 if unknown */
+  uint16_t link_interval_ms; /* connection interval */
+  uint16_t link_maxlen;      /* Kermit packet length learned on this link, 0 if none */
+  uint8_t link_window;       /* Kermit window learned on this link, 0 if none */
 } unixio_rpi_t;
 
 #endif
@@ -42,6 +42,7 @@
 typedef enum
 {
 	ft_mode_server,
+	ft_mode_batch, /* Server keeping one session for all the transactions of the client */
 	ft_mode_client
 } ft_mode_e;
 
@@ -54,12 +55,34 @@ typedef enum
 	ft_type_other
 } ft_transaction_type_e;
 
+/*=============================================================================
+ * struct
+ *=============================================================================*/
+typedef struct
+{
+	int nresend;				 /* Packets resent */
+	int nresend_timeout; /* ... after a timeout */
+	int nresend_nak;		 /* ... after a NAK */
+	int nresend_fast;		 /* ... after ACKs of later packets */
+	int nresend_bad;		 /* ... after a damaged packet */
+	int nnak;						 /* NAKs sent */
+	int nnak_gap;				 /* ... for missing packets */
+	int nnak_bad;				 /* ... for damaged packets */
+	int maxlen;					 /* Packet length that gave the best goodput */
+	int window;					 /* ... and window */
+	int nfiles;					 /* Files sent */
+	long dbytes;				 /* File data bytes ACK'd or received */
+	long dms;						 /* ... during the data phase, ms */
+	int dpkts;					 /* ... in D packets */
+} ft_stats_t;
+
 /*=============================================================================
  * function
  *=============================================================================*/
 unsigned char FT_init(ft_mode_e mode, const char *root_path, void *priv);
 unsigned char FT_deinit(void);
 unsigned char FT_start_server(ft_transaction_type_e *type, char **arg, int *nresend);
+unsigned char FT_get_stats(ft_stats_t *stats);
 unsigned char FT_init_memory(void);
 unsigned char FT_get(char *filename);
 unsigned char FT_send(char *filename);
@@ -0,0 +1,26 @@
+#ifndef H_LINK_PROFILE
+#define H_LINK_PROFILE
+
+#include <stdint.h>
+#include <bluetooth/bluetooth.h>
+
+/* Link settings learned on a SLATE, saved in the GATT cache directory */
+struct link_profile
+{
+  uint16_t conn_interval;  /* connection interval of the best session, units of 1.25 ms */
+  uint16_t kermit_maxlen;  /* Kermit packet length of the best session */
+  uint8_t kermit_window;   /* Kermit window of the best session */
+  uint32_t best_goodput;   /* goodput of the best session, bytes/s */
+  uint32_t recent_goodput; /* goodput of the last session, bytes/s */
+  int8_t rssi;             /* RSSI at the last session, 127 if unknown */
+  uint32_t sessions;       /* number of sessions learned */
+};
+
+int link_profile_init(const char *dir);
+int link_profile_load(const bdaddr_t *addr, struct link_profile *prof);
+int link_profile_store(const bdaddr_t *addr, const struct link_profile *prof);
+void link_profile_remove(const bdaddr_t *addr);
+void link_profile_update(struct link_profile *prof, uint16_t conn_interval, uint16_t kermit_maxlen, uint8_t kermit_window,
+                         uint32_t goodput, int8_t rssi);
+
+#endif
@@ -0,0 +1,47 @@
+#ifndef H_PRESENCE
+#define H_PRESENCE
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <bluetooth/bluetooth.h>
+
+/* Number of slots of the presence table (power of 2) */
+#define PRESENCE_TABLE_BITS 14
+#define PRESENCE_TABLE_SIZE (1 << PRESENCE_TABLE_BITS)
+
+/* Default duty cycle of the background passive scan, in ms */
+#define PRESENCE_SCAN_INTERVAL_MS 100
+#define PRESENCE_SCAN_WINDOW_MS 30
+
+/* A device not seen for this time is not considered as present */
+#define PRESENCE_MAX_AGE_MS 1000
+
+/* presence_info_t flags */
+#define PRESENCE_FLAG_CONNECTABLE 0x01
+#define PRESENCE_FLAG_AD_FLAGS 0x02 /* ad_flags is valid */
+
+/** presence_info_t -- last advertising report received from a device
+ * addr -- address of the device
+ * last_seen_ms -- time of the report (CLOCK_MONOTONIC, ms)
+ * rssi -- RSSI of the report in dBm
+ * ad_flags -- value of the Flags AD type, if PRESENCE_FLAG_AD_FLAGS is set
+ * flags -- PRESENCE_FLAG_*
+ **/
+typedef struct
+{
+  bdaddr_t addr;
+  uint64_t last_seen_ms;
+  int8_t rssi;
+  uint8_t ad_flags;
+  uint8_t flags;
+} presence_info_t;
+
+int presence_start(int dev_id, uint16_t interval_ms, uint16_t window_ms);
+void presence_stop(void);
+bool presence_is_running(void);
+bool presence_get(const bdaddr_t *addr, presence_info_t *info);
+int presence_get_fd(void);
+bool presence_get_connectable(uint32_t max_age_ms, presence_info_t *info);
+uint64_t presence_now_ms(void);
+
+#endif
@@ -0,0 +1,353 @@
+/**
+ * Copyright (c) 2016, Innes SA,
+ * All Rights Reserved
+ *
+ * The copyright notice above does not evidence any
+ * actual or intended publication of such source code.
+ */
+
+/**
+ * @file   	allowlist.c
+ * @brief  	Allowlist of the SLATE addresses accepted by the scan
+ * @author 	K. AUDIERNE
+ * @date 	2020-09-10
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <sys/stat.h>
+
+#include "allowlist.h"
+
+/* Bit 48 marks a used slot, so that 00:00:00:00:00:00 is not an empty slot */
+#define ALLOWLIST_KEY_USED (1ULL << 48)
+#define ALLOWLIST_LINE_LEN 128
+
+/** allowlist_table -- open addressing hash set of 48-bit addresses
+ * seq -- odd while the table is written, readers retry on change
+ * count -- number of addresses stored
+ * slots -- keys (address | ALLOWLIST_KEY_USED), 0 if the slot is empty
+ **/
+struct allowlist_table
+{
+  uint32_t seq;
+  uint32_t count;
+  uint64_t slots[ALLOWLIST_TABLE_SIZE];
+};
+
+/* Two tables: readers use the active one while the other is rebuilt */
+static struct allowlist_table m_tables[2];
+static struct allowlist_table *m_active = &m_tables[0];
+
+static char m_source[PATH_MAX];
+static bool m_source_is_file = false;
+static volatile int m_reload_requested = 0;
+static uint32_t m_generation = 0;
+
+/** allowlist_addr_to_key() --  convert a bdaddr_t into a 48-bit integer
+ * Input : addr -- address to convert
+ * Return : the address, b[5] being the most significant byte
+ **/
+uint64_t allowlist_addr_to_key(const bdaddr_t *addr)
+{
+  return ((uint64_t)addr->b[5] << 40) | ((uint64_t)addr->b[4] << 32) |
+         ((uint64_t)addr->b[3] << 24) | ((uint64_t)addr->b[2] << 16) |
+         ((uint64_t)addr->b[1] << 8) | (uint64_t)addr->b[0];
+}
+
+static inline uint32_t allowlist_hash(uint64_t key)
+{
+  return (uint32_t)((key * 0x9E3779B97F4A7C15ULL) >> (64 - ALLOWLIST_TABLE_BITS));
+}
+
+/** parse_addr() --  parse "xx:xx:xx:xx:xx:xx" or "xxxxxxxxxxxx"
+ * Input : str -- string to parse, leading and trailing blanks are ignored
+ * Output : key -- the address as a 48-bit integer
+ * Return : 0 on success, -EINVAL otherwise
+ **/
+static int parse_addr(const char *str, uint64_t *key)
+{
+  uint64_t value = 0;
+  int digits = 0;
+  int pos = 0;
+
+  while (isspace((unsigned char)*str))
+    str++;
+
+  for (; *str != '\0' && !isspace((unsigned char)*str); str++, pos++)
+  {
+    if (*str == ':')
+    {
+      /* separators are only allowed between two bytes */
+      if (pos % 3 != 2)
+        return -EINVAL;
+      continue;
+    }
+    if (!isxdigit((unsigned char)*str) || digits == 12)
+      return -EINVAL;
+    value = (value << 4) | (uint64_t)(isdigit((unsigned char)*str) ? *str - '0' : (tolower((unsigned char)*str) - 'a' + 10));
+    digits++;
+  }
+
+  while (isspace((unsigned char)*str))
+    str++;
+
+  if (digits != 12 || *str != '\0' || (pos != 12 && pos != 17))
+    return -EINVAL;
+
+  *key = value;
+  return 0;
+}
+
+static void table_clear(struct allowlist_table *table)
+{
+  memset(table->slots, 0, sizeof(table->slots));
+  table->count = 0;
+}
+
+/** table_insert() --  add an address in a table, with linear probing
+ * Return : 0 on success (or if already present), -ENOSPC if the table is full
+ **/
+static int table_insert(struct allowlist_table *table, uint64_t key)
+{
+  uint32_t idx;
+
+  if (table->count >= ALLOWLIST_MAX_ENTRIES)
+    return -ENOSPC;
+
+  key |= ALLOWLIST_KEY_USED;
+  for (idx = allowlist_hash(key);; idx = (idx + 1) & (ALLOWLIST_TABLE_SIZE - 1))
+  {
+    if (table->slots[idx] == key)
+      return 0;
+    if (table->slots[idx] == 0)
+    {
+      table->slots[idx] = key;
+      table->count++;
+      return 0;
+    }
+  }
+}
+
+static bool table_lookup(const struct allowlist_table *table, uint64_t key)
+{
+  uint32_t idx;
+  uint64_t slot;
+
+  key |= ALLOWLIST_KEY_USED;
+  for (idx = allowlist_hash(key);; idx = (idx + 1) & (ALLOWLIST_TABLE_SIZE - 1))
+  {
+    slot = __atomic_load_n(&table->slots[idx], __ATOMIC_RELAXED);
+    if (slot == key)
+      return true;
+    if (slot == 0)
+      return false;
+  }
+}
+
+/** table_load_file() --  fill a table from a file, one address per line
+ * Empty lines and lines starting with '#' are ignored.
+ * Return : 0 on success, negative errno otherwise
+ **/
+static int table_load_file(struct allowlist_table *table, const char *path)
+{
+  char line[ALLOWLIST_LINE_LEN];
+  unsigned int line_num = 0;
+  uint64_t key;
+  FILE *fp;
+  char *p;
+  int err = 0;
+
+  fp = fopen(path, "r");
+  if (fp == NULL)
+    return -errno;
+
+  while (fgets(line, sizeof(line), fp) != NULL)
+  {
+    line_num++;
+    for (p = line; isspace((unsigned char)*p); p++)
+      ;
+    if (*p == '\0' || *p == '#')
+      continue;
+
+    if (parse_addr(p, &key) != 0)
+    {
+      printf("allowlist: %s:%u: invalid address ignored\n", path, line_num);
+      continue;
+    }
+
+    err = table_insert(table, key);
+    if (err != 0)
+    {
+      printf("allowlist: %s: more than %d addresses\n", path, ALLOWLIST_MAX_ENTRIES);
+      break;
+    }
+  }
+
+  fclose(fp);
+  return err;
+}
+
+/** allowlist_build() --  build the inactive table from the source and publish it
+ * The active table is kept if the source can not be loaded.
+ * Return : 0 on success, negative errno otherwise
+ **/
+static int allowlist_build(void)
+{
+  struct allowlist_table *next;
+  uint64_t key;
+  int err;
+
+  next = (m_active == &m_tables[0]) ? &m_tables[1] : &m_tables[0];
+
+  /* odd sequence: readers still holding this table will retry */
+  __atomic_store_n(&next->seq, next->seq + 1, __ATOMIC_RELEASE);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+  table_clear(next);
+  if (m_source_is_file)
+  {
+    err = table_load_file(next, m_source);
+  }
+  else
+  {
+    err = parse_addr(m_source, &key);
+    if (err == 0)
+      err = table_insert(next, key);
+  }
+
+  __atomic_store_n(&next->seq, next->seq + 1, __ATOMIC_RELEASE);
+
+  if (err != 0)
+    return err;
+
+  __atomic_store_n(&m_active, next, __ATOMIC_RELEASE);
+  __atomic_add_fetch(&m_generation, 1, __ATOMIC_RELEASE);
+  return 0;
+}
+
+/** allowlist_init() --  load the allowlist
+ * Input : source -- a single MAC address or the path to a file of addresses
+ * Return : 0 on success, negative errno otherwise
+ **/
+int allowlist_init(const char *source)
+{
+  struct stat st;
+  int err;
+
+  if (source == NULL || strlen(source) >= sizeof(m_source))
+    return -EINVAL;
+
+  strcpy(m_source, source);
+  m_source_is_file = (stat(source, &st) == 0 && S_ISREG(st.st_mode));
+
+  err = allowlist_build();
+  if (err == 0)
+  {
+    printf("allowlist: %u address(es) loaded\n", allowlist_count());
+  }
+  return err;
+}
+
+/** allowlist_reload() --  reload the allowlist file, lookups are never blocked
+ * Return : 0 on success, negative errno otherwise (the previous list is kept)
+ **/
+int allowlist_reload(void)
+{
+  int err;
+
+  if (!m_source_is_file)
+    return 0;
+
+  err = allowlist_build();
+  if (err != 0)
+  {
+    printf("allowlist: reload of %s failed (%s), previous list kept\n", m_source, strerror(-err));
+    return err;
+  }
+  printf("allowlist: %u address(es) reloaded\n", allowlist_count());
+  return 0;
+}
+
+/** allowlist_request_reload() --  ask for a reload, safe to call from a signal handler
+ **/
+void allowlist_request_reload(void)
+{
+  m_reload_requested = 1;
+}
+
+/** allowlist_reload_if_requested() --  reload the allowlist if a reload was requested
+ * Return : 0 on success or if nothing to do, negative errno otherwise
+ **/
+int allowlist_reload_if_requested(void)
+{
+  if (!m_reload_requested)
+    return 0;
+
+  m_reload_requested = 0;
+  return allowlist_reload();
+}
+
+/** allowlist_contains() --  check if an address is in the allowlist
+ * No allocation, no lock: it can be used on each advertising report.
+ * Input : addr -- address to look for
+ * Return : true if the address is allowed
+ **/
+bool allowlist_contains(const bdaddr_t *addr)
+{
+  uint64_t key = allowlist_addr_to_key(addr);
+  struct allowlist_table *table;
+  uint32_t seq;
+  bool found;
+
+  do
+  {
+    table = __atomic_load_n(&m_active, __ATOMIC_ACQUIRE);
+    seq = __atomic_load_n(&table->seq, __ATOMIC_ACQUIRE);
+    found = ((seq & 1) == 0) && table_lookup(table, key);
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  } while ((seq & 1) != 0 || __atomic_load_n(&table->seq, __ATOMIC_RELAXED) != seq);
+
+  return found;
+}
+
+/** allowlist_count() --  number of addresses in the active allowlist
+ **/
+uint32_t allowlist_count(void)
+{
+  return __atomic_load_n(&m_active, __ATOMIC_ACQUIRE)->count;
+}
+
+/** allowlist_generation() --  incremented each time a new allowlist is published
+ **/
+uint32_t allowlist_generation(void)
+{
+  return __atomic_load_n(&m_generation, __ATOMIC_ACQUIRE);
+}
+
+/** allowlist_foreach() --  call a function for each address of the active allowlist
+ * Must be called from the thread which reloads the allowlist.
+ * Input : func -- function to call
+ *         user_data -- parameter given to func
+ **/
+void allowlist_foreach(allowlist_func_t func, void *user_data)
+{
+  const struct allowlist_table *table = m_active;
+  bdaddr_t addr;
+  uint32_t idx;
+  int i;
+
+  for (idx = 0; idx < ALLOWLIST_TABLE_SIZE; idx++)
+  {
+    if (table->slots[idx] == 0)
+      continue;
+
+    for (i = 0; i < 6; i++)
+      addr.b[i] = (table->slots[idx] >> (8 * i)) & 0xff;
+    func(&addr, user_data);
+  }
+}
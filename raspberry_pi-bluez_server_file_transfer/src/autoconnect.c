@@ -0,0 +1,398 @@
+/**
+ * Copyright (c) 2016, Innes SA,
+ * All Rights Reserved
+ *
+ * The copyright notice above does not evidence any
+ * actual or intended publication of such source code.
+ */
+
+/**
+ * @file   	autoconnect.c
+ * @brief  	Kernel auto-connect of the allowlist through the MGMT interface
+ * @author 	K. AUDIERNE
+ * @date 	2020-09-10
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <bluetooth/bluetooth.h>
+
+#include "src/shared/mgmt.h"
+#include "allowlist.h"
+#include "autoconnect.h"
+
+/* From lib/mgmt.h, which is not part of bluez_deps */
+#define MGMT_INDEX_NONE 0xFFFF
+#define MGMT_STATUS_SUCCESS 0x00
+#define MGMT_OP_GET_CONNECTIONS 0x0015
+#define MGMT_OP_ADD_DEVICE 0x0033
+#define MGMT_OP_REMOVE_DEVICE 0x0034
+#define MGMT_OP_LOAD_CONN_PARAM 0x0035
+#define MGMT_EV_DEVICE_CONNECTED 0x000B
+
+#define MGMT_ADDR_LE_PUBLIC 0x01
+#define MGMT_ADD_DEVICE_AUTO_CONNECT 0x02
+
+struct mgmt_addr_info
+{
+  bdaddr_t bdaddr;
+  uint8_t type;
+} __attribute__((packed));
+
+struct mgmt_rp_get_connections
+{
+  uint16_t conn_count;
+  struct mgmt_addr_info addr[0];
+} __attribute__((packed));
+
+struct mgmt_cp_add_device
+{
+  struct mgmt_addr_info addr;
+  uint8_t action;
+} __attribute__((packed));
+
+struct mgmt_cp_remove_device
+{
+  struct mgmt_addr_info addr;
+} __attribute__((packed));
+
+struct mgmt_conn_param
+{
+  struct mgmt_addr_info addr;
+  uint16_t min_interval;
+  uint16_t max_interval;
+  uint16_t latency;
+  uint16_t timeout;
+} __attribute__((packed));
+
+struct mgmt_cp_load_conn_param
+{
+  uint16_t param_count;
+  struct mgmt_conn_param params[0];
+} __attribute__((packed));
+
+struct mgmt_ev_device_connected
+{
+  struct mgmt_addr_info addr;
+  uint32_t flags;
+  uint16_t eir_len;
+  uint8_t eir[0];
+} __attribute__((packed));
+
+/* Same connection parameters as le_connection() */
+#define AUTOCONNECT_INTERVAL 0x0006
+#define AUTOCONNECT_LATENCY 0x0000
+#define AUTOCONNECT_TIMEOUT 0x0C80
+
+#define AUTOCONNECT_PARAM_CHUNK 256
+
+static struct mgmt *m_mgmt = NULL;
+static uint16_t m_index = MGMT_INDEX_NONE;
+
+/* Devices registered in the kernel (sorted), and the allowlist to register */
+static uint64_t m_registered[ALLOWLIST_MAX_ENTRIES];
+static uint32_t m_registered_count = 0;
+static uint64_t m_target[ALLOWLIST_MAX_ENTRIES];
+static uint32_t m_target_count = 0;
+static uint32_t m_synced_generation = 0;
+static bool m_resync = false;
+
+static const char m_add_device[] = "Add Device";
+static const char m_remove_device[] = "Remove Device";
+
+static autoconnect_func_t m_connected_func = NULL;
+static void *m_connected_data = NULL;
+
+static unsigned int m_pending = 0;
+static autoconnect_done_func_t m_stop_func = NULL;
+static void *m_stop_data = NULL;
+
+static int key_cmp(const void *a, const void *b)
+{
+  uint64_t ka = *(const uint64_t *)a, kb = *(const uint64_t *)b;
+
+  return (ka > kb) - (ka < kb);
+}
+
+static bool key_in(const uint64_t *keys, uint32_t count, uint64_t key)
+{
+  return bsearch(&key, keys, count, sizeof(uint64_t), key_cmp) != NULL;
+}
+
+static void key_to_mgmt_addr(uint64_t key, struct mgmt_addr_info *addr)
+{
+  int i;
+
+  for (i = 0; i < 6; i++)
+    addr->bdaddr.b[i] = (key >> (8 * i)) & 0xff;
+  addr->type = MGMT_ADDR_LE_PUBLIC;
+}
+
+/* Record the result of an Add Device / Remove Device in m_registered (kept sorted) */
+static void registered_set(uint64_t key, bool registered)
+{
+  uint64_t *p = bsearch(&key, m_registered, m_registered_count, sizeof(uint64_t), key_cmp);
+  uint32_t i;
+
+  if (registered && !p && m_registered_count < ALLOWLIST_MAX_ENTRIES)
+  {
+    for (i = m_registered_count; i > 0 && m_registered[i - 1] > key; i--)
+      m_registered[i] = m_registered[i - 1];
+    m_registered[i] = key;
+    m_registered_count++;
+  }
+  else if (!registered && p)
+  {
+    memmove(p, p + 1, (m_registered + --m_registered_count - p) * sizeof(uint64_t));
+  }
+}
+
+static void target_add(const bdaddr_t *addr, void *user_data)
+{
+  m_target[m_target_count++] = allowlist_addr_to_key(addr);
+}
+
+static void command_cb(uint8_t status, uint16_t length, const void *param, void *user_data)
+{
+  if (status != MGMT_STATUS_SUCCESS)
+  {
+    printf("autoconnect: %s failed (status 0x%02x)\n", (const char *)user_data, status);
+    m_resync = true;
+  }
+}
+
+static void device_cb(uint8_t status, uint16_t length, const void *param, void *user_data)
+{
+  const struct mgmt_addr_info *addr = param;
+
+  command_cb(status, length, param, user_data);
+  if (status == MGMT_STATUS_SUCCESS && length >= sizeof(*addr))
+    registered_set(allowlist_addr_to_key(&addr->bdaddr), (const char *)user_data == m_add_device);
+}
+
+static void connected(const struct mgmt_addr_info *addr)
+{
+  if (addr->type != MGMT_ADDR_LE_PUBLIC || !allowlist_contains(&addr->bdaddr))
+    return;
+
+  if (m_connected_func)
+    m_connected_func(&addr->bdaddr, addr->type, m_connected_data);
+}
+
+static void device_connected_cb(uint16_t index, uint16_t length, const void *param, void *user_data)
+{
+  const struct mgmt_ev_device_connected *ev = param;
+
+  if (length < sizeof(*ev))
+    return;
+
+  connected(&ev->addr);
+}
+
+static void get_connections_cb(uint8_t status, uint16_t length, const void *param, void *user_data)
+{
+  const struct mgmt_rp_get_connections *rp = param;
+  uint16_t i;
+
+  if (status != MGMT_STATUS_SUCCESS || length < sizeof(*rp) ||
+      length < sizeof(*rp) + rp->conn_count * sizeof(struct mgmt_addr_info))
+    return;
+
+  for (i = 0; i < rp->conn_count; i++)
+    connected(&rp->addr[i]);
+}
+
+static void send_command(uint16_t opcode, uint16_t length, const void *param,
+                         mgmt_request_func_t func, const char *name)
+{
+  mgmt_send(m_mgmt, opcode, m_index, length, param, func, (void *)name, NULL);
+}
+
+/** add_devices() --  register new devices, with their connection parameters first
+ * Input : keys -- devices to add
+ *         count -- number of devices, up to AUTOCONNECT_PARAM_CHUNK
+ * Explanation : Load Connection Parameters drops the parameters of the devices that are not
+ * added yet, so the devices of a chunk are added before the parameters of the next one are loaded.
+ **/
+static void add_devices(const uint64_t *keys, uint16_t count)
+{
+  uint8_t buf[sizeof(struct mgmt_cp_load_conn_param) + AUTOCONNECT_PARAM_CHUNK * sizeof(struct mgmt_conn_param)];
+  struct mgmt_cp_load_conn_param *cp = (void *)buf;
+  struct mgmt_cp_add_device add;
+  uint16_t i;
+
+  if (count == 0)
+    return;
+
+  for (i = 0; i < count; i++)
+  {
+    struct mgmt_conn_param *param = &cp->params[i];
+
+    key_to_mgmt_addr(keys[i], &param->addr);
+    param->min_interval = htobs(AUTOCONNECT_INTERVAL);
+    param->max_interval = htobs(AUTOCONNECT_INTERVAL);
+    param->latency = htobs(AUTOCONNECT_LATENCY);
+    param->timeout = htobs(AUTOCONNECT_TIMEOUT);
+  }
+  cp->param_count = htobs(count);
+  send_command(MGMT_OP_LOAD_CONN_PARAM, sizeof(*cp) + count * sizeof(struct mgmt_conn_param), cp, command_cb,
+               "Load Connection Parameters");
+
+  for (i = 0; i < count; i++)
+  {
+    key_to_mgmt_addr(keys[i], &add.addr);
+    add.action = MGMT_ADD_DEVICE_AUTO_CONNECT;
+    send_command(MGMT_OP_ADD_DEVICE, sizeof(add), &add, device_cb, m_add_device);
+  }
+}
+
+/** autoconnect_sync() --  register the allowlist in the kernel
+ * Devices removed from the allowlist are removed from the kernel, new ones are added
+ * with the auto-connect action: the kernel scans in background and connects them.
+ * m_registered only follows the commands the kernel accepted, a failed command
+ * makes autoconnect_update() sync again.
+ **/
+static void autoconnect_sync(void)
+{
+  uint64_t keys[AUTOCONNECT_PARAM_CHUNK];
+  struct mgmt_cp_remove_device rem;
+  uint16_t count = 0;
+  uint32_t i;
+
+  m_resync = false;
+  m_target_count = 0;
+  allowlist_foreach(target_add, NULL);
+  qsort(m_target, m_target_count, sizeof(uint64_t), key_cmp);
+
+  for (i = 0; i < m_registered_count; i++)
+  {
+    if (key_in(m_target, m_target_count, m_registered[i]))
+      continue;
+    key_to_mgmt_addr(m_registered[i], &rem.addr);
+    send_command(MGMT_OP_REMOVE_DEVICE, sizeof(rem), &rem, device_cb, m_remove_device);
+  }
+
+  for (i = 0; i < m_target_count; i++)
+  {
+    if (key_in(m_registered, m_registered_count, m_target[i]))
+      continue;
+    keys[count++] = m_target[i];
+    if (count == AUTOCONNECT_PARAM_CHUNK)
+    {
+      add_devices(keys, count);
+      count = 0;
+    }
+  }
+  add_devices(keys, count);
+
+  m_synced_generation = allowlist_generation();
+}
+
+/** autoconnect_start() --  register the allowlist for the kernel auto-connect
+ * Input : dev_id -- identifier to the local adapter (hci0)
+ *         func -- function called when the kernel has connected a SLATE of the allowlist
+ *         user_data -- parameter given to func
+ * Return : 0 on success, negative errno otherwise
+ **/
+int autoconnect_start(int dev_id, autoconnect_func_t func, void *user_data)
+{
+  if (dev_id < 0)
+    return -ENODEV;
+
+  m_mgmt = mgmt_new_default();
+  if (!m_mgmt)
+  {
+    printf("autoconnect: could not open the MGMT interface\n");
+    return -EIO;
+  }
+
+  m_index = dev_id;
+  m_connected_func = func;
+  m_connected_data = user_data;
+
+  mgmt_register(m_mgmt, MGMT_EV_DEVICE_CONNECTED, m_index, device_connected_cb, NULL, NULL);
+  autoconnect_sync();
+  return 0;
+}
+
+/** autoconnect_update() --  register the allowlist again if it was reloaded or a command failed
+ **/
+void autoconnect_update(void)
+{
+  if (m_mgmt && m_pending == 0 && (m_resync || m_synced_generation != allowlist_generation()))
+    autoconnect_sync();
+}
+
+/** autoconnect_check() --  look for a SLATE already connected by the kernel
+ * A SLATE connected while a file transfer was running with another one is only
+ * reported by this function.
+ **/
+void autoconnect_check(void)
+{
+  if (m_mgmt)
+    mgmt_send(m_mgmt, MGMT_OP_GET_CONNECTIONS, m_index, 0, NULL, get_connections_cb, NULL, NULL);
+}
+
+static void stop_done(void)
+{
+  autoconnect_done_func_t func = m_stop_func;
+
+  mgmt_unref(m_mgmt);
+  m_mgmt = NULL;
+  m_registered_count = 0;
+  m_resync = false;
+  m_stop_func = NULL;
+  if (func)
+    func(m_stop_data);
+}
+
+static void stop_cb(uint8_t status, uint16_t length, const void *param, void *user_data)
+{
+  if (m_pending > 0 && --m_pending == 0)
+    stop_done();
+}
+
+/** autoconnect_stop() --  remove the allowlist from the kernel
+ * Input : func -- function called when it is done
+ *         user_data -- parameter given to func
+ **/
+void autoconnect_stop(autoconnect_done_func_t func, void *user_data)
+{
+  struct mgmt_cp_remove_device rem;
+  uint32_t i;
+
+  m_stop_func = func;
+  m_stop_data = user_data;
+  m_connected_func = NULL;
+
+  if (!m_mgmt)
+  {
+    m_stop_func = NULL;
+    if (func)
+      func(user_data);
+    return;
+  }
+
+  m_pending = 0;
+  for (i = 0; i < m_registered_count; i++)
+  {
+    key_to_mgmt_addr(m_registered[i], &rem.addr);
+    if (mgmt_send(m_mgmt, MGMT_OP_REMOVE_DEVICE, m_index, sizeof(rem), &rem, stop_cb, NULL, NULL) != 0)
+      m_pending++;
+  }
+  /* Add Device still waiting for its reply: the kernel handles the removal after it */
+  for (i = 0; i < m_target_count; i++)
+  {
+    if (key_in(m_registered, m_registered_count, m_target[i]))
+      continue;
+    key_to_mgmt_addr(m_target[i], &rem.addr);
+    if (mgmt_send(m_mgmt, MGMT_OP_REMOVE_DEVICE, m_index, sizeof(rem), &rem, stop_cb, NULL, NULL) != 0)
+      m_pending++;
+  }
+
+  if (m_pending == 0)
+    stop_done();
+}
@@ -13,14 +13,29 @@
  * @date 	2020-09-10
  */
 
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
 
 #include "file_transfer_task.h"
 #include <stdbool.h>
 #include <signal.h>
 
+/* Sessions waiting for the file transfer thread, the Kermit state allows one transfer at a time */
+static ft_t *m_queue[FT_QUEUE_LEN];
+static unsigned int m_queue_head = 0;
+static unsigned int m_queue_count = 0;
+static pthread_mutex_t m_queue_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t m_queue_cond = PTHREAD_COND_INITIALIZER;
+
+static pthread_t m_ft_task_id;
+static ft_t *m_current = NULL; //session served by the file transfer thread
+static int m_done_fds[2] = {-1, -1}; //the ft_t of each transfer done is written in this pipe
+
 /** file_transfer_sig_handler -- function executed by the thread created in file_transfer_start_server()
  * Input: signum -- number of the signal received
  **/
@@ -32,22 +47,36 @@ void file_transfer_sig_handler(int signum)
   }
 }
 
-/** ft_task -- function executed by the thread created in file_transfer_start_server()
- * Input: arg -- parameter of the function
+/** ft_now_ms -- monotonic time in milliseconds, to measure the transactions
  **/
-void *ft_task(void *arg)
+static uint32_t ft_now_ms(void)
 {
+  struct timespec ts;
 
-  ft_t *p_ft_s = (ft_t *)arg;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint32_t)(ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+}
+
+/** ft_session -- Kermit server of one connection, until the client did a GET or an error
+ * In batch mode the session goes on after a GET, until the client ends it, disconnects or
+ * stays idle: these ends are not errors once a transaction has been served.
+ * Input: p_ft_s -- file transfer structure of the session
+ **/
+static void ft_session(ft_t *p_ft_s)
+{
   char *result = NULL;
   ft_transaction_type_e type;
   int32_t nresend = 0;
+  ft_stats_t stats = {0};
   uint32_t err_code;
   unsigned char err = 0;
+  uint32_t served = 0, nfiles = 0, start_ms;
 
   const char *file_transfer_path = "img/";
 
-  err_code = (uint32_t)FT_init(ft_mode_server, file_transfer_path, (void *)(&(p_ft_s->kermit_handler_s)));
+  p_ft_s->busy_ms = 0;
+  err_code = (uint32_t)FT_init(p_ft_s->batch ? ft_mode_batch : ft_mode_server, file_transfer_path,
+                               (void *)(&(p_ft_s->kermit_handler_s)));
   if (err_code != FT_SUCCESS)
   {
     printf("file_transfer_init init err_code %u.", err_code);
@@ -56,6 +85,7 @@ void *ft_task(void *arg)
   while (true)
   {
     signal(SIGINT, &file_transfer_sig_handler);
+    start_ms = ft_now_ms();
     err = FT_start_server(&type, &result, &nresend);
     switch (type)
     {
@@ -85,6 +115,12 @@ void *ft_task(void *arg)
       printf("Client ended protocol.");
     }
 
+    if (err && p_ft_s->batch && served > 0 && type == ft_type_other)
+    {
+      printf(" Batch session over after %u transactions\n", served);
+      err = 0;
+      break;
+    }
     if (err)
     {
       printf("Error during protocol.");
@@ -109,11 +145,30 @@ void *ft_task(void *arg)
       break;
     }
     printf(" and it succeded after %d resend\n", nresend);
-    if (flag == 1)
+    p_ft_s->busy_ms += ft_now_ms() - start_ms;
+    served++;
+    if (FT_get_stats(&stats) == FT_SUCCESS)
+    {
+      nfiles += stats.nfiles;
+      /* the link profile learns from the last transaction with file data, not from a DIR */
+      if (served == 1 || stats.dbytes > 0)
+        p_ft_s->stats = stats; /* the idle end of a batch session must not replace them */
+      if (nresend > 0)
+        printf("Resends: %d timeout, %d NAK, %d fast, %d damaged\n", stats.nresend_timeout, stats.nresend_nak,
+               stats.nresend_fast, stats.nresend_bad);
+    }
+    if (p_ft_s->batch ? (type == ft_type_end) : (flag == 1))
     {
       break;
     }
   }
+  /* read by the mainloop when the session is done */
+  p_ft_s->err = err;
+  if ((served == 0 || err) && FT_get_stats(&p_ft_s->stats) != FT_SUCCESS)
+    memset(&p_ft_s->stats, 0, sizeof(p_ft_s->stats));
+  p_ft_s->stats.nfiles = nfiles;
+  if (nfiles > 1)
+    printf("%u files sent in %u ms\n", nfiles, p_ft_s->busy_ms);
   err_code = (uint32_t)FT_deinit();
   if (err_code != FT_SUCCESS)
   {
@@ -121,15 +176,91 @@ void *ft_task(void *arg)
   }
 }
 
-/** file_transfer_start_server -- Create the file transfer thread
- * Input: p_ft_s -- file transfer structure
+/** ft_task -- function executed by the thread created in file_transfer_init_thread()
+ * Input: arg -- unused
+ * Explanation : The sessions given to file_transfer_start_server() are served one after the other,
+ * the end of each one is reported through the pipe returned by file_transfer_init_thread().
  **/
-int file_transfer_start_server(ft_t *p_ft_s)
+void *ft_task(void *arg)
 {
-  if (pthread_create(&p_ft_s->ft_task_id, NULL, ft_task, (void *)p_ft_s) != 0)
+  ft_t *p_ft_s;
+
+  while (true)
+  {
+    pthread_mutex_lock(&m_queue_mutex);
+    while (m_queue_count == 0)
+      pthread_cond_wait(&m_queue_cond, &m_queue_mutex);
+    p_ft_s = m_queue[m_queue_head];
+    m_queue_head = (m_queue_head + 1) % FT_QUEUE_LEN;
+    m_queue_count--;
+    pthread_mutex_unlock(&m_queue_mutex);
+
+    m_current = p_ft_s;
+    ft_session(p_ft_s);
+    m_current = NULL;
+
+    if (write(m_done_fds[1], &p_ft_s, sizeof(p_ft_s)) != sizeof(p_ft_s))
+      printf("FAILED TO REPORT THE END OF FT_TASK");
+  }
+  return NULL;
+}
+
+/** file_transfer_init_thread -- Create the file transfer thread, once for all the sessions
+ * Return: file descriptor readable when a transfer is done (see file_transfer_get_done()), -1 on error
+ **/
+int file_transfer_init_thread(void)
+{
+  if (pipe2(m_done_fds, O_CLOEXEC) < 0)
+    return -1;
+
+  if (pthread_create(&m_ft_task_id, NULL, ft_task, NULL) != 0)
   {
     printf("FAILED TO CREATE FT_TASK");
+    close(m_done_fds[0]);
+    close(m_done_fds[1]);
     return -1;
   }
-  return 0;
+  return m_done_fds[0];
+}
+
+/** file_transfer_get_done -- Read the session of a transfer done
+ * Input: fd -- file descriptor returned by file_transfer_init_thread()
+ * Return: file transfer structure given to file_transfer_start_server(), NULL on error
+ **/
+ft_t *file_transfer_get_done(int fd)
+{
+  ft_t *p_ft_s;
+
+  if (read(fd, &p_ft_s, sizeof(p_ft_s)) != sizeof(p_ft_s))
+    return NULL;
+  return p_ft_s;
+}
+
+/** file_transfer_current -- Session served by the file transfer thread
+ * Return: file transfer structure, only valid when called from the Kermit callbacks
+ **/
+ft_t *file_transfer_current(void)
+{
+  return m_current;
+}
+
+/** file_transfer_start_server -- Give a session to the file transfer thread
+ * Input: p_ft_s -- file transfer structure, used until it is returned by file_transfer_get_done()
+ * Return: 0 on success, -1 if too many sessions are waiting
+ **/
+int file_transfer_start_server(ft_t *p_ft_s)
+{
+  int err = 0;
+
+  pthread_mutex_lock(&m_queue_mutex);
+  if (m_queue_count == FT_QUEUE_LEN)
+    err = -1;
+  else
+  {
+    m_queue[(m_queue_head + m_queue_count) % FT_QUEUE_LEN] = p_ft_s;
+    m_queue_count++;
+    pthread_cond_signal(&m_queue_cond);
+  }
+  pthread_mutex_unlock(&m_queue_mutex);
+  return err;
 }
\ No newline at end of file
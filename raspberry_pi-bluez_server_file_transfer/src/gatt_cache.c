@@ -0,0 +1,436 @@
+/**
+ * Copyright (c) 2016, Innes SA,
+ * All Rights Reserved
+ *
+ * The copyright notice above does not evidence any
+ * actual or intended publication of such source code.
+ */
+
+/**
+ * @file   	gatt_cache.c
+ * @brief  	Persistent cache of the GATT database of each SLATE, validated by its Database Hash
+ * @author 	K. AUDIERNE
+ * @date 	2020-09-10
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include <bluetooth/bluetooth.h>
+
+#include "uuid.h"
+#include "queue.h"
+#include "att.h"
+#include "gatt-db.h"
+#include "gatt_cache.h"
+
+#define GATT_CACHE_LINE_LEN 256
+#define GATT_CACHE_VALUE_MAX 32
+
+/* File format, one attribute per line, handles in hexadecimal:
+ *   hash <Database Hash of the SLATE>
+ *   local <gatt_db_get_hash() of the stored database, checked after loading>
+ *   service <start> <end> <primary> <uuid>
+ *   char <value handle> <properties> <uuid>
+ *   desc <handle> <uuid> [value]
+ */
+
+static char m_dir[PATH_MAX] = "";
+
+struct store_data
+{
+  FILE *fp;
+  int err;
+};
+
+static void hex_write(FILE *fp, const uint8_t *data, size_t len)
+{
+  size_t i;
+
+  for (i = 0; i < len; i++)
+    fprintf(fp, "%02x", data[i]);
+}
+
+static int hex_parse(const char *str, uint8_t *data, size_t max_len)
+{
+  size_t len = 0;
+  unsigned int byte;
+
+  while (str[0] != '\0' && str[0] != '\n' && len < max_len)
+  {
+    if (sscanf(str, "%2x", &byte) != 1)
+      return -EINVAL;
+    data[len++] = byte;
+    str += 2;
+  }
+  return len;
+}
+
+static int cache_path(const bdaddr_t *addr, char *path, size_t size)
+{
+  char str[18];
+
+  if (m_dir[0] == '\0')
+    return -ENOENT;
+
+  ba2str(addr, str);
+  if (snprintf(path, size, "%s/%s", m_dir, str) >= (int)size)
+    return -ENAMETOOLONG;
+  return 0;
+}
+
+static void read_value_cb(struct gatt_db_attribute *attrib, int err, const uint8_t *value, size_t length, void *user_data)
+{
+  struct iovec *iov = user_data;
+
+  if (err)
+    return;
+
+  iov->iov_base = (void *)value;
+  iov->iov_len = length;
+}
+
+static void write_value_cb(struct gatt_db_attribute *attrib, int err, void *user_data)
+{
+  int *p_err = user_data;
+
+  *p_err = err;
+}
+
+static void get_first_attribute(struct gatt_db_attribute *attrib, void *user_data)
+{
+  struct gatt_db_attribute **stored = user_data;
+
+  if (*stored == NULL)
+    *stored = attrib;
+}
+
+static struct gatt_db_attribute *find_db_hash(struct gatt_db *db)
+{
+  struct gatt_db_attribute *attr = NULL;
+  bt_uuid_t uuid;
+
+  bt_uuid16_create(&uuid, GATT_CHARAC_DB_HASH);
+  gatt_db_find_by_type(db, 0x0001, 0xffff, &uuid, get_first_attribute, &attr);
+  return attr;
+}
+
+/** gatt_cache_get_peer_hash() --  Database Hash of the SLATE, as read by bt_gatt_client
+ * Input : db -- client database
+ * Output : hash -- value of the Database Hash characteristic
+ * Return : true if the SLATE has a Database Hash and it was read
+ **/
+bool gatt_cache_get_peer_hash(struct gatt_db *db, uint8_t hash[GATT_CACHE_HASH_LEN])
+{
+  struct gatt_db_attribute *attr = find_db_hash(db);
+  struct iovec iov = {NULL, 0};
+
+  if (attr == NULL)
+    return false;
+
+  gatt_db_attribute_read(attr, 0, BT_ATT_OP_READ_REQ, NULL, read_value_cb, &iov);
+  if (iov.iov_len != GATT_CACHE_HASH_LEN)
+    return false;
+
+  memcpy(hash, iov.iov_base, GATT_CACHE_HASH_LEN);
+  return true;
+}
+
+static void store_desc(struct gatt_db_attribute *attr, void *user_data)
+{
+  struct store_data *data = user_data;
+  const bt_uuid_t *uuid = gatt_db_attribute_get_type(attr);
+  struct iovec iov = {NULL, 0};
+  char str[MAX_LEN_UUID_STR];
+  bt_uuid_t ext_prop_uuid;
+
+  bt_uuid_to_string(uuid, str, sizeof(str));
+  fprintf(data->fp, "desc %04x %s", gatt_db_attribute_get_handle(attr), str);
+
+  /* the extended properties are needed by gatt_db_attribute_get_char_data() */
+  bt_uuid16_create(&ext_prop_uuid, GATT_CHARAC_EXT_PROPER_UUID);
+  if (bt_uuid_cmp(uuid, &ext_prop_uuid) == 0)
+  {
+    gatt_db_attribute_read(attr, 0, BT_ATT_OP_READ_REQ, NULL, read_value_cb, &iov);
+    if (iov.iov_len > 0 && iov.iov_len <= GATT_CACHE_VALUE_MAX)
+    {
+      fprintf(data->fp, " ");
+      hex_write(data->fp, iov.iov_base, iov.iov_len);
+    }
+  }
+  fprintf(data->fp, "\n");
+}
+
+static void store_chrc(struct gatt_db_attribute *attr, void *user_data)
+{
+  struct store_data *data = user_data;
+  uint16_t handle, value_handle, ext_prop;
+  char str[MAX_LEN_UUID_STR];
+  uint8_t properties;
+  bt_uuid_t uuid;
+
+  if (!gatt_db_attribute_get_char_data(attr, &handle, &value_handle, &properties, &ext_prop, &uuid))
+  {
+    data->err = -EINVAL;
+    return;
+  }
+
+  bt_uuid_to_string(&uuid, str, sizeof(str));
+  fprintf(data->fp, "char %04x %02x %s\n", value_handle, properties, str);
+  gatt_db_service_foreach_desc(attr, store_desc, data);
+}
+
+static void store_incl(struct gatt_db_attribute *attr, void *user_data)
+{
+  struct store_data *data = user_data;
+
+  /* included services are not cached, the SLATE has none */
+  data->err = -ENOTSUP;
+}
+
+static void store_service(struct gatt_db_attribute *attr, void *user_data)
+{
+  struct store_data *data = user_data;
+  char str[MAX_LEN_UUID_STR];
+  uint16_t start, end;
+  bool primary;
+  bt_uuid_t uuid;
+
+  if (!gatt_db_attribute_get_service_data(attr, &start, &end, &primary, &uuid))
+  {
+    data->err = -EINVAL;
+    return;
+  }
+
+  bt_uuid_to_string(&uuid, str, sizeof(str));
+  fprintf(data->fp, "service %04x %04x %d %s\n", start, end, primary, str);
+  gatt_db_service_foreach_incl(attr, store_incl, data);
+  gatt_db_service_foreach_char(attr, store_chrc, data);
+}
+
+/** gatt_cache_store() --  save the client database of a SLATE
+ * Input : db -- client database, discovered by bt_gatt_client
+ *         addr -- address of the SLATE
+ * Return : 0 on success, negative errno otherwise
+ * Explanation : The database is only saved if the SLATE has a Database Hash,
+ * which is needed to validate the cache on the next connection.
+ **/
+int gatt_cache_store(struct gatt_db *db, const bdaddr_t *addr)
+{
+  char path[PATH_MAX], tmp_path[PATH_MAX + 4];
+  uint8_t hash[GATT_CACHE_HASH_LEN];
+  struct store_data data;
+  uint8_t *local_hash;
+  int err;
+
+  err = cache_path(addr, path, sizeof(path));
+  if (err != 0)
+    return err;
+
+  if (!gatt_cache_get_peer_hash(db, hash))
+    return -ENOENT;
+
+  local_hash = gatt_db_get_hash(db);
+  if (local_hash == NULL)
+    return -EIO;
+
+  /* written in a temporary file, so that a partial file is never loaded */
+  snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+  data.fp = fopen(tmp_path, "w");
+  if (data.fp == NULL)
+    return -errno;
+  data.err = 0;
+
+  fprintf(data.fp, "hash ");
+  hex_write(data.fp, hash, GATT_CACHE_HASH_LEN);
+  fprintf(data.fp, "\nlocal ");
+  hex_write(data.fp, local_hash, GATT_CACHE_HASH_LEN);
+  fprintf(data.fp, "\n");
+  gatt_db_foreach_service(db, NULL, store_service, &data);
+
+  if (fclose(data.fp) != 0 && data.err == 0)
+    data.err = -errno;
+  if (data.err == 0 && rename(tmp_path, path) != 0)
+    data.err = -errno;
+  if (data.err != 0)
+  {
+    unlink(tmp_path);
+    return data.err;
+  }
+
+  printf("gatt_cache: database of %s saved\n", strrchr(path, '/') + 1);
+  return 0;
+}
+
+static void activate_service(void *data, void *user_data)
+{
+  gatt_db_service_set_active(data, true);
+}
+
+/** load_line() --  add the attribute of a line of the cache file in the database
+ * Input : db -- database to fill
+ *         line -- line of the cache file
+ *         service -- current service, updated on a service line
+ *         services -- services added
+ * Output : hash, local_hash -- hashes read in the file
+ * Return : 0 on success, -EINVAL otherwise
+ **/
+static int load_line(struct gatt_db *db, const char *line, struct gatt_db_attribute **service, struct queue *services,
+                     uint8_t *hash, uint8_t *local_hash)
+{
+  char uuid_str[MAX_LEN_UUID_STR], value_str[2 * GATT_CACHE_VALUE_MAX + 1];
+  uint8_t value[GATT_CACHE_VALUE_MAX];
+  unsigned int start, end, primary, properties;
+  struct gatt_db_attribute *attr;
+  bt_uuid_t uuid;
+  int len, err = 0;
+
+  if (sscanf(line, "hash %32s", value_str) == 1)
+    return hex_parse(value_str, hash, GATT_CACHE_HASH_LEN) == GATT_CACHE_HASH_LEN ? 0 : -EINVAL;
+
+  if (sscanf(line, "local %32s", value_str) == 1)
+    return hex_parse(value_str, local_hash, GATT_CACHE_HASH_LEN) == GATT_CACHE_HASH_LEN ? 0 : -EINVAL;
+
+  if (sscanf(line, "service %4x %4x %u %36s", &start, &end, &primary, uuid_str) == 4)
+  {
+    if (end < start || bt_string_to_uuid(&uuid, uuid_str) != 0)
+      return -EINVAL;
+    *service = gatt_db_insert_service(db, start, &uuid, primary, end - start + 1);
+    if (*service == NULL)
+      return -EINVAL;
+    queue_push_tail(services, *service);
+    return 0;
+  }
+
+  if (sscanf(line, "char %4x %2x %36s", &start, &properties, uuid_str) == 3)
+  {
+    if (*service == NULL || bt_string_to_uuid(&uuid, uuid_str) != 0)
+      return -EINVAL;
+    attr = gatt_db_service_insert_characteristic(*service, start, &uuid, 0, properties, NULL, NULL, NULL);
+    return attr ? 0 : -EINVAL;
+  }
+
+  value_str[0] = '\0';
+  if (sscanf(line, "desc %4x %36s %64s", &start, uuid_str, value_str) >= 2)
+  {
+    if (*service == NULL || bt_string_to_uuid(&uuid, uuid_str) != 0)
+      return -EINVAL;
+    attr = gatt_db_service_insert_descriptor(*service, start, &uuid, 0, NULL, NULL, NULL);
+    if (attr == NULL)
+      return -EINVAL;
+    if (value_str[0] == '\0')
+      return 0;
+
+    len = hex_parse(value_str, value, sizeof(value));
+    if (len <= 0)
+      return -EINVAL;
+    gatt_db_attribute_write(attr, 0, value, len, 0, NULL, write_value_cb, &err);
+    return err ? -EINVAL : 0;
+  }
+
+  return -EINVAL;
+}
+
+/** gatt_cache_load() --  fill the client database from the cache of a SLATE
+ * Input : db -- empty client database, given to bt_gatt_client_new() afterwards
+ *         addr -- address of the SLATE
+ * Output : hash -- Database Hash of the cached database
+ * Return : 0 on success, negative errno otherwise (the database is left empty)
+ * Explanation : bt_gatt_client reads the Database Hash of the SLATE when the database is not
+ * empty, and skips the discovery if it is the one stored in the database.
+ **/
+int gatt_cache_load(struct gatt_db *db, const bdaddr_t *addr, uint8_t hash[GATT_CACHE_HASH_LEN])
+{
+  uint8_t local_hash[GATT_CACHE_HASH_LEN], *db_hash;
+  struct gatt_db_attribute *service = NULL, *attr;
+  char path[PATH_MAX], line[GATT_CACHE_LINE_LEN];
+  struct queue *services;
+  int err = 0, write_err = 0;
+  bool hash_read = false;
+  FILE *fp;
+
+  err = cache_path(addr, path, sizeof(path));
+  if (err != 0)
+    return err;
+
+  fp = fopen(path, "r");
+  if (fp == NULL)
+    return -errno;
+
+  memset(hash, 0, GATT_CACHE_HASH_LEN);
+  memset(local_hash, 0, sizeof(local_hash));
+  services = queue_new();
+  while (err == 0 && fgets(line, sizeof(line), fp) != NULL)
+  {
+    err = load_line(db, line, &service, services, hash, local_hash);
+    if (err == 0 && strncmp(line, "hash ", 5) == 0)
+      hash_read = true;
+  }
+  fclose(fp);
+
+  queue_foreach(services, activate_service, NULL);
+  queue_destroy(services, NULL);
+
+  /* the file must describe the database it was saved from */
+  db_hash = gatt_db_get_hash(db);
+  if (err == 0 && (!hash_read || db_hash == NULL || memcmp(db_hash, local_hash, sizeof(local_hash)) != 0))
+    err = -EINVAL;
+
+  if (err == 0)
+  {
+    attr = find_db_hash(db);
+    if (attr == NULL)
+      err = -EINVAL;
+    else
+      gatt_db_attribute_write(attr, 0, hash, GATT_CACHE_HASH_LEN, 0, NULL, write_value_cb, &write_err);
+    if (write_err != 0)
+      err = -EIO;
+  }
+
+  if (err != 0)
+  {
+    printf("gatt_cache: invalid cache %s removed\n", path);
+    gatt_db_clear(db);
+    unlink(path);
+    return err;
+  }
+  return 0;
+}
+
+/** gatt_cache_remove() --  remove the cache of a SLATE
+ * Input : addr -- address of the SLATE
+ **/
+void gatt_cache_remove(const bdaddr_t *addr)
+{
+  char path[PATH_MAX];
+
+  if (cache_path(addr, path, sizeof(path)) == 0)
+    unlink(path);
+}
+
+/** gatt_cache_init() --  set the directory of the cache
+ * Input : dir -- directory, created if it does not exist
+ * Return : 0 on success, negative errno otherwise (the cache is disabled)
+ **/
+int gatt_cache_init(const char *dir)
+{
+  struct stat st;
+
+  m_dir[0] = '\0';
+  if (dir == NULL || strlen(dir) >= sizeof(m_dir))
+    return -EINVAL;
+
+  if (mkdir(dir, 0755) != 0 && errno != EEXIST)
+    return -errno;
+  if (stat(dir, &st) != 0 || !S_ISDIR(st.st_mode))
+    return -ENOTDIR;
+
+  strcpy(m_dir, dir);
+  return 0;
+}
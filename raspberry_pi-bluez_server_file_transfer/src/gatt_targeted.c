@@ -0,0 +1,284 @@
+/**
+ * Copyright (c) 2016, Innes SA,
+ * All Rights Reserved
+ *
+ * The copyright notice above does not evidence any
+ * actual or intended publication of such source code.
+ */
+
+/**
+ * @file   	gatt_targeted.c
+ * @brief  	Discovery of given primary services only, and writes without bt_gatt_client
+ * @author 	K. AUDIERNE
+ * @date 	2020-09-10
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <bluetooth/bluetooth.h>
+#include "uuid.h"
+#include "util.h"
+#include "att.h"
+#include "queue.h"
+#include "gatt-db.h"
+#include "gatt-helpers.h"
+#include "gatt_targeted.h"
+
+/** discovery -- state of the discovery in progress
+ * The services are discovered one UUID after the other with Discover Primary Service By
+ * Service UUID, then the characteristics of each service found. Descriptors are not discovered.
+ **/
+static struct
+{
+  struct bt_att *att;
+  struct gatt_db *db;
+  bt_uuid_t uuids[GATT_TARGETED_MAX_SERVICES];
+  unsigned int count;
+  unsigned int index;
+  struct bt_gatt_request *req;
+
+  /* services found for the current UUID */
+  uint16_t starts[GATT_TARGETED_MAX_SERVICES];
+  uint16_t ends[GATT_TARGETED_MAX_SERVICES];
+  unsigned int svc_count;
+  unsigned int svc_index;
+
+  gatt_targeted_func_t func;
+  void *user_data;
+} m_disc;
+
+struct write_req
+{
+  gatt_targeted_func_t func;
+  void *user_data;
+};
+
+static void discover_next_uuid(void);
+static void discover_next_service(void);
+
+static void req_clear(void)
+{
+  if (m_disc.req == NULL)
+    return;
+
+  bt_gatt_request_unref(m_disc.req);
+  m_disc.req = NULL;
+}
+
+static void discovery_complete(bool success, uint8_t att_ecode)
+{
+  gatt_targeted_func_t func = m_disc.func;
+
+  m_disc.func = NULL;
+  if (func)
+    func(success, att_ecode, m_disc.user_data);
+}
+
+static void discover_chrcs_cb(bool success, uint8_t att_ecode, struct bt_gatt_result *result, void *user_data)
+{
+  uint16_t start = m_disc.starts[m_disc.svc_index], end = m_disc.ends[m_disc.svc_index];
+  uint16_t chrc_start, chrc_end, value_handle;
+  struct gatt_db_attribute *service;
+  struct bt_gatt_iter iter;
+  uint8_t properties;
+  uint128_t u128;
+  bt_uuid_t uuid;
+
+  req_clear();
+
+  if (!success && att_ecode != BT_ATT_ERROR_ATTRIBUTE_NOT_FOUND)
+  {
+    discovery_complete(false, att_ecode);
+    return;
+  }
+
+  service = gatt_db_insert_service(m_disc.db, start, &m_disc.uuids[m_disc.index], true, end - start + 1);
+  if (service == NULL)
+  {
+    discovery_complete(false, BT_ATT_ERROR_UNLIKELY);
+    return;
+  }
+
+  if (success && bt_gatt_iter_init(&iter, result))
+  {
+    while (bt_gatt_iter_next_characteristic(&iter, &chrc_start, &chrc_end, &value_handle, &properties, u128.data))
+    {
+      bt_uuid128_create(&uuid, u128);
+      if (!gatt_db_service_insert_characteristic(service, value_handle, &uuid, 0, properties, NULL, NULL, NULL))
+      {
+        discovery_complete(false, BT_ATT_ERROR_UNLIKELY);
+        return;
+      }
+    }
+  }
+
+  gatt_db_service_set_active(service, true);
+  m_disc.svc_index++;
+  discover_next_service();
+}
+
+/** discover_next_service() --  discover the characteristics of the next service found
+ **/
+static void discover_next_service(void)
+{
+  if (m_disc.svc_index == m_disc.svc_count)
+  {
+    m_disc.index++;
+    discover_next_uuid();
+    return;
+  }
+
+  /* a service made of its declaration only has no characteristic */
+  if (m_disc.starts[m_disc.svc_index] == m_disc.ends[m_disc.svc_index])
+  {
+    discover_chrcs_cb(false, BT_ATT_ERROR_ATTRIBUTE_NOT_FOUND, NULL, NULL);
+    return;
+  }
+
+  m_disc.req = bt_gatt_discover_characteristics(m_disc.att, m_disc.starts[m_disc.svc_index] + 1,
+                                                m_disc.ends[m_disc.svc_index], discover_chrcs_cb, NULL, NULL);
+  if (m_disc.req == NULL)
+    discovery_complete(false, BT_ATT_ERROR_UNLIKELY);
+}
+
+static void discover_primary_cb(bool success, uint8_t att_ecode, struct bt_gatt_result *result, void *user_data)
+{
+  struct bt_gatt_iter iter;
+  uint16_t start, end;
+  uint128_t u128;
+
+  req_clear();
+
+  if (!success || !bt_gatt_iter_init(&iter, result))
+  {
+    /* a missing service is an error: all the requested services are needed */
+    discovery_complete(false, att_ecode);
+    return;
+  }
+
+  m_disc.svc_count = 0;
+  m_disc.svc_index = 0;
+  while (m_disc.svc_count < GATT_TARGETED_MAX_SERVICES && bt_gatt_iter_next_service(&iter, &start, &end, u128.data))
+  {
+    if (end < start)
+      continue;
+    m_disc.starts[m_disc.svc_count] = start;
+    m_disc.ends[m_disc.svc_count] = end;
+    m_disc.svc_count++;
+  }
+
+  discover_next_service();
+}
+
+/** discover_next_uuid() --  look for the services of the next UUID
+ **/
+static void discover_next_uuid(void)
+{
+  if (m_disc.index == m_disc.count)
+  {
+    discovery_complete(true, 0);
+    return;
+  }
+
+  m_disc.req = bt_gatt_discover_primary_services(m_disc.att, &m_disc.uuids[m_disc.index], 0x0001, 0xffff,
+                                                 discover_primary_cb, NULL, NULL);
+  if (m_disc.req == NULL)
+    discovery_complete(false, BT_ATT_ERROR_UNLIKELY);
+}
+
+/** gatt_targeted_discover() --  discover the given primary services and their characteristics
+ * Input : att -- ATT bearer
+ *         db -- empty database, filled with the services found
+ *         uuids -- UUID of the services to discover
+ *         count -- number of UUIDs, up to GATT_TARGETED_MAX_SERVICES
+ *         func -- called when the discovery is done, with the same parameters as a bt_gatt_client ready callback
+ *         user_data -- parameter given to func
+ * Return : true if the discovery is started
+ **/
+bool gatt_targeted_discover(struct bt_att *att, struct gatt_db *db, const bt_uuid_t *uuids, unsigned int count,
+                            gatt_targeted_func_t func, void *user_data)
+{
+  if (att == NULL || db == NULL || count == 0 || count > GATT_TARGETED_MAX_SERVICES)
+    return false;
+
+  gatt_targeted_cancel();
+  m_disc.att = att;
+  m_disc.db = db;
+  memcpy(m_disc.uuids, uuids, count * sizeof(bt_uuid_t));
+  m_disc.count = count;
+  m_disc.index = 0;
+  m_disc.func = func;
+  m_disc.user_data = user_data;
+
+  discover_next_uuid();
+  return true;
+}
+
+/** gatt_targeted_cancel() --  stop the discovery in progress, its callback is not called
+ **/
+void gatt_targeted_cancel(void)
+{
+  if (m_disc.req)
+    bt_gatt_request_cancel(m_disc.req);
+  req_clear();
+  m_disc.func = NULL;
+}
+
+static void write_rsp_cb(uint8_t opcode, const void *pdu, uint16_t length, void *user_data)
+{
+  struct write_req *req = user_data;
+  uint8_t att_ecode = 0;
+
+  if (opcode == BT_ATT_OP_ERROR_RSP)
+    att_ecode = (length >= 4) ? ((const uint8_t *)pdu)[3] : BT_ATT_ERROR_UNLIKELY;
+
+  if (req->func)
+    req->func(opcode == BT_ATT_OP_WRITE_RSP, att_ecode, req->user_data);
+}
+
+static unsigned int write_send(struct bt_att *att, uint8_t opcode, uint16_t handle, const uint8_t *value, uint16_t length,
+                               struct write_req *req)
+{
+  uint8_t pdu[BT_ATT_MAX_LE_MTU];
+
+  if (att == NULL || length > sizeof(pdu) - 2)
+    return 0;
+
+  put_le16(handle, pdu);
+  memcpy(pdu + 2, value, length);
+
+  if (req == NULL)
+    return bt_att_send(att, opcode, pdu, length + 2, NULL, NULL, NULL);
+  return bt_att_send(att, opcode, pdu, length + 2, write_rsp_cb, req, free);
+}
+
+/** gatt_targeted_write() --  Write Request, the equivalent of bt_gatt_client_write_value()
+ * Return : the ATT request identifier, 0 on error
+ **/
+unsigned int gatt_targeted_write(struct bt_att *att, uint16_t handle, const uint8_t *value, uint16_t length,
+                                 gatt_targeted_func_t func, void *user_data)
+{
+  struct write_req *req;
+  unsigned int id;
+
+  req = new0(struct write_req, 1);
+  if (req == NULL)
+    return 0;
+
+  req->func = func;
+  req->user_data = user_data;
+  id = write_send(att, BT_ATT_OP_WRITE_REQ, handle, value, length, req);
+  if (id == 0)
+    free(req);
+  return id;
+}
+
+/** gatt_targeted_write_cmd() --  Write Command, the equivalent of bt_gatt_client_write_without_response()
+ * Return : the ATT identifier, 0 on error
+ **/
+unsigned int gatt_targeted_write_cmd(struct bt_att *att, uint16_t handle, const uint8_t *value, uint16_t length)
+{
+  return write_send(att, BT_ATT_OP_WRITE_CMD, handle, value, length, NULL);
+}
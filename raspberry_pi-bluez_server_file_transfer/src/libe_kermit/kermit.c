@@ -99,18 +99,28 @@ STATIC ULONG stringnum(UCHAR *, struct k_data *);
 STATIC UCHAR *numstring(ULONG, UCHAR *, int, struct k_data *);
 STATIC int spkt(char, short, int, UCHAR *, struct k_data *);
 STATIC int ack(struct k_data *, short, UCHAR *text);
-STATIC int nak(struct k_data *, short, short);
+STATIC int ack_hold(struct k_data *, short);
+STATIC int ack_flush(struct k_data *);
+STATIC void ack_upto(struct k_data *, short);
+STATIC int nak(struct k_data *, short, short, short);
 STATIC int chk1(UCHAR *, struct k_data *);
 STATIC USHORT chk2(UCHAR *, struct k_data *);
 STATIC USHORT chk3(UCHAR *, struct k_data *);
 
 STATIC void spar(struct k_data *, UCHAR *, int);
 STATIC int rpar(struct k_data *, char);
+STATIC void trusted_link(struct k_data *);
+STATIC void pick_prefixes(struct k_data *);
+STATIC void report_escapes(struct k_data *, struct k_response *);
 STATIC int decode(struct k_data *, struct k_response *, short, UCHAR *,
-                  int rslot);
+                  int rslot, int outlen);
+STATIC int zputc(struct k_data *, struct k_response *, UCHAR);
+STATIC int unlzss(struct k_data *, struct k_response *, UCHAR);
 
 STATIC int gattr(struct k_data *, UCHAR *, struct k_response *);
 STATIC int sattr(struct k_data *, struct k_response *);
+STATIC int ack_recover(struct k_data *, struct k_response *, short);
+STATIC int srecover(struct k_data *, struct k_response *, UCHAR *);
 
 STATIC int sdata(struct k_data *, struct k_response *);
 
@@ -119,7 +129,14 @@ STATIC int getpkt(struct k_data *, struct k_response *);
 STATIC int encstr(UCHAR *, struct k_data *, struct k_response *);
 STATIC void encode(int, int, struct k_data *);
 STATIC short nxtpkt(struct k_data *);
-STATIC int resend(struct k_data *, short seq);
+STATIC int resend(struct k_data *, short seq, short why);
+STATIC int fast_resend(struct k_data *, short);
+STATIC void rtt_update(struct k_data *, short);
+STATIC void rto_backoff(struct k_data *);
+STATIC void tune_start(struct k_data *);
+STATIC void tune_ack(struct k_data *, short);
+STATIC void data_phase(struct k_data *, int, long);
+STATIC void data_ack(struct k_data *, short);
 STATIC int nused_sslots(struct k_data *);
 STATIC int nused_rslots(struct k_data *);
 
@@ -277,7 +294,7 @@ nak_oldest_unacked(struct k_data *k, short rseq)
 
    if (oldest_seq != -1)
    {
-      nak(k, oldest_seq, oldest_rslot);
+      nak(k, oldest_seq, oldest_rslot, RT_BAD);
       //    k->anseq = oldest_seq;
       return (X_OK);
    }
@@ -417,7 +434,7 @@ handle_good_rpkt(struct k_data *k, struct k_response *r,
          {
 
             /* Decode pkt and write file */
-            rc = decode(k, r, 1, k->ipktinfo[rslot].buf, rslot);
+            rc = decode(k, r, 1, k->ipktinfo[rslot].buf, rslot, 0);
             debug(DB_LOG, "HANDLE_RPKT decode rc", 0, rc);
             if (rc != X_OK)
             {
@@ -444,8 +461,9 @@ handle_good_rpkt(struct k_data *k, struct k_response *r,
       // 1. PSN = SEQ = HIGH + 1, the usual case
       debug(DB_LOG, "HANDLE_RPKT usual rseq", 0, rseq);
 
-      // acknowledge incoming packet
-      ack(k, rseq, (UCHAR *)0);
+      // acknowledge incoming packet, or hold its ACK back
+      if (!ack_hold(k, rseq))
+         ack(k, rseq, (UCHAR *)0);
 
       do_add_pkt = 1;
    }
@@ -460,7 +478,8 @@ handle_good_rpkt(struct k_data *k, struct k_response *r,
 
       debug(DB_LOG, "  nnak", 0, nnak);
 
-      // acknowledge incoming packet
+      // acknowledge incoming packet, after the ones before the gap
+      ack_flush(k);
       ack(k, rseq, (UCHAR *)0);
 
       // send NAKs for whole gap: HIGH+1 to PSN-1
@@ -470,7 +489,7 @@ handle_good_rpkt(struct k_data *k, struct k_response *r,
          rslot = k->r_pw[iseq];
          debug(DB_LOG, "HANDLE_RPKT isgap nak iseq", 0, iseq);
          debug(DB_LOG, "  rslot", 0, rslot);
-         nak(k, iseq, rslot);
+         nak(k, iseq, rslot, RT_GAP);
       }
 
       do_add_pkt = 2;
@@ -480,6 +499,7 @@ handle_good_rpkt(struct k_data *k, struct k_response *r,
       // 3. LOW <= PSN <= HIGH, old, possibly missing pkt arrived
       debug(DB_LOG, "HANDLE_RPKT isold rseq", 0, rseq);
 
+      ack_flush(k);
       ack(k, rseq, (UCHAR *)0);
 
       // If packet was missing add it to window.
@@ -527,6 +547,16 @@ handle_good_rpkt(struct k_data *k, struct k_response *r,
       test_rslots(k);
    }
 
+   if (isold && rseq == k->acknext)
+   { // the gap is filled, in sequence again after the packets received
+      do
+      {
+         k->acknext = (k->acknext + 1) & 63;
+         rslot = k->r_pw[k->acknext];
+      } while (rslot >= 0 && rslot < wsize && k->ipktinfo[rslot].seq == k->acknext);
+      debug(DB_LOG, "HANDLE_RPKT acknext", 0, k->acknext);
+   }
+
 #ifdef DEBUG
    show_rslots(k);
 #endif
@@ -543,7 +573,7 @@ int ok2rxd(struct k_data *k)
    int ok = 0;
    int sw_full = 0;
 
-   if (nused_sslots(k) == k->wslots)
+   if (nused_sslots(k) >= k->cwnd)
       sw_full = 1;
    else
       sw_full = 0;
@@ -662,7 +692,7 @@ flush_to_file(struct k_data *k, struct k_response *r)
       }
 
       /* Decode pkt and write file */
-      rc = decode(k, r, 1, k->ipktinfo[rslot].buf, rslot);
+      rc = decode(k, r, 1, k->ipktinfo[rslot].buf, rslot, 0);
       debug(DB_LOG, "FLUSH_TO_FILE decode rc", 0, rc);
       if (rc != X_OK)
       {
@@ -776,6 +806,8 @@ get_sslot(struct k_data *k, short *n)
          k->opktinfo[slot].typ = SP;
          k->opktinfo[slot].rtr = 0;
          k->opktinfo[slot].flg = 0; // ACK'd bit
+         k->opktinfo[slot].tim = 0;
+         k->opktinfo[slot].ooo = 0;
          k->opktinfo[slot].dat = (UCHAR *)0;
          debug(DB_LOG, "GET_SSLOT slot", 0, slot);
          return (k->opktinfo[slot].buf);
@@ -950,6 +982,8 @@ free_sslot(struct k_data *k, short slot)
    k->opktinfo[slot].typ = (char)0; /* Type */
    k->opktinfo[slot].rtr = 0;       /* Retry count */
    k->opktinfo[slot].flg = 0;       /* ACK'd bit */
+   k->opktinfo[slot].tim = 0;       /* Time sent */
+   k->opktinfo[slot].ooo = 0;       /* ACKs of later packets */
 }
 
 STATIC short
@@ -1082,6 +1116,7 @@ spkt(char typ, short seq, int len, UCHAR *data, struct k_data *k)
       k->opktinfo[slot].typ = typ;
       k->opktinfo[slot].seq = seq;
       k->opktinfo[slot].len = len;
+      k->opktinfo[slot].tim = k->clockf ? (*(k->clockf))(k) : 0;
 
       buf = k->opktinfo[slot].buf;
       buflen = P_BUFLEN;
@@ -1231,10 +1266,12 @@ spkt(char typ, short seq, int len, UCHAR *data, struct k_data *k)
  */
 
 STATIC int
-nak(struct k_data *k, short seq, short slot)
+nak(struct k_data *k, short seq, short slot, short why)
 {
    int rc = 0;
    k->nsnak++;
+   if (why >= 0 && why < RT_N)
+      k->nsnak_why[why]++;
    debug(DB_LOG, "NAK seq", 0, seq);
    debug(DB_LOG, "  slot", 0, slot);
    // k->anseq = seq;
@@ -1276,6 +1313,79 @@ ack(struct k_data *k, short seq, UCHAR *text)
    return (rc);
 }
 
+/*
+ * A C K _ H O L D -- Hold back the ACK of a D packet received in sequence
+ *
+ * Returns 1 if the ACK is held back, it is then sent by ack_flush() with
+ * the ACKs of the next packets. Returns 0 if the packet must be ACK'd
+ * now: no cumulative ACKs, window too small, or a gap before it.
+ */
+
+STATIC int
+ack_hold(struct k_data *k, short seq)
+{
+   if (!(k->capas2 & CAP2_CA) || k->streaming || k->wslots < 4 ||
+       seq != k->acknext)
+   {
+      ack_flush(k);
+      return (0);
+   }
+   debug(DB_LOG, "ACK_HOLD seq", 0, seq);
+   k->ackseq = seq;
+   k->acknext = (seq + 1) & 63;
+   if (seq == k->r_seq) /* As ack() does */
+      k->r_seq = (k->r_seq + 1) & 63;
+   if (++k->ackpend >= k->wslots / 2)
+      ack_flush(k);
+   return (1);
+}
+
+/*
+ * A C K _ F L U S H -- Send the ACK held back, if any
+ */
+
+STATIC int
+ack_flush(struct k_data *k)
+{
+   UCHAR text[2];
+
+   if (k->ackpend == 0)
+      return (X_OK);
+   debug(DB_LOG, "ACK_FLUSH seq", 0, k->ackseq);
+   debug(DB_LOG, "  ackpend", 0, k->ackpend);
+   k->ackpend = 0;
+   text[0] = ACK_CUM;
+   text[1] = NUL;
+   return (spkt('Y', k->ackseq, 1, text, k));
+}
+
+/*
+ * A C K _ U P T O -- A cumulative ACK was received for seq
+ *
+ * The packets of the window sent before seq are ACK'd too.
+ */
+
+STATIC void
+ack_upto(struct k_data *k, short seq)
+{
+   short slot = 0;
+   short d = 0;
+
+   for (slot = 0; slot < k->wslots; slot++)
+   {
+      if (k->opktinfo[slot].seq < 0 || k->opktinfo[slot].seq > 63 ||
+          k->opktinfo[slot].flg)
+         continue;
+      d = (seq - k->opktinfo[slot].seq) & 63; /* How far before seq */
+      if (d == 0 || d >= k->wslots)
+         continue;
+      debug(DB_LOG, "ACK_UPTO seq", 0, k->opktinfo[slot].seq);
+      data_ack(k, slot);
+      tune_ack(k, slot);
+      k->opktinfo[slot].flg = 1;
+   }
+}
+
 /*
  * S P A R -- Set parameters requested by other Kermit
  */
@@ -1366,6 +1476,22 @@ spar(struct k_data *k, UCHAR *s, int datalen)
 #endif /* F_LS */
          k->capas &= ~CAP_LS;
 
+      /* Second capas byte */
+      x = ((x & CAP_MORE) && datalen >= 11) ? xunchar(s[11]) : 0;
+
+#ifdef F_CZ /* Compression */
+      if (!(x & CAP2_CZ))
+#endif /* F_CZ */
+         k->capas2 &= ~CAP2_CZ;
+#ifdef F_CA /* Cumulative ACKs */
+      if (!(x & CAP2_CA))
+#endif /* F_CA */
+         k->capas2 &= ~CAP2_CA;
+#ifdef F_RS /* Recovery */
+      if (!(x & CAP2_RS))
+#endif /* F_RS */
+         k->capas2 &= ~CAP2_RS;
+
       /* In case other Kermit sends addt'l capas fields ...  */
 
       for (y = 10; (xunchar(s[y]) & 1) && (datalen >= y); y++)
@@ -1401,12 +1527,33 @@ spar(struct k_data *k, UCHAR *s, int datalen)
    {
       k->wslots = 1;
    }
+   k->cwnd = k->wslots; /* Until tuned */
+
+   /*
+    * WHATAMI field, past the checkpoint fields. Streaming only when we
+    * send and the receiver says so, trusted link when both sides say so.
+    */
+   k->streaming = 0;
+   k->trusted = 0;
+   if (y > 0 && datalen >= y + 8)
+   {
+      x = xunchar(s[y + 8]);
+      if (x & WMI_FLAG)
+      {
+         if (k->streamok && k->what == W_SEND && k->state == S_INIT && (x & WMI_STREAM))
+            k->streaming = 1;
+         if (k->trustok && (x & WMI_CLEAR))
+            k->trusted = 1;
+      }
+   }
 
    debug(DB_LOG, "  k->capas & CAP_LP", 0, k->capas & CAP_LP);
    debug(DB_LOG, "  k->capas & CAP_SW", 0, k->capas & CAP_SW);
    debug(DB_LOG, "  k->capas & CAP_AT", 0, k->capas & CAP_AT);
-   debug(DB_LOG, "  k->capas & CAP_RS", 0, k->capas & CAP_RS);
+   debug(DB_LOG, "  k->capas2 & CAP2_RS", 0, k->capas2 & CAP2_RS);
    debug(DB_LOG, "  k->capas & CAP_LS", 0, k->capas & CAP_LS);
+   debug(DB_LOG, "  k->capas2 & CAP2_CZ", 0, k->capas2 & CAP2_CZ);
+   debug(DB_LOG, "  k->capas2 & CAP2_CA", 0, k->capas2 & CAP2_CA);
    debug(DB_CHR, "  k->ebq           ", 0, k->ebq);
    debug(DB_LOG, "  k->ebqflg        ", 0, k->ebqflg);
    debug(DB_LOG, "  k->parity        ", 0, k->parity);
@@ -1422,10 +1569,88 @@ spar(struct k_data *k, UCHAR *s, int datalen)
    debug(DB_LOG, "  k->r_maxlen      ", 0, k->r_maxlen);
    debug(DB_LOG, "  k->s_maxlen      ", 0, k->s_maxlen);
    debug(DB_LOG, "  k->wslots        ", 0, k->wslots);
+   debug(DB_LOG, "  k->streaming     ", 0, k->streaming);
+   debug(DB_LOG, "  k->trusted       ", 0, k->trusted);
    debug(DB_LOG, "  k->binary        ", 0, k->binary);
    debug(DB_LOG, "  k->retry         ", 0, k->retry);
 }
 
+/*
+ * T R U S T E D _ L I N K -- Switch to the trusted link profile
+ *
+ * The BLE link already checks the integrity of what it carries, so once
+ * both sides agreed on it the lightest block check is used, even if
+ * bcta3 was set. Called after the S packet and its ACK were exchanged,
+ * both were checked with the block check used before.
+ */
+
+STATIC void
+trusted_link(struct k_data *k)
+{
+   if (!k->trusted)
+      return;
+
+   k->bcta3 = 0;
+   k->bct = 1;
+   debug(DB_LOG, "TRUSTED_LINK bct", 0, k->bct);
+}
+
+/*
+ * P I C K _ P R E F I X E S -- Choose the prefixes for the first file
+ *
+ * The control and repeat prefixes are sent in the S packet, any printable
+ * character can be used. Take the ones the beginning of the first file
+ * contains the least, each of them in the data costs a control prefix.
+ * The bytes sampled are the ones S_FILE sends: the compressed variant
+ * when the compression is offered and the file has one, chosen by the
+ * same openf(), else the file itself.
+ */
+
+STATIC void
+pick_prefixes(struct k_data *k)
+{
+   long count[256];
+   long n = 0;
+   int c = 0, i = 0;
+   short cz = 0;
+
+   if (!k->filelist || !*(k->filelist))
+      return;
+   if ((k->capas2 & CAP2_CZ) && (*(k->openf))(k, *(k->filelist), 4, 0L) == X_OK)
+      cz = 1;
+   else if ((*(k->openf))(k, *(k->filelist), 1, 0L) != X_OK)
+      return;
+
+   for (i = 0; i < 256; i++)
+      count[i] = 0;
+   while (n < P_PFXSAMPLE && (c = (*(k->readf))(k)) >= 0)
+   {
+      count[(k->binary || cz) ? c : c & 127]++; /* Compressed data is binary */
+      n++;
+   }
+   (*(k->closef))(k, 0, 1);
+
+   for (i = 33; i < 127; i++)
+   {
+      if ((i > 62 && i < 96) || i == '&') /* Not a prefix, or 8th-bit prefix */
+         continue;
+      if (count[i] < count[(UCHAR)k->s_ctlq])
+         k->s_ctlq = i;
+   }
+   for (i = 33; i < 127; i++)
+   {
+      if ((i > 62 && i < 96) || i == '&' || i == (UCHAR)k->s_ctlq)
+         continue;
+      if (count[i] < count[(UCHAR)k->rptq])
+         k->rptq = i;
+   }
+
+   debug(DB_LOG, "PICK_PREFIXES sampled", 0, n);
+   debug(DB_LOG, "  cz", 0, cz);
+   debug(DB_CHR, "  s_ctlq", 0, k->s_ctlq);
+   debug(DB_CHR, "  rptq", 0, k->rptq);
+}
+
 /*
  * R P A R -- Send my parameters to other Kermit
  */
@@ -1434,7 +1659,7 @@ STATIC int
 rpar(struct k_data *k, char type)
 {
    UCHAR *d = 0;
-   int rc = 0, len = 0;
+   int rc = 0, len = 0, x = 0, i = 0;
    short bctsv = 0;
    UCHAR *buf = 0;
    short s_slot = 0;
@@ -1458,13 +1683,32 @@ rpar(struct k_data *k, char type)
    else
       d[7] = k->bct + '0';    /* Block check type */
    d[8] = k->rptq;            /* Repeat prefix */
-   d[9] = tochar(k->capas);   /* Capability bits */
-   d[10] = tochar(k->wslots); /* Window size */
-
-   d[11] = tochar(k->r_maxlen / 95); /* Long packet size, big part */
-   d[12] = tochar(k->r_maxlen % 95); /* Long packet size, little part */
-   d[13] = '\0';                     /* Terminate the init string */
-   len = 13;
+   i = 9;
+   if (k->capas2)
+   { /* Capability bits, two bytes */
+      d[i++] = tochar(k->capas | CAP_MORE);
+      d[i++] = tochar(k->capas2);
+   }
+   else
+   {
+      d[i++] = tochar(k->capas); /* Capability bits */
+   }
+   d[i++] = tochar(k->wslots); /* Window size */
+
+   d[i++] = tochar(k->r_maxlen / 95); /* Long packet size, big part */
+   d[i++] = tochar(k->r_maxlen % 95); /* Long packet size, little part */
+   d[i++] = '0';                      /* No checkpointing */
+   d[i++] = '_';                      /* Checkpoint interval, unused */
+   d[i++] = '_';
+   d[i++] = '_';
+   x = WMI_FLAG;                      /* WHATAMI */
+   if (k->streamok && type == 'S')    /* Streaming only offered as a sender */
+      x |= WMI_STREAM;
+   if (k->trustok)
+      x |= WMI_CLEAR;
+   d[i++] = tochar(x);
+   d[i] = '\0'; /* Terminate the init string */
+   len = i;
 
    if (k->bcta3)
    {
@@ -1509,11 +1753,13 @@ Call with:
 		0: decode filename
 		1: decode file data
 	inbuf = pointer to packet data to be decoded
-	Returns: X_OK on success X_ERROR if output function fails
+	outlen = size of the string decoded to, with f = 0
+	Returns: X_OK on success X_ERROR if output function fails, or if
+	the string does not fit in outlen
  */
 STATIC int
 decode(struct k_data *k, struct k_response *r, short f, UCHAR *inbuf,
-       int rslot)
+       int rslot, int outlen)
 {
 
    register unsigned int a = 0, a7 = 0; /* Current character */
@@ -1521,6 +1767,7 @@ decode(struct k_data *k, struct k_response *r, short f, UCHAR *inbuf,
    int rpt = 0;                         /* Repeat count */
    int rc = 0;                          /* Return code */
    UCHAR *ucp = 0;
+   UCHAR *ucpmax = 0;
    int i = 0;
    int nobuf = 0;
    USHORT crc = 0;
@@ -1528,7 +1775,10 @@ decode(struct k_data *k, struct k_response *r, short f, UCHAR *inbuf,
    rc = X_OK;
    rpt = 0;    /* Initialize repeat count. */
    if (f == 0) /* Output function... */
-      ucp = r->filename;
+   {
+      ucp = k->ostring ? k->ostring : r->filename;
+      ucpmax = ucp + outlen - 1; /* Room for the NUL */
+   }
 
    debug(DB_LOG, "DECODE rslot", 0, rslot);
    if (rslot >= 0)
@@ -1565,6 +1815,11 @@ decode(struct k_data *k, struct k_response *r, short f, UCHAR *inbuf,
          //       exit (1);
          return (X_ERROR);
       }
+      if (f == 1)
+      {
+         k->n_dat += k->ipktinfo[rslot].len;
+         data_phase(k, k->ipktinfo[rslot].len, -1);
+      }
    }
 
    nobuf = 0;
@@ -1581,10 +1836,14 @@ decode(struct k_data *k, struct k_response *r, short f, UCHAR *inbuf,
       {                       /* Have 8th-bit prefix? */
          b8 = 0200;           /* Yes, flag the 8th bit */
          a = *inbuf++ & 0x7F; /* and get the prefixed character. */
+         if (f == 1)
+            k->n_esc++;
       }
       if (a == k->r_ctlq)
       {                       /* If control prefix, */
          a = *inbuf++ & 0xFF; /* get its operand */
+         if (f == 1)
+            k->n_esc++;
 
          // Innes Kermit optimization
 
@@ -1607,22 +1866,22 @@ decode(struct k_data *k, struct k_response *r, short f, UCHAR *inbuf,
       { /* Output the char 'rpt' times */
          if (k->recvdir == 1 || f == 0)
          {
+            if (f == 0 && ucp >= ucpmax)
+            { /* Repeat counts can expand past the packet length */
+               rc = X_ERROR;
+               break;
+            }
             *ucp++ = (UCHAR)a; /* to memory */
          }
          else
-         {                                    /* or to file */
-            k->obuf[k->obufpos++] = (UCHAR)a; /* Deposit the byte */
+         { /* or to file */
+            if (k->cz)
+               rc = unlzss(k, r, (UCHAR)a); /* Through the decompressor */
+            else
+               rc = zputc(k, r, (UCHAR)a);
             nobuf++;
-            if (k->obufpos == k->obuflen)
-            {                                               /* Buffer full? */
-               rc = (*(k->writef))(k, k->obuf, k->obuflen); /* Dump it. */
-               debug(DB_LOG, "DECODE writef rc", 0, rc);
-               r->sofar += k->obuflen;
-               r->sofar_rumor += k->obuflen;
-               if (rc != X_OK)
-                  break;
-               k->obufpos = 0;
-            }
+            if (rc != X_OK)
+               break;
          }
       }
    }
@@ -1637,6 +1896,79 @@ decode(struct k_data *k, struct k_response *r, short f, UCHAR *inbuf,
    return (rc);
 }
 
+/*
+ * Z P U T C -- Deposit a byte of file data in the output buffer
+ */
+
+STATIC int
+zputc(struct k_data *k, struct k_response *r, UCHAR c)
+{
+   int rc = X_OK;
+
+   k->obuf[k->obufpos++] = c; /* Deposit the byte */
+   if (k->obufpos == k->obuflen)
+   {                                               /* Buffer full? */
+      rc = (*(k->writef))(k, k->obuf, k->obuflen); /* Dump it. */
+      debug(DB_LOG, "ZPUTC writef rc", 0, rc);
+      r->sofar += k->obuflen;
+      r->sofar_rumor += k->obuflen;
+      if (rc == X_OK)
+         k->obufpos = 0;
+   }
+   return (rc);
+}
+
+/*
+ * U N L Z S S -- Decompress a byte of file data, see AT_CZ
+ *
+ * The data of a packet may end anywhere in an LZSS group, the decoder
+ * keeps its state in k_data between the packets. A reference before the
+ * start of the file is an error.
+ */
+
+STATIC int
+unlzss(struct k_data *k, struct k_response *r, UCHAR c)
+{
+   int rc = X_OK, dist = 0, len = 0;
+   UCHAR b = 0;
+
+   if (k->cz_nflags == 0)
+   { /* Flag byte of the next group */
+      k->cz_flags = c;
+      k->cz_nflags = 8;
+      return (X_OK);
+   }
+   if (!(k->cz_flags & 1))
+   { /* Reference */
+      if (k->cz_hi < 0)
+      {
+         k->cz_hi = c;
+         return (X_OK);
+      }
+      dist = (((k->cz_hi << 8) | c) >> (16 - P_CZ_DBITS)) + 1;
+      len = (c & ((1 << (16 - P_CZ_DBITS)) - 1)) + P_CZ_MINLEN;
+      k->cz_hi = -1;
+      if (dist > k->cz_len)
+      {
+         debug(DB_LOG, "UNLZSS bad distance", 0, dist);
+         return (X_ERROR);
+      }
+   }
+   k->cz_flags >>= 1;
+   k->cz_nflags--;
+
+   do
+   {
+      b = dist ? k->czwin[(k->cz_pos - dist) & (P_CZ_WINDOW - 1)] : c;
+      k->czwin[k->cz_pos] = b;
+      k->cz_pos = (k->cz_pos + 1) & (P_CZ_WINDOW - 1);
+      if (k->cz_len < P_CZ_WINDOW)
+         k->cz_len++;
+      rc = zputc(k, r, b);
+   } while (--len > 0 && rc == X_OK);
+   return (rc);
+}
+
 STATIC ULONG /* Convert decimal string to number */
 stringnum(UCHAR *s, struct k_data *k)
 {
@@ -1690,8 +2022,8 @@ numstring(ULONG n, UCHAR *buf, int buflen, struct k_data *k)
 STATIC int
 gattr(struct k_data *k, UCHAR *s, struct k_response *r)
 {
-   long fsize = 0, fsizek = 0; /* File size */
-   UCHAR c = 0;                /* Workers */
+   long fsize = -1, fsizek = -1; /* File size */
+   UCHAR c = 0;                  /* Workers */
    int aln = 0, i = 0, rc = 0;
 
    UCHAR sizebuf[SIZEBUFL];
@@ -1741,6 +2073,28 @@ gattr(struct k_data *k, UCHAR *s, struct k_response *r)
          fsize = stringnum(sizebuf, k); /* Convert to number */
          break;
 
+      case '+': /* Disposition */
+         if (aln > 0 && *s == 'R' && (k->capas2 & CAP2_RS))
+            k->rs = RS_ASKED; /* Recovery */
+         s += aln;
+         break;
+
+      case AT_CZ: /* Compressed data */
+         if (aln > 0 && *s == CZ_LZSS && (k->capas2 & CAP2_CZ))
+            k->cz = 1;
+         s += aln;
+         break;
+
+      case AT_OFFSET:                                  /* Offset of the recovery */
+         for (i = 0; (i < aln) && (i < SIZEBUFL); i++) /* Copy it */
+            sizebuf[i] = *s++;
+         sizebuf[i] = '\0'; /* Terminate with null */
+         if (i < aln)
+            s += (aln - i);
+         k->rs_off = stringnum(sizebuf, k);
+         k->rs = RS_OFFSET;
+         break;
+
       default:     /* Unknown attribute */
          s += aln; /* Just skip past it */
          break;
@@ -1777,6 +2131,8 @@ sattr(struct k_data *k, struct k_response *r)
    tmp = k->binary;
    filelength = (*(k->finfo))(k, k->filename, datebuf, DATE_MAX, &tmp, k->xfermode);
    k->binary = tmp;
+   if (k->cz) /* Compressed data is binary */
+      k->binary = 1;
 
    debug(DB_LOG, "  filename: ", k->filename, 0);
    debug(DB_LOG, "  filedate: ", datebuf, 0);
@@ -1841,6 +2197,19 @@ sattr(struct k_data *k, struct k_response *r)
          r->filedate[x] = '\0';
       }
    }
+   if (k->cz)
+   {                             /* Compressed variant of the file */
+      k->xdata[i++] = AT_CZ;
+      k->xdata[i++] = tochar(1); /* Length of value is 1 */
+      k->xdata[i++] = CZ_LZSS;
+   }
+   else if ((k->capas2 & CAP2_RS) && k->binary)
+   {                             /* Recovery negotiated */
+      k->xdata[i++] = '+';       /* Disposition */
+      k->xdata[i++] = tochar(1); /* Length of value is 1 */
+      k->xdata[i++] = 'R';       /* R for recover */
+      k->rs = RS_ASKED;
+   }
    k->xdata[i++] = '@'; /* End of Attributes */
    k->xdata[i++] = ' ';
    k->xdata[i] = '\0'; /* Terminate attribute string */
@@ -1859,6 +2228,142 @@ sattr(struct k_data *k, struct k_response *r)
    }
 }
 
+/*
+ * A C K _ R E C O V E R -- ACK the A packet that asked for recovery
+ *
+ * The ACK carries the length and the CRC-32 of the partial file kept
+ * from an earlier transfer, if any, the sender checks them against its
+ * own file before it resumes.
+ */
+
+STATIC int
+ack_recover(struct k_data *k, struct k_response *r, short seq)
+{
+   UCHAR text[ATTRLEN];
+   UCHAR lenbuf[16];
+   UCHAR *p = 0;
+   ULONG crc = 0;
+   int i = 0, x = 0;
+
+   text[i++] = 'Y';
+   k->rs_len = 0;
+   if (k->crcf)
+      k->rs_len = (*(k->crcf))(k, r->filename, -1L, &crc);
+   if (k->rs_len > 0 && (r->filesize <= 0 || k->rs_len < r->filesize) &&
+       (p = numstring(k->rs_len, lenbuf, 16, k)))
+   {
+      for (x = 0; p[x]; x++)
+         ; /* Get length of length string */
+      text[i++] = '1'; /* Length of the partial file */
+      text[i++] = tochar(x);
+      while (*p)
+         text[i++] = *p++;
+      text[i++] = AT_CRC; /* And its CRC */
+      text[i++] = tochar(8);
+      snprintf((char *)&text[i], 9, "%08lx", (unsigned long)crc);
+      i += 8;
+   }
+   else
+   {
+      k->rs_len = 0;
+   }
+   text[i] = '\0';
+   debug(DB_LOG, "ACK_RECOVER rs_len", 0, k->rs_len);
+   return (ack(k, seq, text));
+}
+
+/*
+ * S R E C O V E R -- Check the partial file of the receiver
+ *
+ * Called with the ACK to the A packet that asked for recovery. If the
+ * receiver keeps the first bytes of the file, with the same CRC as ours,
+ * the input file is moved past them. The offset the data starts from is
+ * then sent in a second A packet, 0 if the partial file must be dropped.
+ */
+
+STATIC int
+srecover(struct k_data *k, struct k_response *r, UCHAR *s)
+{
+   UCHAR buf[SIZEBUFL];
+   UCHAR *p = 0;
+   UCHAR c = 0;
+   ULONG crc = 0, mycrc = 0;
+   long len = -1, off = 0, n = 0;
+   int aln = 0, i = 0, x = 0;
+   short s_slot = 0;
+
+   if (*s != 'Y')
+   { /* Refused, or no attributes */
+      k->rs = RS_NONE;
+      return (X_OK);
+   }
+   s++; /* Accepted, attributes follow */
+   while ((c = *s++) && *s)
+   {
+      aln = xunchar(*s++);
+      for (i = 0; (i < aln) && (i < SIZEBUFL - 1) && s[i]; i++)
+         buf[i] = s[i];
+      buf[i] = '\0';
+      for (i = 0; (i < aln) && *s; i++)
+         s++;
+      if (c == '1')
+         len = stringnum(buf, k);
+      else if (c == AT_CRC)
+         for (crc = 0, p = buf; *p; p++) /* Hex digits */
+            crc = (crc << 4) | ((*p <= '9') ? (*p - '0') : ((*p | 0x20) - 'a' + 10));
+   }
+   debug(DB_LOG, "SRECOVER len", 0, len);
+
+   if (len < 0)
+   { /* Old receiver, or nothing kept */
+      k->rs = RS_NONE;
+      return (X_OK);
+   }
+
+   if (len > 0 && k->crcf && (*(k->crcf))(k, k->filename, len, &mycrc) == len && mycrc == crc)
+   {
+      for (n = 0; n < len; n++)
+         if (zgetc() < 0)
+            break;
+      if (n < len)
+      {
+         epkt("eksw recovery seek failed", k);
+         return (X_ERROR);
+      }
+      off = len;
+      PRINT_DDEBUG_ARG("Recovery from byte %ld", off);
+   }
+   else if (len > 0)
+   {
+      PRINT_DDEBUG_ARG("Recovery refused, CRC of the %ld bytes kept differs", len);
+   }
+   r->sofar = r->sofar_rumor = off;
+
+   p = numstring(off, buf, SIZEBUFL, k);
+   if (!p)
+      return (X_ERROR);
+   for (x = 0; p[x]; x++)
+      ;
+   i = 0;
+   k->xdata[i++] = AT_OFFSET;
+   k->xdata[i++] = tochar(x);
+   while (*p)
+      k->xdata[i++] = *p++;
+   k->xdata[i++] = '@'; /* End of Attributes */
+   k->xdata[i++] = ' ';
+   k->xdata[i] = '\0';
+
+   nxtpkt(k);
+   get_sslot(k, &s_slot); // get a new send slot
+   if (s_slot < 0)
+      return (X_ERROR);
+   k->s_pw[k->s_seq] = s_slot;
+   k->rs = RS_OFFSET;
+   k->rs_off = off;
+   debug(DB_LOG, "SRECOVER sending A pkt s_seq", 0, k->s_seq);
+   return (spkt('A', k->s_seq, -1, k->xdata, k));
+}
+
 STATIC int
 getpkt(struct k_data *k, struct k_response *r)
 {
@@ -2008,9 +2513,41 @@ sdata(struct k_data *k, struct k_response *r)
    rc = spkt('D', k->s_seq, len, k->xdata, k); /* Send the packet */
 
    debug(DB_LOG, "SDATA spkt rc", 0, rc);
+
+   /*
+    * Streaming: the D packet is not ACK'd, free its slot so that
+    * the next one is sent without waiting.
+    */
+   if (k->streaming && rc != X_ERROR)
+   {
+      free_sslot(k, k->s_pw[k->s_seq]);
+      r->sofar = r->sofar_rumor;
+   }
+   if (rc != X_ERROR)
+      k->n_dat += len;
    return ((rc == X_ERROR) ? rc : len);
 }
 
+/*
+ * R E P O R T _ E S C A P E S -- Prefixing overhead of the file done
+ */
+
+STATIC void
+report_escapes(struct k_data *k, struct k_response *r)
+{
+   char tmp[80];
+   long raw = k->n_dat - k->n_esc;
+
+   debug(DB_LOG, "ESCAPES n_esc", 0, k->n_esc);
+   debug(DB_LOG, "  n_dat", 0, k->n_dat);
+   if (raw <= 0)
+      return;
+
+   snprintf(tmp, sizeof(tmp), "%s: %ld prefixes in %ld bytes (%ld.%02ld%%)", r->filename, k->n_esc,
+            k->n_dat, (k->n_esc * 100) / raw, ((k->n_esc * 10000) / raw) % 100);
+   PRINT_DDEBUG_ARG("Escape overhead %s", tmp);
+}
+
 /*
  * E P K T -- Send a (fatal) Error packet with the given message
  */
@@ -2065,7 +2602,7 @@ decstr (UCHAR * s, struct k_data *k, struct k_response *r)
 STATIC void
 encode(int a, int next, struct k_data *k)
 { /* Encode character into packet == k->xdata */
-   int a7or8 = 0, b8 = 0, maxlen = 0;
+   int a7or8 = 0, b8 = 0, maxlen = 0, esc = 0;
 
    maxlen = k->s_maxlen - 4;
    if (k->rptflg)
@@ -2121,6 +2658,8 @@ encode(int a, int next, struct k_data *k)
    {                                  /* If doing 8th bit prefixing */
       k->xdata[(k->size)++] = k->ebq; /* and 8th bit on, insert prefix */
       a = a7or8;                      /* and clear the 8th bit. */
+      if (!k->istring)
+         k->n_esc++;
    }
 
    // if (a7 < 32 || a7 == 127)    /* If in control range -- conservative */
@@ -2128,6 +2667,7 @@ encode(int a, int next, struct k_data *k)
    // this is a bit more conservative than C-Kermit "set prefixing minimal"
    //  if (a7 == 0 || a7 == 1 || a7 == 3 || a7 == 4 || a7 == 10 ||
    //      a7 == 13 || a7 == 21 || a7 == 127)
+   esc = k->size;
    if (
        (k->binary == 1 && (a7or8 == 0 || a7or8 == PACKET_START || a7or8 == PACKET_END)) ||
        (k->binary == 0 && (a7or8 == 0 || a7or8 == PACKET_START || a7or8 == 3 || a7or8 == 4 || a7or8 == 10 || a7or8 == PACKET_END || a7or8 == 21 || a7or8 == 127)))
@@ -2135,12 +2675,14 @@ encode(int a, int next, struct k_data *k)
       k->xdata[(k->size)++] = k->s_ctlq; /* insert control prefix */
       a = ctl(a);                        /* and make character printable. */
    }
-   else if (a7or8 == k->s_ctlq)            /* If data is control prefix, */
-      k->xdata[(k->size)++] = k->s_ctlq;   /* prefix it. */
-   else if (k->ebqflg && a7or8 == k->ebq)  /* If doing 8th-bit prefixing, */
-      k->xdata[(k->size)++] = k->s_ctlq;   /* ditto for 8th-bit prefix. */
-   else if (k->rptflg && a7or8 == k->rptq) /* If doing run-length encoding, */
-      k->xdata[(k->size)++] = k->s_ctlq;   /* ditto for repeat prefix. */
+   else if (a7or8 == (UCHAR)k->s_ctlq)            /* If data is control prefix, */
+      k->xdata[(k->size)++] = k->s_ctlq;          /* prefix it. */
+   else if (k->ebqflg && a7or8 == (UCHAR)k->ebq)  /* If doing 8th-bit prefixing, */
+      k->xdata[(k->size)++] = k->s_ctlq;          /* ditto for 8th-bit prefix. */
+   else if (k->rptflg && a7or8 == (UCHAR)k->rptq) /* If doing run-length encoding, */
+      k->xdata[(k->size)++] = k->s_ctlq;          /* ditto for repeat prefix. */
+   if (k->size != esc && !k->istring) /* File data prefixed */
+      k->n_esc++;
 
    k->xdata[(k->size)++] = a;  /* Finally, emit the character. */
    k->xdata[(k->size)] = '\0'; /* Terminate string with null. */
@@ -2166,8 +2708,285 @@ nxtpkt(struct k_data *k)
    return (k->s_seq);
 }
 
+/*
+ * R T T _ U P D A T E -- Measure the round trip time of an ACK'd packet
+ *
+ * Jacobson/Karels estimator, in fixed point as in TCP: srtt is kept
+ * times 8 and rttvar times 4. Packets that were resent give no sample
+ * (Karn), the ACK may belong to any of the copies.
+ */
+
+STATIC void
+rtt_update(struct k_data *k, short slot)
+{
+   long m = 0;
+
+   if (!k->clockf || slot < 0 || slot >= k->wslots)
+      return;
+   if (k->opktinfo[slot].flg || k->opktinfo[slot].rtr > 0 || k->opktinfo[slot].tim <= 0)
+      return;
+
+   m = (*(k->clockf))(k) - k->opktinfo[slot].tim;
+   if (m < 0)
+      return;
+   k->rtt = (int)m;
+
+   if (k->srtt == 0)
+   { /* First sample */
+      k->srtt = m << 3;
+      k->rttvar = m << 1;
+   }
+   else
+   {
+      m -= (k->srtt >> 3); /* Error of the estimate */
+      k->srtt += m;
+      if (m < 0)
+         m = -m;
+      m -= (k->rttvar >> 2);
+      k->rttvar += m;
+   }
+   k->rto = (k->srtt >> 3) + k->rttvar;
+   if (k->rto < P_RTO_MIN)
+      k->rto = P_RTO_MIN;
+   if (k->rto > P_RTO_MAX)
+      k->rto = P_RTO_MAX;
+   debug(DB_LOG, "RTT_UPDATE rtt", 0, k->rtt);
+   debug(DB_LOG, "  rto", 0, k->rto);
+}
+
+/*
+ * R T O _ B A C K O F F -- Double the timeout after a timeout
+ *
+ * It stays backed off until a packet sent only once is ACK'd.
+ */
+
+STATIC void
+rto_backoff(struct k_data *k)
+{
+   if (k->rto == 0)
+      return; /* Not measured yet, r_timo is used */
+   k->rto <<= 1;
+   if (k->rto > P_RTO_MAX)
+      k->rto = P_RTO_MAX;
+   debug(DB_LOG, "RTO_BACKOFF rto", 0, k->rto);
+}
+
+/*
+ * T U N E _ S T A R T -- Seed the window and packet length from the link
+ *
+ * Called when the parameters are negotiated, the sender starts with
+ * packets of P_AT_WRITES link writes and a window covering a guessed
+ * bandwidth-delay product: P_AT_PDUS writes per connection interval,
+ * over a round trip of 3 intervals plus the P_AT_TURN ms the receiver
+ * takes to answer. The shorter the interval, the more the turnaround
+ * weighs and the more packets the window holds. If the link gives the
+ * values learned in its previous sessions, they are used instead.
+ * tune_ack() then corrects them from what is measured.
+ */
+
+STATIC void
+tune_start(struct k_data *k)
+{
+   long bdp = 0;
+   int len = 0;
+
+   k->cwnd = k->wslots;
+   k->at_maxlen = k->s_maxlen;
+   k->link.mtu = 0;
+   if (!k->linkf || !k->clockf || k->streaming)
+      return;
+   if ((*(k->linkf))(k, &k->link) != X_OK || k->link.mtu <= 0)
+   {
+      k->link.mtu = 0;
+      return;
+   }
+   if (k->link.itv <= 0)
+      k->link.itv = 8;
+   if (k->at_bps > 0)
+   { /* Tuned by the previous transaction of the session */
+      k->link.maxlen = k->at_bestlen;
+      k->link.window = k->at_bestwin;
+   }
+
+   len = k->link.mtu * P_AT_WRITES;
+   if (len < P_AT_MINLEN)
+      len = P_AT_MINLEN;
+   if (len < k->at_maxlen)
+      k->s_maxlen = len;
+
+   if (k->link.maxlen >= P_AT_MINLEN) /* Learned */
+      k->s_maxlen = (k->link.maxlen < k->at_maxlen) ? k->link.maxlen : k->at_maxlen;
+
+   bdp = (long)k->link.mtu * P_AT_PDUS * (3 * k->link.itv + P_AT_TURN) / k->link.itv;
+   k->cwnd = (short)(bdp / k->s_maxlen + 1);
+   if (k->link.window > 0) /* Learned */
+      k->cwnd = (short)k->link.window;
+   if (k->cwnd > k->wslots)
+      k->cwnd = k->wslots;
+
+   k->at_t0 = (*(k->clockf))(k);
+   k->at_bytes = 0;
+   k->at_nresend = k->nresend;
+   k->at_bps = 0;
+   k->at_bestlen = k->s_maxlen;
+   k->at_bestwin = k->cwnd;
+   debug(DB_LOG, "TUNE_START s_maxlen", 0, k->s_maxlen);
+   debug(DB_LOG, "  cwnd", 0, k->cwnd);
+}
+
+/*
+ * D A T A _ P H A S E -- Measure the goodput of the file data
+ *
+ * Called with each D packet ACK'd or received, t0 is the time it was
+ * sent, -1 if unknown. The data phase is the time with D packets on
+ * the way: the packets of a file overlap, the time before the first
+ * one, between the files and of the other packets is not counted.
+ */
+
+STATIC void
+data_phase(struct k_data *k, int len, long t0)
+{
+   long now = 0;
+
+   if (!k->clockf)
+      return;
+   now = (*(k->clockf))(k);
+   if (t0 < k->dp_tack) /* Already counted up to dp_tack */
+      t0 = k->dp_tack;
+   if (t0 >= 0 && now > t0)
+      k->dp_ms += now - t0;
+   k->dp_tack = now;
+   k->dp_bytes += len;
+   k->dp_npkt++;
+}
+
+/*
+ * D A T A _ A C K -- A packet sent is ACK'd, count it if it is file data
+ */
+
+STATIC void
+data_ack(struct k_data *k, short slot)
+{
+   if (k->opktinfo[slot].flg || k->opktinfo[slot].typ != 'D' ||
+       k->what == W_DIR)
+      return;
+   data_phase(k, k->opktinfo[slot].len, k->opktinfo[slot].tim);
+}
+
+/*
+ * T U N E _ A C K -- Adjust the window and packet length
+ *
+ * Called with each D packet ACK'd. Every P_AT_PERIOD ms (4 round trips
+ * at least), the goodput of the period is compared:
+ *  - resends during the period: window halved, packets 3/4 as long;
+ *  - goodput under 7/8 of the best: back to the best settings;
+ *  - otherwise: longer packets, and a window that covers the
+ *    bandwidth-delay product measured.
+ * Always within the window size and packet length negotiated.
+ */
+
+STATIC void
+tune_ack(struct k_data *k, short slot)
+{
+   long now = 0, dt = 0, bps = 0, bdp = 0;
+   int len = 0;
+   short win = 0;
+
+   if (k->link.mtu <= 0 || k->streaming || k->opktinfo[slot].flg ||
+       k->opktinfo[slot].typ != 'D')
+      return;
+
+   k->at_bytes += k->opktinfo[slot].len;
+   now = (*(k->clockf))(k);
+   dt = now - k->at_t0;
+   if (dt < P_AT_PERIOD || dt < (k->srtt >> 1)) /* srtt >> 3, 4 times */
+      return;
+
+   bps = k->at_bytes * 1000 / dt;
+   len = k->s_maxlen;
+   win = k->cwnd;
+   if (k->nresend != k->at_nresend)
+   { /* Losses */
+      win = (win > 1) ? win / 2 : 1;
+      len = len * 3 / 4;
+   }
+   else if (bps * 8 < k->at_bps * 7)
+   { /* Worse than the best, the last step went too far */
+      len = k->at_bestlen;
+      win = k->at_bestwin;
+   }
+   else
+   {
+      if (bps > k->at_bps)
+      {
+         k->at_bps = bps;
+         k->at_bestlen = len;
+         k->at_bestwin = win;
+      }
+      len += (len / 4 > k->link.mtu) ? len / 4 : k->link.mtu;
+      bdp = bps * (k->srtt >> 3) / 1000;
+      if (bdp / len + 1 > win)
+         win = (short)(bdp / len + 1);
+   }
+
+   if (len > k->at_maxlen)
+      len = k->at_maxlen;
+   if (len < P_AT_MINLEN)
+      len = (k->at_maxlen < P_AT_MINLEN) ? k->at_maxlen : P_AT_MINLEN;
+   if (win > k->wslots)
+      win = k->wslots;
+   if (win < 1)
+      win = 1;
+   k->s_maxlen = len;
+   k->cwnd = win;
+
+   k->at_t0 = now;
+   k->at_bytes = 0;
+   k->at_nresend = k->nresend;
+   debug(DB_LOG, "TUNE_ACK bps", 0, bps);
+   debug(DB_LOG, "  s_maxlen", 0, k->s_maxlen);
+   debug(DB_LOG, "  cwnd", 0, k->cwnd);
+}
+
+/*
+ * F A S T _ R E S E N D -- Resend the packets left behind by an ACK
+ *
+ * Each packet still unACK'd and sent before rseq counts the ACK. After
+ * P_FASTRT of them it is resent without waiting for the timeout, only
+ * once: if that copy is lost too, the timeout does the rest. The other
+ * packets of the window are not resent.
+ */
+
+STATIC int
+fast_resend(struct k_data *k, short rseq)
+{
+   short slot = 0;
+   short seq = 0;
+   short d = 0;
+   int rc = X_OK;
+
+   if (k->streaming || k->wslots < 2)
+      return (X_OK);
+
+   for (slot = 0; slot < k->wslots && rc == X_OK; slot++)
+   {
+      seq = k->opktinfo[slot].seq;
+      if (seq < 0 || seq > 63 || k->opktinfo[slot].flg || k->opktinfo[slot].len < 1)
+         continue;
+      d = (rseq - seq) & 63; /* How far before rseq */
+      if (d == 0 || d >= k->wslots)
+         continue;
+      if (++k->opktinfo[slot].ooo == P_FASTRT && k->opktinfo[slot].rtr == 0)
+      {
+         debug(DB_LOG, "FAST_RESEND seq", 0, seq);
+         rc = resend(k, seq, RT_FAST);
+      }
+   }
+   return (rc);
+}
+
 STATIC int
-resend(struct k_data *k, short seq)
+resend(struct k_data *k, short seq, short why)
 {
    UCHAR *buf = 0;
    int ret = 0;
@@ -2250,6 +3069,9 @@ resend(struct k_data *k, short seq)
       return (X_OK);
 
    k->nresend++;
+   if (why >= 0 && why < RT_N)
+      k->nresend_why[why]++;
+   debug(DB_LOG, "  why", 0, why);
 
    buf = k->opktinfo[slot].buf;
 
@@ -2353,8 +3175,22 @@ kermit(short fc,             /* Function code */
                  | CAP_LP                  /* Long packets */
                  | CAP_AT                  /* Attribute packets */
           ;
-      if (k->wslots > 1)
+      if (k->wslots_max > 1)
          k->capas |= CAP_SW; /* Sliding windows */
+      k->bcta3_cfg = k->bcta3; /* Restored after a trusted link */
+      k->capas2 = 0;
+#ifdef F_RS
+      if (k->crcf)
+         k->capas2 |= CAP2_RS; /* Recovery */
+#endif /* F_RS */
+#ifdef F_CZ
+      k->capas2 |= CAP2_CZ; /* Compression */
+#endif /* F_CZ */
+#ifdef F_CA
+      if (k->wslots_max > 1)
+         k->capas2 |= CAP2_CA; /* Cumulative ACKs */
+#endif /* F_CA */
+      k->cz = 0;
 
       /* This is the only way to initialize these tables -- no static data. */
 
@@ -2394,7 +3230,7 @@ kermit(short fc,             /* Function code */
 
       return (X_OK);
    }
-   else if (fc == K_REINIT)
+   else if (fc == K_REINIT || fc == K_NEXT)
    {                         /* Initialize packet buffers etc */
       r->filename[0] = '\0'; /* No filename yet. */
       r->filedate[0] = '\0'; /* No filedate yet. */
@@ -2436,6 +3272,14 @@ kermit(short fc,             /* Function code */
       k->r_maxlen = k->p_maxlen;          /* Maximum packet length */
       k->s_maxlen = k->p_maxlen;          /* Maximum packet length */
       k->wslots = k->wslots_max;          /* Current window slots */
+      k->cwnd = k->wslots;                /* Until tuned */
+      k->link.mtu = 0;
+      k->streaming = 0;                   /* Until negotiated */
+      k->trusted = 0;                     /* Until negotiated */
+      k->rs = RS_NONE;                    /* No recovery yet */
+      k->bcta3 = k->bcta3_cfg;            /* As set by the caller */
+      k->s_ctlq = k->r_ctlq = PREFIX_CTRL; /* Until picked or negotiated */
+      k->rptq = PREFIX_REPEAT;
       k->zincnt = 0;
       k->filename = (UCHAR *)0;
       k->cgetpkt = 0;
@@ -2464,12 +3308,28 @@ kermit(short fc,             /* Function code */
          k->opktinfo[i].seq = -1;
          k->opktinfo[i].typ = SP;
          k->opktinfo[i].dat = (UCHAR *)(0);
+         k->opktinfo[i].tim = 0;
+         k->opktinfo[i].ooo = 0;
       }
 
       k->opktlen = 0;
 
       k->nsnak = 0;
       k->nresend = 0;
+      for (i = 0; i < RT_N; i++)
+         k->nsnak_why[i] = k->nresend_why[i] = 0;
+      if (fc == K_REINIT)
+      {                           /* New session */
+         k->srtt = k->rttvar = 0; /* New estimate */
+         k->rto = 0;
+         k->at_bps = 0; /* Nothing tuned yet */
+      }
+      k->nfiles = 0;
+      k->ackpend = 0;
+      k->acknext = -1;
+      k->dp_tack = -1;
+      k->dp_ms = k->dp_bytes = 0;
+      k->dp_npkt = 0;
       r->dir[0] = 0;
 
       k->recvdir = 0;
@@ -2578,6 +3438,8 @@ kermit(short fc,             /* Function code */
    }
    else if (fc == K_SEND)
    {
+      if (k->trustok)
+         pick_prefixes(k);
       if (rpar(k, 'S') != X_OK) /* Send S packet with my parameters */
       {
          debug(DB_LOG, "K_SEND error rpar(S) failed fc", 0, fc);
@@ -2635,6 +3497,8 @@ kermit(short fc,             /* Function code */
          if (k->what == W_RECV) /* If receiving */
          {
             debug(DB_MSG, "DO_RXD len<4", 0, 0);
+            if (k->ackpend) /* Idle link, send the ACK held back */
+               return (ack_flush(k));
 #ifdef USE_NAK_OLDEST_UNACKED
             nak_oldest_unacked(k, -1);
 #endif
@@ -2648,7 +3512,9 @@ kermit(short fc,             /* Function code */
          else /* If W_SEND or W_GET */
          {
             debug(DB_MSG, "DO_RXD len<4: resending earliest", 0, 0);
-            ret = resend(k, -1); /* retransmit earliest packet in queue. */
+            if (len == 0) /* Timeout */
+               rto_backoff(k);
+            ret = resend(k, -1, len == 0 ? RT_TIMEOUT : RT_BAD); /* retransmit earliest packet in queue. */
             return (ret);
          }
       }
@@ -2724,7 +3590,7 @@ kermit(short fc,             /* Function code */
             else
             {
                debug(DB_MSG, "resending earliest", 0, 0);
-               ret = resend(k, -1);
+               ret = resend(k, -1, RT_BAD);
                debug(DB_LOG, "resend ret", 0, ret);
                return (ret);
             }
@@ -2794,7 +3660,7 @@ kermit(short fc,             /* Function code */
          else
          {
             debug(DB_MSG, "  resend earliest", 0, 0);
-            resend(k, -1);
+            resend(k, -1, RT_BAD);
          }
          return (X_OK);
       }
@@ -2826,7 +3692,7 @@ kermit(short fc,             /* Function code */
             else
             {
                debug(DB_MSG, "  resend earliest", 0, 0);
-               resend(k, -1);
+               resend(k, -1, RT_BAD);
             }
             return (X_OK);
          }
@@ -2865,7 +3731,7 @@ kermit(short fc,             /* Function code */
             else
             {
                debug(DB_MSG, "  resend earliest", 0, 0);
-               resend(k, -1);
+               resend(k, -1, RT_BAD);
             }
             return (X_OK);
          }
@@ -2911,7 +3777,7 @@ kermit(short fc,             /* Function code */
             else
             {
                debug(DB_MSG, "  resend earliest", 0, 0);
-               resend(k, -1);
+               resend(k, -1, RT_BAD);
             }
             return (X_OK);
          }
@@ -2944,7 +3810,10 @@ kermit(short fc,             /* Function code */
             }
 
             // set ACK'd flag for that send slot
+            rtt_update(k, s_slot);
             k->opktinfo[s_slot].flg = 1;
+            if ((k->capas2 & CAP2_CA) && *pdf == ACK_CUM)
+               ack_upto(k, rseq); // and the packets sent before it
 
             // remove earliest and subsequent
             free_sslot_easca(k);
@@ -3084,7 +3953,7 @@ kermit(short fc,             /* Function code */
       if (rtyp == 'G')
       {
          // server decode DIR packet
-         if ((rc = decode(k, r, 0, pdf, -1)) == X_OK)
+         if ((rc = decode(k, r, 0, pdf, -1, sizeof(r->filename))) == X_OK)
          {
             if (pdf[0] != 'D')
             {
@@ -3129,25 +3998,61 @@ kermit(short fc,             /* Function code */
       if (rtyp == 'R')
       {
          // Server decode GET packet
-         if ((rc = decode(k, r, 0, pdf, -1)) == X_OK)
+         k->ostring = k->getlist; /* Not in r->filename, it can name several files */
+         rc = decode(k, r, 0, pdf, -1, sizeof(k->getlist));
+         k->ostring = (UCHAR *)0;
+         if (rc == X_OK)
          {
-            PRINT_DDEBUG_ARG("Received a GET command for file '%s'", pdf);
-            strcpy((char *)k->xdatabuf, (char *)pdf);
+            PRINT_DDEBUG_ARG("Received a GET command for '%s'", k->getlist);
 
             r->type = A_GET; /* The last transaction was a get */
             //r->arg=k->xdatabuf;
 
-            if (k->accessf(k, k->xdatabuf) != X_OK)
+            /*
+             * In a batch session, several names separated by spaces are
+             * sent in one batch: F A D... Z for each of them, then B.
+             * Otherwise the parameters are one name, spaces included.
+             */
+            i = 0;
+            s = k->getlist;
+            while (k->batch && *s)
+            {
+               for (; *s == ' '; s++)
+                  *s = '\0';
+               if (!*s)
+                  break;
+               if (i == P_GETFILES)
+               {
+                  epkt("Too many files in GET parameters", k);
+                  return X_ERROR;
+               }
+               k->filelistptr[i++] = s;
+               for (; *s && *s != ' '; s++)
+                  ;
+            }
+            if (!k->batch)
+               k->filelistptr[i++] = s;
+            k->filelistptr[i] = (UCHAR *)0;
+            for (i = 0; k->filelistptr[i]; i++)
             {
-               PRINT_DDEBUG_ARG("The file specified in GET parameters ('%s') is not accessible", k->xdatabuf);
-               epkt("The file specified in GET parameters is not accessible", k);
-               r->arg = k->xdatabuf;
-               return X_ERROR; /* We sent en error packet, so abort now */
+               if (strlen((char *)k->filelistptr[i]) >= FN_MAX || k->accessf(k, k->filelistptr[i]) != X_OK)
+               {
+                  PRINT_DDEBUG_ARG("The file specified in GET parameters ('%s') is not accessible", k->filelistptr[i]);
+                  epkt("The file specified in GET parameters is not accessible", k);
+                  r->arg = k->filelistptr[i];
+                  return X_ERROR; /* We sent en error packet, so abort now */
+               }
+            }
+            if (i == 0)
+            {
+               epkt("No file in GET parameters", k);
+               return X_ERROR;
             }
 
-            k->filelistptr[0] = (UCHAR *)k->xdatabuf;
-            k->filelistptr[1] = (UCHAR *)0;
             k->filelist = (UCHAR **)k->filelistptr;
+            k->nfiles = 0;
+            if (k->trustok)
+               pick_prefixes(k);
 
             //Acknowledgment from server : send initiation of connection
             if (rpar(k, 'S') != X_OK) /* Send S packet with my parameters */
@@ -3163,9 +4068,10 @@ kermit(short fc,             /* Function code */
             return (X_OK);
          }
          else
-         {
+         { /* Only fails if the names do not fit */
             PRINT_DDEBUG("Decoding 'R' packet : failed");
-            rc = nak(k, 0, -1);
+            epkt("GET parameters too long", k);
+            return X_ERROR;
          }
          return (rc);
       }
@@ -3185,6 +4091,14 @@ kermit(short fc,             /* Function code */
 
             debug(DB_CHR, "rtyp not Y, rtyp", 0, rtyp);
 
+            if (k->streaming && rtyp == 'N')
+            {
+               /* Nothing to resend, the link was supposed to be reliable */
+               debug(DB_LOG, "NAK while streaming rseq", 0, rseq);
+               epkt("NAK while streaming", k);
+               return (X_ERROR);
+            }
+
             if (k->state == S_DATA &&
                 rtyp == 'N' && rseq == ((k->r_seq + 1) & 63))
             {
@@ -3226,7 +4140,8 @@ kermit(short fc,             /* Function code */
                if (rc == 0)
                {                      /* If there was no data to send */
                   k->closef(k, 0, 1); /* Close input file */
-                  k->state = S_EOF;   /* And wait for ACK */
+                  report_escapes(k, r);
+                  k->state = S_EOF; /* And wait for ACK */
                   r->rstatus = S_EOF;
                   k->s_seq--;
                   if (k->s_seq < 0)
@@ -3238,10 +4153,17 @@ kermit(short fc,             /* Function code */
             }
             else
             {
+               s_slot = k->s_pw[rseq];
+               if (s_slot >= 0 && s_slot < k->wslots &&
+                   k->opktinfo[s_slot].seq == rseq && k->opktinfo[s_slot].flg)
+               {
+                  debug(DB_LOG, "ignoring NAK -- already ACK'd rseq", 0, rseq);
+                  return (X_OK);
+               }
                debug(DB_LOG, "6: resending rseq", 0, rseq);
                // resend will send rseq if it's in the send table
                // otherwise it will resend earliest unacked packet
-               ret = resend(k, rseq);
+               ret = resend(k, rseq, RT_NAK);
                debug(DB_LOG, "ret", 0, ret);
                return (ret);
             }
@@ -3260,8 +4182,17 @@ kermit(short fc,             /* Function code */
          }
 
          // set ACK'd flag for that send slot
+         rtt_update(k, s_slot);
+         data_ack(k, s_slot);
+         tune_ack(k, s_slot);
          k->opktinfo[s_slot].flg = 1;
 
+         if ((k->capas2 & CAP2_CA) && *pdf == ACK_CUM)
+            ack_upto(k, rseq); // and the packets sent before it
+         // resend the packets this ACK overtook
+         else if ((rc = fast_resend(k, rseq)) != X_OK)
+            return (rc);
+
          // remove earliest and subsequent
          free_sslot_easca(k);
 
@@ -3323,6 +4254,8 @@ kermit(short fc,             /* Function code */
       { /* Got ACK to S packet? */
          debug(DB_MSG, "S_INIT", 0, 0);
          spar(k, pdf, datalen); /* Set negotiated parameters */
+         trusted_link(k);
+         tune_start(k);
          debug(DB_CHR, "Parity", 0, k->parity);
          debug(DB_LOG, "Ebqflg", 0, k->ebqflg);
          debug(DB_CHR, "Ebq", 0, k->ebq);
@@ -3362,8 +4295,12 @@ kermit(short fc,             /* Function code */
                break;
          }
          (k->filelist)++;
+         k->nfiles++;
          debug(DB_LOG, "Filename", k->filename, 0);
-         if ((rc = (k->openf)(k, k->filename, 1, r->filesize)) != X_OK) /* Try to open */
+         k->cz = 0;
+         if ((k->capas2 & CAP2_CZ) && (k->openf)(k, k->filename, 4, r->filesize) == X_OK)
+            k->cz = 1; /* Its compressed variant */
+         else if ((rc = (k->openf)(k, k->filename, 1, r->filesize)) != X_OK) /* Try to open */
          {
             debug(DB_LOG, "k->openf failed rc", 0, rc);
             return (rc);
@@ -3383,6 +4320,8 @@ kermit(short fc,             /* Function code */
          }
          r->sofar = 0L;
          r->sofar_rumor = 0L;
+         k->n_esc = k->n_dat = 0;
+         k->rs = RS_NONE;
          k->state = S_FILE; /* Wait for ACK */
          r->rstatus = S_FILE;
       }
@@ -3501,6 +4440,16 @@ kermit(short fc,             /* Function code */
 
    case S_ATTR: /* Got ACK to A packet */
    case S_DATA: /* Got ACK to D packet */
+      if (k->state == S_ATTR && k->rs == RS_ASKED)
+      {
+         if ((rc = srecover(k, r, pdf)) != X_OK)
+            return (rc);
+         if (k->rs == RS_OFFSET)
+         {                       /* Second A packet sent */
+            k->r_seq = k->s_seq; /* Wait for its ACK */
+            return (X_OK);
+         }
+      }
       if (k->state == S_ATTR)
       {
          /*
@@ -3514,7 +4463,10 @@ kermit(short fc,             /* Function code */
          r->rstatus = S_DATA;
       }
 
-      buf = get_sslot(k, &s_slot); // get a new send slot
+      if (nused_sslots(k) >= k->cwnd)
+         s_slot = -1; // window reduced by the autotuning
+      else
+         buf = get_sslot(k, &s_slot); // get a new send slot
       if (s_slot < 0)
       {
          debug(DB_LOG, "window full k->state", 0, k->state);
@@ -3540,6 +4492,7 @@ kermit(short fc,             /* Function code */
       if (rc == 0)
       {                      /* If there was no data to send */
          k->closef(k, 0, 1); /* Close input file */
+         report_escapes(k, r);
 
          debug(DB_LOG, "NUSED_SSLOTS", 0, nused_sslots(k));
 
@@ -3605,8 +4558,10 @@ kermit(short fc,             /* Function code */
          debug(DB_LOG, "  k->capas & CAP_LP", 0, k->capas & CAP_LP);
          debug(DB_LOG, "  k->capas & CAP_SW", 0, k->capas & CAP_SW);
          debug(DB_LOG, "  k->capas & CAP_AT", 0, k->capas & CAP_AT);
-         debug(DB_LOG, "  k->capas & CAP_RS", 0, k->capas & CAP_RS);
+         debug(DB_LOG, "  k->capas2 & CAP2_RS", 0, k->capas2 & CAP2_RS);
          debug(DB_LOG, "  k->capas & CAP_LS", 0, k->capas & CAP_LS);
+         debug(DB_LOG, "  k->capas2 & CAP2_CZ", 0, k->capas2 & CAP2_CZ);
+         debug(DB_LOG, "  k->capas2 & CAP2_CA", 0, k->capas2 & CAP2_CA);
          debug(DB_CHR, "  k->ebq           ", 0, k->ebq);
          debug(DB_LOG, "  k->ebqflg        ", 0, k->ebqflg);
          debug(DB_LOG, "  k->parity        ", 0, k->parity);
@@ -3630,6 +4585,7 @@ kermit(short fc,             /* Function code */
             debug(DB_MSG, "R_WAIT error rpar(Y) failed", 0, 0);
             return (X_ERROR); /* I/O error, quit. */
          }
+         trusted_link(k);
          if (k->what == W_DIR)
          {
             k->state = R_DATA;
@@ -3647,12 +4603,12 @@ kermit(short fc,             /* Function code */
       else if (k->what == W_GET)
       {
          debug(DB_MSG, "  what==W_GET so resending R-packet", 0, 0);
-         rc = resend(k, 0);
+         rc = resend(k, 0, RT_BAD);
       }
       else
       {
          debug(DB_MSG, "  unexpected packet so send NAK for seq 0", 0, 0);
-         rc = nak(k, 0, -1);
+         rc = nak(k, 0, -1, RT_BAD);
       }
       if (rc != X_OK)
          debug(DB_LOG, "R_WAIT rc not X_OK: rc", 0, rc);
@@ -3662,7 +4618,7 @@ kermit(short fc,             /* Function code */
       debug(DB_CHR, "R_FILE rtyp", 0, rtyp);
       if (rtyp == 'F')
       {                                               /* File name */
-         if ((rc = decode(k, r, 0, pdf, -1)) == X_OK) /* Decode and save */
+         if ((rc = decode(k, r, 0, pdf, -1, sizeof(r->filename))) == X_OK) /* Decode and save */
             k->state = R_ATTR;                        /* Switch to next state */
          r->rstatus = k->state;
          debug(DB_LOG, "R_FILE decode rc", 0, rc);
@@ -3673,6 +4629,11 @@ kermit(short fc,             /* Function code */
             r->filesize = 0L;               /* Or file size */
             r->sofar = 0L;                  /* Or bytes transferred yet */
             r->sofar_rumor = 0L;            /* Or bytes transferred yet */
+            k->n_esc = k->n_dat = 0;        /* Or prefixes */
+            k->rs = RS_NONE;                /* Or recovery */
+            k->rs_len = k->rs_off = 0;
+            k->cz = 0;                      /* Or compression */
+            k->dp_tack = -1;                /* Or data phase */
             rc = ack(k, rseq, r->filename); /* so ACK the F packet */
          }
          else
@@ -3736,6 +4697,13 @@ kermit(short fc,             /* Function code */
          x = gattr(k, pdf, r); /* Read the attributes */
          if (x > -1)
             k->binary = x;
+         if (k->rs == RS_ASKED)
+         {                            /* Tell what we kept */
+            ack_recover(k, r, rseq); /* and accept the file */
+            return (X_OK);
+         }
+         if (k->rs == RS_OFFSET && k->rs_off != k->rs_len)
+            k->rs_off = 0;           /* Not what we kept, start again */
          ack(k, rseq, (UCHAR *)"Y"); /* Always accept the file */
          return (X_OK);
       }
@@ -3745,7 +4713,17 @@ kermit(short fc,             /* Function code */
          k->filename = r->filename;
          r->sofar = 0L;
          r->sofar_rumor = 0L;
-         if ((rc = (*(k->openf))(k, r->filename, 2, r->filesize)) == X_OK)
+         k->cz_nflags = k->cz_pos = k->cz_len = 0; /* Decompressor */
+         k->cz_hi = -1;
+         k->ackpend = 0;
+         k->acknext = k->r_seq; /* In sequence after the A packet */
+         i = 2; /* Create */
+         if (k->rs == RS_OFFSET && k->rs_off > 0)
+         {
+            i = 3; /* Append to the partial file */
+            r->sofar = r->sofar_rumor = k->rs_off;
+         }
+         if ((rc = (*(k->openf))(k, r->filename, i, r->filesize)) == X_OK)
          {
             k->state = R_DATA; /* Switch to Data state */
             r->rstatus = k->state;
@@ -3815,6 +4793,8 @@ kermit(short fc,             /* Function code */
    case R_DATA: /* Want a D or Z packet */
       debug(DB_CHR, "R_DATA rtyp", 0, rtyp);
       debug(DB_LOG, "R_DATA rseq", 0, rseq);
+      if (rtyp != 'D' && (rc = ack_flush(k)) != X_OK)
+         return (rc);
       if (rtyp == 'X')
       {
          // rc = handle_good_rpkt (k, r, rseq, pdf);
@@ -3839,6 +4819,7 @@ kermit(short fc,             /* Function code */
          if (k->recvdir == 0)
          {
             flush_to_file(k, r);
+            report_escapes(k, r);
             if (((rc = (*(k->closef))(k, *pdf, 2)) == X_OK) && (rc == X_OK))
                k->state = R_FILE;
             debug(DB_LOG, "R_DATA closef rc", 0, rc);
@@ -56,7 +56,10 @@ int xerror()
 }
 #endif /* DEBUG */
 
-static int kermit_main(int action, UCHAR **cmlist, UCHAR **arg, UCHAR *type, int *nresend)
+/* Server session kept open after its last transaction, see _EK_start_server() */
+static int session_open = 0;
+
+static int kermit_main(int action, UCHAR **cmlist, UCHAR **arg, UCHAR *type, int *nresend, int batch)
 {
 #ifndef BSP_INTERNAL_BUFFER_SIZE
 	int status = 0, rx_len = 0, retrycounter = 0;
@@ -65,7 +68,7 @@ static int kermit_main(int action, UCHAR **cmlist, UCHAR **arg, UCHAR *type, int
 	UCHAR *inbuf = 0;
 
 	PRINT_DDEBUG_ARG("Entering %s...\n", __FUNCTION__);
-	if (kdevopen() != 0)
+	if (!session_open && kdevopen() != 0)
 	{
 		PRINT_DDEBUG_ARG("Entering %s...\n", __FUNCTION__);
 		if (type != NULL)
@@ -78,9 +81,12 @@ static int kermit_main(int action, UCHAR **cmlist, UCHAR **arg, UCHAR *type, int
 	r.type = A_WAIT;
 	k.filelist = cmlist;
 
-	status = kermit(K_REINIT, &k, 0, "eksw init", &r);
+	/* The next transaction of a batch session keeps the timeout and the tuning */
+	status = kermit(session_open ? K_NEXT : K_REINIT, &k, 0, "eksw init", &r);
+	session_open = 0;
 	if (status != X_OK)
 		return K_ERROR;
+	k.batch = batch;
 
 	if (action == A_DIR)
 	{
@@ -142,6 +148,8 @@ static int kermit_main(int action, UCHAR **cmlist, UCHAR **arg, UCHAR *type, int
 					PRINT_DDEBUG_ARG("In %s, timeout while reading\n", __FUNCTION__);
 				}
 			}
+			else
+				retrycounter = k.retry + 1; /* Only the timeouts in a row are counted */
 		}
 		/*
 		For simplicity, kermit() ACKs the packet immediately after verifying it was
@@ -151,8 +159,8 @@ static int kermit_main(int action, UCHAR **cmlist, UCHAR **arg, UCHAR *type, int
 		*/
 		//PRINT_DDEBUG_ARG("In %s, before rx_len...\n", __FUNCTION__);
 
-		/* Handle the input */
-		if (rx_len == 0)
+		/* Handle the input, not counting the idle link that sends the ACK held back */
+		if (rx_len == 0 && k.ackpend == 0)
 		{
 			if (retrycounter == 0)
 			{
@@ -219,7 +227,10 @@ kermit_main_end:
 		if (arg != NULL)
 			*arg = r.arg;
 	}
-	kdevclose();
+	/* Kept open for the next transaction of a batch session */
+	session_open = (batch && ret == K_SUCCESS);
+	if (!session_open)
+		kdevclose();
 	/* Close file anyway in case of receive stop because we are not sure that the reception file is properly closed*/
 	kclosefile(&k, (UCHAR)0, 2);
 
@@ -231,7 +242,7 @@ kermit_main_end:
 	UCHAR *inbuf = 0;
 
 	PRINT_DDEBUG_ARG("Entering %s...\n", __FUNCTION__);
-	if (kdevopen() != 0)
+	if (!session_open && kdevopen() != 0)
 	{
 		PRINT_DDEBUG_ARG("Entering %s...\n", __FUNCTION__);
 		if (type != NULL)
@@ -244,9 +255,12 @@ kermit_main_end:
 	r->type = A_WAIT;
 	k->filelist = cmlist;
 
-	status = kermit(K_REINIT, k, 0, "eksw init", r);
+	/* The next transaction of a batch session keeps the timeout and the tuning */
+	status = kermit(session_open ? K_NEXT : K_REINIT, k, 0, "eksw init", r);
+	session_open = 0;
 	if (status != X_OK)
 		return K_ERROR;
+	k->batch = batch;
 
 	if (action == A_DIR)
 	{
@@ -308,6 +322,8 @@ kermit_main_end:
 					PRINT_DDEBUG_ARG("In %s, timeout while reading\n", __FUNCTION__);
 				}
 			}
+			else
+				retrycounter = k->retry + 1; /* Only the timeouts in a row are counted */
 		}
 		/*
 		For simplicity, kermit() ACKs the packet immediately after verifying it was
@@ -317,8 +333,8 @@ kermit_main_end:
 		*/
 		PRINT_DDEBUG_ARG("In %s, before rx_len...\n", __FUNCTION__);
 
-		/* Handle the input */
-		if (rx_len == 0)
+		/* Handle the input, not counting the idle link that sends the ACK held back */
+		if (rx_len == 0 && k->ackpend == 0)
 		{
 			if (retrycounter == 0)
 			{
@@ -380,7 +396,10 @@ kermit_main_end:
 		if (arg != NULL)
 			*arg = r->arg;
 	}
-	kdevclose();
+	/* Kept open for the next transaction of a batch session */
+	session_open = (batch && ret == K_SUCCESS);
+	if (!session_open)
+		kdevclose();
 	/* Close file anyway in case of receive stop because we are not sure that the reception file is properly closed*/
 	kclosefile(k, (UCHAR)0, 2);
 
@@ -405,6 +424,8 @@ int _EK_init(char *root_path, void *priv)
 	if (priv == NULL)
 		return (K_FAILURE);
 
+	session_open = 0;
+
 	debug(DB_MSG, "==========", 0, 0);
 	debug(DB_OPN, "debug.log", 0, 0);
 	debug(DB_MSG, "Initializing...", 0, 0);
@@ -413,8 +434,10 @@ int _EK_init(char *root_path, void *priv)
 	/*  Fill in parameters for this run */
 	memset(&k, 0, sizeof(k));
 
-	k.wslots_max = 1; // default to use one window slot
+	k.wslots_max = P_WSLOTS; // offer the whole window, the autotuning uses what fits the link
 	k.p_maxlen = P_PKTLEN;
+	k.streamok = 1; // the BLE link is reliable, stream if the other Kermit agrees
+	k.trustok = 1;  // and it checks the integrity, lightest block check if it agrees
 	k.send_pause_us = 1000000;
 	k.baud = 115200;
 
@@ -451,6 +474,9 @@ int _EK_init(char *root_path, void *priv)
 #endif
 	k.getdirdata = kgetdirdata;
 	k.accessf = kaccessfile;
+	k.crcf = kcrcfile; /* for the recovery */
+	k.clockf = kclock; /* for the adaptive timeout */
+	k.linkf = klinkinfo; /* for the autotuning */
 	k.priv = priv;
 
 	/* Initialize Kermit protocol */
@@ -496,6 +522,7 @@ int _EK_deinit(void)
 {
 	/* You should have check that init has been done before... */
 	int err = kdevdeinit();
+	session_open = 0;
 	return (err);
 }
 
@@ -509,11 +536,14 @@ int _EK_init_memory(char *root_path, void *priv)
 #else
 	int status = X_OK;
 
+	session_open = 0;
 	/*  Fill in parameters for this run */
 	memset(k, 0, sizeof(struct k_data));
 
-	k->wslots_max = 1; // default to use one window slot
+	k->wslots_max = P_WSLOTS; // offer the whole window, the autotuning uses what fits the link
 	k->p_maxlen = P_PKTLEN;
+	k->streamok = 1; // the BLE link is reliable, stream if the other Kermit agrees
+	k->trustok = 1;  // and it checks the integrity, lightest block check if it agrees
 	k->send_pause_us = 1000000;
 	k->baud = 115200;
 
@@ -550,6 +580,9 @@ int _EK_init_memory(char *root_path, void *priv)
 #endif
 	k->getdirdata = kgetdirdata;
 	k->accessf = kaccessfile;
+	k->crcf = kcrcfile; /* for the recovery */
+	k->clockf = kclock; /* for the adaptive timeout */
+	k->linkf = klinkinfo; /* for the autotuning */
 	k->priv = priv;
 
 	/* Initialize Kermit protocol */
@@ -568,12 +601,12 @@ int _EK_init_memory(char *root_path, void *priv)
 /*-----------------------------------------------------------------------------
  * _EK_start_server()
  *-----------------------------------------------------------------------------*/
-uint8_t _EK_start_server(ek_transaction_type_e *type, char **arg, int *nresend)
+uint8_t _EK_start_server(ek_transaction_type_e *type, char **arg, int *nresend, int batch)
 {
 	int ret = K_SUCCESS;
 	unsigned char k_type = 0;
 
-	ret = kermit_main(A_WAIT, NULL, (UCHAR **)arg, &k_type, nresend);
+	ret = kermit_main(A_WAIT, NULL, (UCHAR **)arg, &k_type, nresend, batch);
 
 	/* Translate type */
 	switch (k_type)
@@ -595,6 +628,44 @@ uint8_t _EK_start_server(ek_transaction_type_e *type, char **arg, int *nresend)
 	return ret;
 }
 
+/*-----------------------------------------------------------------------------
+ * _EK_get_stats()
+ *-----------------------------------------------------------------------------*/
+void _EK_get_stats(ek_stats_t *stats)
+{
+#ifndef BSP_INTERNAL_BUFFER_SIZE
+	struct k_data *kp = &k;
+#else
+	struct k_data *kp = k;
+#endif
+
+	if (stats == NULL || kp == NULL)
+		return;
+
+	stats->nresend = kp->nresend;
+	stats->nresend_timeout = kp->nresend_why[RT_TIMEOUT];
+	stats->nresend_nak = kp->nresend_why[RT_NAK];
+	stats->nresend_fast = kp->nresend_why[RT_FAST];
+	stats->nresend_bad = kp->nresend_why[RT_BAD];
+	stats->nnak = kp->nsnak;
+	stats->nnak_gap = kp->nsnak_why[RT_GAP];
+	stats->nnak_bad = kp->nsnak_why[RT_BAD];
+	stats->nfiles = kp->nfiles;
+	stats->dbytes = kp->dp_bytes;
+	stats->dms = kp->dp_ms;
+	stats->dpkts = kp->dp_npkt;
+	if (kp->link.mtu > 0 && kp->at_bps > 0)
+	{ /* Autotuned */
+		stats->maxlen = kp->at_bestlen;
+		stats->window = kp->at_bestwin;
+	}
+	else
+	{
+		stats->maxlen = kp->s_maxlen;
+		stats->window = kp->wslots;
+	}
+}
+
 /*-----------------------------------------------------------------------------
  * _EK_get()
  *-----------------------------------------------------------------------------*/
@@ -610,7 +681,7 @@ int _EK_get(char *filename)
 	array[1] = (unsigned char *)0;
 	filelist = array;
 
-	ret = kermit_main(A_GET, (UCHAR **)filelist, NULL, NULL, NULL);
+	ret = kermit_main(A_GET, (UCHAR **)filelist, NULL, NULL, NULL, 0);
 
 	return ret;
 }
@@ -630,7 +701,7 @@ int _EK_send(char *filename)
 	array[1] = (unsigned char *)0;
 	filelist = array;
 
-	ret = kermit_main(A_SEND, (UCHAR **)filelist, NULL, NULL, NULL);
+	ret = kermit_main(A_SEND, (UCHAR **)filelist, NULL, NULL, NULL, 0);
 
 	return ret;
 }
@@ -649,7 +720,7 @@ int _EK_dir(char **result)
 	array[1] = (unsigned char *)0;
 	filelist = array;
 
-	ret = kermit_main(A_DIR, (UCHAR **)filelist, (UCHAR **)result, NULL, NULL);
+	ret = kermit_main(A_DIR, (UCHAR **)filelist, (UCHAR **)result, NULL, NULL, 0);
 
 	return ret;
 }
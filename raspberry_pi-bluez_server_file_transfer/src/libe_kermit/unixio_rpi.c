@@ -28,6 +28,13 @@ static FILE *ifile = (FILE *)0; /* and pointers */
 #define KFILENAME_MAXSIZE 256
 static char kfilename[KFILENAME_MAXSIZE] = {0};
 
+/* Compressed variant of a file, next to it */
+#define KCZ_SUFFIX ".lzs"
+#define KCZ_TMP_SUFFIX ".tmp"
+#define KCZ_HDR_N 3 /* Header: mtime seconds, nanoseconds and size of the file */
+#define KCZ_HASH 4096 /* Hash of 3 bytes, to find the references */
+#define KCZ_DEPTH 64  /* References tried per position */
+
 /* DEBUG */
 #ifdef DEBUG
 static FILE *dp = (FILE *)0; /* Debug log */
@@ -220,9 +227,21 @@ int kreadpkt(struct k_data *k, UCHAR *p, int len)
 
   while (1)
   {
-    timeout = k->r_timo;
-    /* Set timeout in second with more than 5 retry */
-    timeout = timeout * 1200;
+    /*
+     * Adaptive timeout in ms, from the round trip time, while waiting for
+     * ACKs. The wait for the next command of a batch session or for the
+     * packets of the sender is the one of r_timo.
+     */
+    if (k->rto > 0 && k->what != W_RECV && k->state != R_WAIT)
+      timeout = k->rto;
+    else
+    {
+      timeout = k->r_timo;
+      /* Set timeout in second with more than 5 retry */
+      timeout = timeout * 1200;
+    }
+    if (k->ackpend > 0 && !flag && timeout > P_ACKDELAY)
+      timeout = P_ACKDELAY; /* Idle link, kermit() sends the ACK held back */
     /* wait for the next character */
 
     do
@@ -330,16 +349,162 @@ int ktx_data(struct k_data *k, UCHAR *p, int n)
   return X_OK;
 }
 
+static inline unsigned int kczhash(const UCHAR *p)
+{
+  return ((p[0] << 8) ^ (p[1] << 4) ^ p[2]) & (KCZ_HASH - 1);
+}
+
+/*-----------------------------------------------------------------------------
+ * L Z S S -- Compress a buffer in the format of AT_CZ (kermit.h)
+ *
+ * Greedy parsing, the longest of the KCZ_DEPTH last references with the
+ * same 3 bytes hash is taken. Returns X_OK, or X_ERROR on write error.
+ *-----------------------------------------------------------------------------*/
+static int klzss(const UCHAR *in, long n, FILE *out)
+{
+  static long head[KCZ_HASH], prev[P_CZ_WINDOW];
+  UCHAR grp[1 + 8 * 2];
+  long i = 0, p = 0, cand = 0;
+  int ngrp = 1, nitem = 0, len = 0, best = 0, dist = 0, depth = 0;
+  unsigned int v = 0;
+
+  for (p = 0; p < KCZ_HASH; p++)
+    head[p] = -1;
+  grp[0] = 0;
+
+  while (i < n)
+  {
+    best = 0;
+    if (i + P_CZ_MINLEN <= n)
+    {
+      cand = head[kczhash(&in[i])];
+      for (depth = 0; cand >= 0 && i - cand <= P_CZ_WINDOW && depth < KCZ_DEPTH; depth++)
+      {
+        for (len = 0; len < P_CZ_MAXLEN && i + len < n && in[cand + len] == in[i + len]; len++)
+          ;
+        if (len > best)
+        {
+          best = len;
+          dist = i - cand;
+          if (len == P_CZ_MAXLEN)
+            break;
+        }
+        cand = prev[cand % P_CZ_WINDOW];
+      }
+    }
+
+    if (best >= P_CZ_MINLEN)
+    { /* Reference */
+      v = ((dist - 1) << (16 - P_CZ_DBITS)) | (best - P_CZ_MINLEN);
+      grp[ngrp++] = v >> 8;
+      grp[ngrp++] = v & 0xff;
+    }
+    else
+    { /* Literal */
+      best = 1;
+      grp[0] |= 1 << nitem;
+      grp[ngrp++] = in[i];
+    }
+
+    for (p = i; p < i + best; p++)
+    { /* Positions covered, for the next references */
+      if (p + P_CZ_MINLEN > n)
+        break;
+      prev[p % P_CZ_WINDOW] = head[kczhash(&in[p])];
+      head[kczhash(&in[p])] = p;
+    }
+    i += best;
+
+    if (++nitem == 8 || i >= n)
+    { /* Group done */
+      if (fwrite(grp, 1, ngrp, out) != (size_t)ngrp)
+        return X_ERROR;
+      grp[0] = 0;
+      ngrp = 1;
+      nitem = 0;
+    }
+  }
+  return X_OK;
+}
+
+/*-----------------------------------------------------------------------------
+ * C Z V A R I A N T -- Name of the compressed variant of a file
+ *
+ * The variant is made next to the file the first time it is asked. It
+ * starts with the modification time and the size of the file it was made
+ * from, and is made again when they differ, whether the file is newer or
+ * not (cp -p, rsync -a, rewrite in the same second...). Returns X_ERROR
+ * if the file does not compress, the file is then sent as is.
+ *-----------------------------------------------------------------------------*/
+static int kczvariant(const char *name, char *czname, size_t size)
+{
+  char tmpname[KFILENAME_MAXSIZE + sizeof(KCZ_SUFFIX) + sizeof(KCZ_TMP_SUFFIX)];
+  struct stat st = {0}, czst = {0};
+  int64_t hdr[KCZ_HDR_N] = {0}, czhdr[KCZ_HDR_N] = {0};
+  UCHAR *in = NULL;
+  FILE *fp = NULL;
+  int rc = X_OK;
+
+  if (snprintf(czname, size, "%s" KCZ_SUFFIX, name) >= (int)size || stat(name, &st) != 0 || st.st_size == 0)
+    return X_ERROR;
+  hdr[0] = st.st_mtim.tv_sec;
+  hdr[1] = st.st_mtim.tv_nsec;
+  hdr[2] = st.st_size;
+
+  if ((fp = fopen(czname, "r")) != NULL)
+  {
+    if (fread(czhdr, sizeof(czhdr), 1, fp) != 1 || fstat(fileno(fp), &czst) != 0)
+      czhdr[2] = -1;
+    fclose(fp);
+    fp = NULL;
+  }
+
+  if (memcmp(hdr, czhdr, sizeof(hdr)) != 0)
+  {
+    if (snprintf(tmpname, sizeof(tmpname), "%s" KCZ_TMP_SUFFIX, czname) >= (int)sizeof(tmpname))
+      return X_ERROR;
+    in = malloc(st.st_size);
+    fp = fopen(name, "r");
+    if (in == NULL || fp == NULL || fread(in, 1, st.st_size, fp) != (size_t)st.st_size)
+      rc = X_ERROR;
+    if (fp)
+      fclose(fp);
+
+    /* written in a temporary file, so that a partial variant is never sent */
+    fp = (rc == X_OK) ? fopen(tmpname, "w") : NULL;
+    if (fp == NULL || fwrite(hdr, sizeof(hdr), 1, fp) != 1 || klzss(in, st.st_size, fp) != X_OK)
+      rc = X_ERROR;
+    if (fp && fclose(fp) != 0)
+      rc = X_ERROR;
+    if (rc == X_OK && rename(tmpname, czname) != 0)
+      rc = X_ERROR;
+    if (fp && rc != X_OK)
+      unlink(tmpname);
+    free(in);
+    if (rc != X_OK || stat(czname, &czst) != 0)
+      return X_ERROR;
+    PRINT_DDEBUG_ARG("Compressed variant %s made", czname);
+  }
+
+  /* kept even if it does not compress, so that it is not made again */
+  if (czst.st_size - (off_t)sizeof(hdr) >= st.st_size)
+    return X_ERROR;
+  PRINT_DDEBUG_ARG("Sending %ld bytes of compressed data", (long)(czst.st_size - sizeof(hdr)));
+  return X_OK;
+}
+
 /*-----------------------------------------------------------------------------
  * O P E N F I L E -- Open output file
  *
  * Call with: Pointer to filename. Size in bytes. Creation date in format
  * yyyymmdd hh:mm:ss, e.g. 19950208 14:00:00 Mode: 1 = read, 2 = create, 3
- * = append. Returns: X_OK on success. X_ERROR on failure, including
- * rejection based on name, size, or date.
+ * = append, 4 = read the compressed variant. Returns: X_OK on success.
+ * X_ERROR on failure, including rejection based on name, size, or date.
  *-----------------------------------------------------------------------------*/
 int kopenfile(struct k_data *k, UCHAR *s, int mode, long filesize)
 {
+  char czname[KFILENAME_MAXSIZE + sizeof(KCZ_SUFFIX)];
+
   PRINT_DDEBUG_ARG("Entering %s...", __FUNCTION__);
   debug(DB_LOG, "OPENFILE ", s, 0);
   debug(DB_LOG, "  mode", 0, mode);
@@ -348,12 +513,22 @@ int kopenfile(struct k_data *k, UCHAR *s, int mode, long filesize)
 
   switch (mode)
   {
+  case 4: /* Read the compressed variant */
+    if (kczvariant(kfilename, czname, sizeof(czname)) != X_OK)
+      return (X_ERROR);
+    /* fall through */
   case 1: /* Read */
-    if (!(ifile = fopen((char *)kfilename, "r")))
+    if (!(ifile = fopen((mode == 4) ? czname : (char *)kfilename, "r")))
     {
       debug(DB_LOG, "openfile read error", kfilename, 0);
       return (X_ERROR);
     }
+    if (mode == 4 && fseek(ifile, KCZ_HDR_N * sizeof(int64_t), SEEK_SET) != 0)
+    { /* Data after the header */
+      fclose(ifile);
+      ifile = (FILE *)0;
+      return (X_ERROR);
+    }
     k->s_first = 1;        /* Set up for getkpt */
     k->zinbuf[0] = '\0';   /* Initialize buffer */
     k->zinptr = k->zinbuf; /* Set up buffer pointer */
@@ -523,7 +698,7 @@ int kclosefile(struct k_data *k, UCHAR c, int mode)
     debug(DB_LOG, "closefile (output) keep", 0, k->ikeep);
     if (close(ofile) < 0) /* Try to close */
       rc = X_ERROR;
-    if ((k->ikeep == 0) && (c == 'D')) /* Don't keep incomplete files */
+    if ((k->ikeep == 0) && (c == 'D') && !(k->capas2 & CAP2_RS)) /* Don't keep incomplete files, unless they can be recovered */
     {
       kadd_rootpath(k->rootpath, k->filename, kfilename, KFILENAME_MAXSIZE);
       if (k->filename)
@@ -562,6 +737,7 @@ int kgetdirdata(struct k_data *k, char *pdf)
   struct dirent *ep = {0};
   unsigned long etag = 0;
   FILE *fp = NULL;
+  size_t len = 0;
 
   kadd_rootpath(k->rootpath, k->dirname, kfilename, KFILENAME_MAXSIZE);
   dir = (DIR *)opendir(kfilename);
@@ -576,6 +752,10 @@ int kgetdirdata(struct k_data *k, char *pdf)
   { /* We show only the files on the first level of the asked directory */
     if ((ep->d_type != DT_REG) && (ep->d_type != DT_LNK))
       continue;
+    /* Compressed variants are sent in place of their file */
+    len = strlen(ep->d_name);
+    if (len > strlen(KCZ_SUFFIX) && strcmp(ep->d_name + len - strlen(KCZ_SUFFIX), KCZ_SUFFIX) == 0)
+      continue;
     /* Let's use k->xdatabuf as a temporary buffer */
     strcpy((char *)k->xdatabuf, kfilename);
     strcat((char *)k->xdatabuf, "/");
@@ -627,6 +807,70 @@ int kaccessfile(struct k_data *k, UCHAR *s)
   return X_OK;
 }
 
+/*-----------------------------------------------------------------------------
+ * C L O C K -- Monotonic time in ms, to measure the round trip time
+ *-----------------------------------------------------------------------------*/
+long kclock(struct k_data *k)
+{
+  struct timespec ts = {0};
+
+  if (clock_gettime(CLOCK_MONOTONIC, &ts) != 0)
+    return 0;
+  return (long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/*-----------------------------------------------------------------------------
+ * L I N K I N F O -- Payload of one link write, connection interval, and
+ * the packet length and window learned on the link
+ *
+ * Set by the transport before the session, they seed the autotuning of
+ * the window and packet length. Returns X_ERROR if they are unknown.
+ *-----------------------------------------------------------------------------*/
+int klinkinfo(struct k_data *k, struct k_link *link)
+{
+  struct unixio_rpi *h = k->priv;
+
+  if (h == NULL || h->link_mtu == 0)
+    return X_ERROR;
+  link->mtu = h->link_mtu;
+  link->itv = h->link_interval_ms;
+  link->maxlen = h->link_maxlen;
+  link->window = h->link_window;
+  return X_OK;
+}
+
+/*-----------------------------------------------------------------------------
+ * C R C F I L E -- CRC-32 of the first bytes of a file, for the recovery
+ *
+ * len is the number of bytes to check, or -1 for the whole file.
+ * Returns the number of bytes checked, or -1 if the file is missing, empty
+ * or shorter than len.
+ *-----------------------------------------------------------------------------*/
+long kcrcfile(struct k_data *k, UCHAR *s, long len, ULONG *crc)
+{
+  struct stat buf = {0};
+  uint32_t crc32 = 0;
+  FILE *fp = NULL;
+
+  kadd_rootpath(k->rootpath, s, kfilename, KFILENAME_MAXSIZE);
+  if (stat((const char *)kfilename, &buf) != 0)
+    return -1;
+  if (len < 0)
+    len = buf.st_size;
+  if (len == 0 || len > buf.st_size)
+    return -1;
+
+  fp = fopen((char *)kfilename, "r");
+  if (fp == NULL)
+    return -1;
+  if (CRCF_calc_crc((CRCF_FILE *)fp, 0, (uint32_t)len, &crc32))
+    len = -1;
+  fclose(fp);
+  *crc = crc32;
+  debug(DB_LOG, "crcfile len", 0, len);
+  return len;
+}
+
 int kdevopen(void)
 {
   return X_OK;
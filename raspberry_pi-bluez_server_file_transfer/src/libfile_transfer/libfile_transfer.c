@@ -111,13 +111,13 @@ unsigned char FT_start_server(ft_transaction_type_e *type, char **arg, int *nres
 	unsigned char ret = FT_SUCCESS;
 	ek_transaction_type_e ek_type = ft_type_other;
 
-	if ((gStatus.state == FT_IS_NOT_INITIALIZED) || (gStatus.mode != ft_mode_server))
+	if ((gStatus.state == FT_IS_NOT_INITIALIZED) || ((gStatus.mode != ft_mode_server) && (gStatus.mode != ft_mode_batch)))
 		return EACCES;
 
 	if ((type == NULL) || (arg == NULL))
 		return EINVAL;
 
-	ret = (unsigned char)_EK_start_server(&ek_type, arg, nresend);
+	ret = (unsigned char)_EK_start_server(&ek_type, arg, nresend, gStatus.mode == ft_mode_batch);
 
 	/* Translate type */
 	switch (ek_type)
@@ -150,6 +150,38 @@ unsigned char FT_start_server(ft_transaction_type_e *type, char **arg, int *nres
 	}
 }
 
+/*-----------------------------------------------------------------------------
+ * 													FT_get_stats()
+ *-----------------------------------------------------------------------------*/
+unsigned char FT_get_stats(ft_stats_t *stats)
+{
+	ek_stats_t ek_stats = {0};
+
+	if (gStatus.state == FT_IS_NOT_INITIALIZED)
+		return EACCES;
+
+	if (stats == NULL)
+		return EINVAL;
+
+	_EK_get_stats(&ek_stats);
+	stats->nresend = ek_stats.nresend;
+	stats->nresend_timeout = ek_stats.nresend_timeout;
+	stats->nresend_nak = ek_stats.nresend_nak;
+	stats->nresend_fast = ek_stats.nresend_fast;
+	stats->nresend_bad = ek_stats.nresend_bad;
+	stats->nnak = ek_stats.nnak;
+	stats->nnak_gap = ek_stats.nnak_gap;
+	stats->nnak_bad = ek_stats.nnak_bad;
+	stats->maxlen = ek_stats.maxlen;
+	stats->window = ek_stats.window;
+	stats->nfiles = ek_stats.nfiles;
+	stats->dbytes = ek_stats.dbytes;
+	stats->dms = ek_stats.dms;
+	stats->dpkts = ek_stats.dpkts;
+
+	return FT_SUCCESS;
+}
+
 /*-----------------------------------------------------------------------------
  * 													FT_init_memory()
  *-----------------------------------------------------------------------------*/
@@ -0,0 +1,202 @@
+/**
+ * Copyright (c) 2016, Innes SA,
+ * All Rights Reserved
+ *
+ * The copyright notice above does not evidence any
+ * actual or intended publication of such source code.
+ */
+
+/**
+ * @file   	link_profile.c
+ * @brief  	Persistent link settings of each SLATE, learned from its previous file transfers
+ * @author 	K. AUDIERNE
+ * @date 	2020-09-10
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <bluetooth/bluetooth.h>
+
+#include "link_profile.h"
+
+#define LINK_PROFILE_LINE_LEN 64
+
+/* File format, <dir>/<address>.link, one value per line:
+ *   interval <connection interval>
+ *   maxlen <Kermit packet length>
+ *   window <Kermit window>
+ *   best <goodput in bytes/s>
+ *   recent <goodput in bytes/s>
+ *   rssi <dBm>
+ *   sessions <count>
+ */
+
+static char m_dir[PATH_MAX] = "";
+
+static int profile_path(const bdaddr_t *addr, char *path, size_t size)
+{
+  char str[18];
+
+  if (m_dir[0] == '\0')
+    return -ENOENT;
+
+  ba2str(addr, str);
+  if (snprintf(path, size, "%s/%s.link", m_dir, str) >= (int)size)
+    return -ENAMETOOLONG;
+  return 0;
+}
+
+/** link_profile_load() --  load the profile of a SLATE
+ * Input : addr -- address of the SLATE
+ *         prof -- filled with the profile, cleared if there is none
+ * Return : 0 on success, negative errno otherwise
+ * Explanation : An invalid file is removed, so that the SLATE is connected with the
+ * default settings.
+ **/
+int link_profile_load(const bdaddr_t *addr, struct link_profile *prof)
+{
+  char path[PATH_MAX], line[LINK_PROFILE_LINE_LEN], key[16];
+  long value;
+  int err = 0;
+  FILE *fp;
+
+  memset(prof, 0, sizeof(*prof));
+  prof->rssi = 127;
+
+  err = profile_path(addr, path, sizeof(path));
+  if (err != 0)
+    return err;
+
+  fp = fopen(path, "r");
+  if (fp == NULL)
+    return -errno;
+
+  while (err == 0 && fgets(line, sizeof(line), fp) != NULL)
+  {
+    if (sscanf(line, "%15s %ld", key, &value) != 2)
+      err = -EINVAL;
+    else if (strcmp(key, "interval") == 0 && value >= 0x0006 && value <= 0x0C80)
+      prof->conn_interval = value;
+    else if (strcmp(key, "maxlen") == 0 && value >= 0 && value <= UINT16_MAX)
+      prof->kermit_maxlen = value;
+    else if (strcmp(key, "window") == 0 && value >= 0 && value <= UINT8_MAX)
+      prof->kermit_window = value;
+    else if (strcmp(key, "best") == 0 && value >= 0)
+      prof->best_goodput = value;
+    else if (strcmp(key, "recent") == 0 && value >= 0)
+      prof->recent_goodput = value;
+    else if (strcmp(key, "rssi") == 0 && value >= INT8_MIN && value <= INT8_MAX)
+      prof->rssi = value;
+    else if (strcmp(key, "sessions") == 0 && value >= 0)
+      prof->sessions = value;
+    else
+      err = -EINVAL;
+  }
+  fclose(fp);
+
+  if (err != 0)
+  {
+    printf("link_profile: invalid profile %s removed\n", path);
+    memset(prof, 0, sizeof(*prof));
+    prof->rssi = 127;
+    unlink(path);
+  }
+  return err;
+}
+
+/** link_profile_store() --  save the profile of a SLATE
+ * Input : addr -- address of the SLATE
+ *         prof -- profile to save
+ * Return : 0 on success, negative errno otherwise
+ **/
+int link_profile_store(const bdaddr_t *addr, const struct link_profile *prof)
+{
+  char path[PATH_MAX], tmp_path[PATH_MAX + 4];
+  int err;
+  FILE *fp;
+
+  err = profile_path(addr, path, sizeof(path));
+  if (err != 0)
+    return err;
+
+  /* written in a temporary file, so that a partial file is never loaded */
+  snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+  fp = fopen(tmp_path, "w");
+  if (fp == NULL)
+    return -errno;
+
+  fprintf(fp, "interval %u\nmaxlen %u\nwindow %u\n", prof->conn_interval, prof->kermit_maxlen, prof->kermit_window);
+  fprintf(fp, "best %u\nrecent %u\nrssi %d\nsessions %u\n", prof->best_goodput, prof->recent_goodput, prof->rssi,
+          prof->sessions);
+
+  if (fclose(fp) != 0)
+    err = -errno;
+  if (err == 0 && rename(tmp_path, path) != 0)
+    err = -errno;
+  if (err != 0)
+    unlink(tmp_path);
+  return err;
+}
+
+/** link_profile_remove() --  remove the profile of a SLATE
+ * Input : addr -- address of the SLATE
+ **/
+void link_profile_remove(const bdaddr_t *addr)
+{
+  char path[PATH_MAX];
+
+  if (profile_path(addr, path, sizeof(path)) == 0)
+    unlink(path);
+}
+
+/** link_profile_update() --  learn a file transfer session
+ * Input : prof -- profile of the SLATE
+ *         conn_interval -- connection interval of the session
+ *         kermit_maxlen, kermit_window -- Kermit settings that gave the best goodput
+ *         goodput -- goodput of the session, bytes/s
+ *         rssi -- RSSI of the SLATE, 127 if unknown
+ * Explanation : The settings are only replaced by a session at least as fast as the
+ * best one, so that a bad session (interference, SLATE far away) does not lose them.
+ **/
+void link_profile_update(struct link_profile *prof, uint16_t conn_interval, uint16_t kermit_maxlen, uint8_t kermit_window,
+                         uint32_t goodput, int8_t rssi)
+{
+  prof->recent_goodput = goodput;
+  prof->rssi = rssi;
+  prof->sessions++;
+
+  if (goodput >= prof->best_goodput)
+  {
+    prof->best_goodput = goodput;
+    prof->conn_interval = conn_interval;
+    prof->kermit_maxlen = kermit_maxlen;
+    prof->kermit_window = kermit_window;
+  }
+}
+
+/** link_profile_init() --  set the directory of the profiles
+ * Input : dir -- directory, created if it does not exist
+ * Return : 0 on success, negative errno otherwise (the profiles are disabled)
+ **/
+int link_profile_init(const char *dir)
+{
+  struct stat st;
+
+  m_dir[0] = '\0';
+  if (dir == NULL || strlen(dir) >= sizeof(m_dir))
+    return -EINVAL;
+
+  if (mkdir(dir, 0755) != 0 && errno != EEXIST)
+    return -errno;
+  if (stat(dir, &st) != 0 || !S_ISDIR(st.st_mode))
+    return -ENOTDIR;
+
+  strcpy(m_dir, dir);
+  return 0;
+}
@@ -22,12 +22,14 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <sys/socket.h>
 #include <sys/signalfd.h>
 #include <stdbool.h>
 #include <pthread.h>
 #include <sys/time.h>
-#include <regex.h>
+#include <getopt.h>
 
 #include <bluetooth/bluetooth.h>
 #include <bluetooth/hci.h>
@@ -45,12 +47,46 @@
 #include "libe-kermit.h"
 #include "fifo.h"
 #include "file_transfer_task.h"
+#include "src/shared/hci.h"
+#include "allowlist.h"
+#include "presence.h"
+#include "autoconnect.h"
+#include "gatt_cache.h"
+#include "gatt_targeted.h"
+#include "link_profile.h"
 #include "define.h"
 
 #ifndef MIN
 #define MIN(a, b) ((a) < (b) ? (a) : (b))
 #endif
 
+#ifndef MAX
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+#endif
+
+/* Time given to the controller to create the connection */
+#define LE_CONNECTION_TIMEOUT_MS 25000
+#define HCI_CONN_HANDLE_INVALID 0xffff
+/* LE Connection Complete statuses caused by the connection parameters, the others (cancel of the
+ * timeout, SLATE gone...) say nothing about them */
+#define HCI_STATUS_UNACCEPTABLE_CONN_PARAMS 0x3b
+#define HCI_STATUS_CONN_FAILED_ESTABLISHMENT 0x3e
+
+/* Sessions initialized once: a released session is used again once its file transfer is done */
+#define SESSION_POOL_SIZE 2
+
+/* EATT bearers opened with the ATT bearer, for the requests */
+#define EATT_MAX_BEARERS 4
+
+/* LE credit based channel of the Kermit packets: a long packet (P_PKTLEN of kermit.h) fits in one SDU */
+#define COC_SDU_LEN 1024
+#define COC_SEND_RETRIES 1000 //1 ms apart, while the SLATE gives no credit
+
+/* Transfer needed to learn the link profile of a SLATE, shorter ones do not measure the goodput */
+#define LINK_PROFILE_MIN_BYTES 4096
+/* Resends, in percent of the data packets, after which a failed transfer removes the link profile */
+#define LINK_PROFILE_MAX_RESENDS 10
+
 typedef enum
 {
   BLE_SCANNING,
@@ -60,7 +96,8 @@ typedef enum
   BLE_SPS_DISCOVERING,
   BLE_ALL_SERVICE_DISCOVERY_COMPLETE,
   BLE_WAIT_MLDP_DATA,
-  BLE_FILE_TRANSFER
+  BLE_FILE_TRANSFER,
+  BLE_DISCONNECTING
 } ble_connection_step;
 
 ble_connection_step ble_con_step = -1;
@@ -83,6 +120,10 @@ struct client
   uint16_t central_identification_char_handle;
   uint16_t peripheral_authentication_char_handle;
   uint16_t misc_char_handle;
+
+  // database loaded from the cache, and its Database Hash
+  bool cache_loaded;
+  uint8_t cache_hash[GATT_CACHE_HASH_LEN];
 };
 
 struct server
@@ -107,70 +148,105 @@ struct gatt_central
 {
   // socket file descriptor
   int fd;
+  // LE credit based channel carrying the Kermit packets instead of MLDP, -1 if not opened
+  int coc_fd;
+  // EATT or CoC socket whose connect() is in progress, -1 if none
+  int connect_fd;
+  // EATT bearers attached to att
+  int eatt_bearers;
+  // bytes of one MLDP write, ATT MTU - 3 of the transfer
+  uint16_t mldp_write_len;
+  // handshake writes not answered yet, 0 once they are or one of them failed
+  unsigned int sps_writes;
 
   // pointer to a bt_att structure
   struct bt_att *att;
 
   // pointer to a gatt_db structure
-  struct gatt_db *db_c; //client
-  struct gatt_db *db_s; //server
+  struct gatt_db *db_c; //client, the server one is m_server_db
 
   struct client cli;
   struct server srv;
 
-  //identifier to the ft thread
+  // file transfer of the session, busy until the ft thread has reported its end
   ft_t ft_s;
+  bool ft_started;
+  // bytes of the transfer, and the queue entries allocated before it started
+  uint32_t ft_rx_bytes;
+  uint32_t ft_tx_bytes;
+  unsigned int ft_queue_allocs;
+  unsigned int ft_queue_reuses;
+  unsigned int ft_op_allocs;
+  unsigned int ft_op_reuses;
+  unsigned int ft_syscalls;
+  unsigned int ft_pdus;
+  // MLDP data received from the SLATE, by ATT opcode
+  unsigned int ft_rx_write_reqs;
+  unsigned int ft_rx_write_cmds;
+  unsigned int ft_rx_notifications;
+  unsigned int ft_rx_sdus;
+  // link profile of the SLATE, learned when the transfer is done
+  bdaddr_t ft_addr;
+  struct link_profile ft_profile;
+  uint16_t ft_interval;
+
+  // session of the pool used by a connection
+  bool in_use;
+  // taken by the ft thread to write on att, and by the mainloop to release it
+  pthread_mutex_t att_lock;
 
   fifo mldp_fifo_rx;
   fifo mldp_fifo_tx;
 };
 
 static struct gatt_central *m_gatt_central = NULL;
-static void retry_scan(struct gatt_central *central);
-static void sig_handler(int signum);
+static struct gatt_central m_sessions[SESSION_POOL_SIZE];
+static struct gatt_db *m_server_db = NULL; //MLDP service, shared by all the sessions
+static struct server m_server;             //handles of the MLDP service in m_server_db
 static int end_of_state_machine = 0;
+static bdaddr_t m_slate_addr; //address of the SLATE found by the scan
+static uint8_t m_slate_addr_type = BDADDR_LE_PUBLIC; //type of m_slate_addr given by the connection, BDADDR_LE_*
+static bdaddr_t m_src_addr;   //address of the adapter, source of the L2CAP sockets
+
+static struct bt_hci *m_hci = NULL; //HCI socket of the adapter, commands are sent asynchronously
+static int m_dev_id = -1;
+static bool m_auto_connect = false;
+static int m_eatt_bearers = 0; //EATT bearers opened for the requests, the MLDP data stays on the ATT bearer
+static uint16_t m_coc_psm = 0;  //PSM of the LE credit based channel of the Kermit packets, 0 for MLDP only
+static bool m_batch = false;    //keep the Kermit session after a GET, until the SLATE ends it
+static int m_conn_timeout_id = -1;
+static uint16_t m_conn_handle = HCI_CONN_HANDLE_INVALID; //HCI handle of the SLATE connection
+static bdaddr_t m_conn_complete_addr;                   //last LE Connection Complete event received
+static uint16_t m_conn_complete_handle = HCI_CONN_HANDLE_INVALID;
+static uint16_t m_conn_complete_interval = 0x0006; //connection interval of the last connection, 1.25 ms units
+static struct link_profile m_link_profile;         //learned on m_slate_addr, sessions is 0 if there is none
+
+static bool m_uuid_discovery = false; //discover the SLATE and MLDP services only, without bt_gatt_client
+
+/* UUIDs parsed once by uuids_init(), the services to discover first */
+enum
+{
+  UUID_SLATE_SERVICE,
+  UUID_MLDP_SERVICE,
+  UUID_CENTRAL_IDENTIFICATION_CHAR,
+  UUID_PERIPHERAL_AUTHENTICATION_CHAR,
+  UUID_MISC_CHAR,
+  UUID_MLDP_DATA_CHAR,
+  UUID_MLDP_CTRL_CHAR,
+  UUID_COUNT
+};
+static bt_uuid_t m_uuids[UUID_COUNT];
+
+static void scan_restart(void);
+static void att_connect(void);
+static void eatt_connect(struct gatt_central *central);
+static void coc_connect(struct gatt_central *central);
+static void state_machine_stop(void);
 
 /*-----------------------------------------------------------------------------
  * scan & connect functions
  *-----------------------------------------------------------------------------*/
 
-static void eir_parse_name(uint8_t *eir, size_t eir_len, char *buf, size_t buf_len)
-{
-  size_t offset;
-
-  offset = 0;
-  while (offset < eir_len)
-  {
-    uint8_t field_len = eir[0];
-    size_t name_len;
-
-    /* Check for the end of EIR */
-    if (field_len == 0)
-      break;
-
-    if (offset + field_len > eir_len)
-      goto failed;
-
-    switch (eir[1])
-    {
-    case EIR_NAME_SHORT:
-    case EIR_NAME_COMPLETE:
-      name_len = field_len - 1;
-      if (name_len > buf_len)
-        goto failed;
-
-      memcpy(buf, &eir[2], name_len);
-      return;
-    }
-
-    offset += field_len + 1;
-    eir += field_len + 1;
-  }
-
-failed:
-  snprintf(buf, buf_len, "(unknown)");
-}
-
 static int read_flags(uint8_t *flags, const uint8_t *data, size_t size)
 {
   size_t offset;
@@ -236,302 +312,545 @@ static int check_report_filter(uint8_t procedure, le_advertising_info *info)
 
 /** slate_research() --  parse the scan result
  * Input : addr -- address of the device to test
- * output : out_research_success-- true if SLATE is discovered, otherwise false
+ * output : out_research_success-- true if the device is in the allowlist, otherwise false
  **/
-static int slate_research(char *addr, bool *out_research_success, char *slate_addr)
+static int slate_research(const bdaddr_t *addr, bool *out_research_success)
 {
   *out_research_success = false;
   if (addr == NULL)
   {
     return ERR_ERR;
   }
-  if (strcmp((char *)addr, slate_addr) == 0)
+  if (allowlist_contains(addr))
   {
     *out_research_success = true;
-    return ERR_SUCCESS;
   }
+  return ERR_SUCCESS;
 }
 
-/** scan_result() --  collect the name and address of the scanned devices
- * Input : dd -- identifier to the local adapter (hci0)
- *         filter_type -- defined if the scan collect only devices in the withelist
- *         slate_addr -- pointer to the SLATE MAC address on wich we want to connect
- * output : out_success -- true if SLATE is discovered, otherwise false. This is the result of slate_research.
+/** hci_cmd_status() --  status of an HCI command
+ * Input : data, size -- return parameters of the Command Complete or status of the Command Status
+ * Return : the HCI status, 0x00 on success
  **/
-static int scan_result(int dd, uint8_t filter_type, bool *out_success, char *slate_addr)
+static uint8_t hci_cmd_status(const void *data, uint8_t size)
+{
+  if (size < 1)
+    return 0xff;
+  return ((const uint8_t *)data)[0];
+}
+
+static void scan_params_cb(const void *data, uint8_t size, void *user_data)
 {
-  unsigned char buf[HCI_MAX_EVENT_SIZE], *ptr;
-  struct hci_filter nf, of;
-  struct sigaction sa;
-  socklen_t olen;
-  int len;
+  uint8_t status = hci_cmd_status(data, size);
 
-  olen = sizeof(of);
-  if (getsockopt(dd, SOL_HCI, HCI_FILTER, &of, &olen) < 0)
+  if (status != 0)
   {
-    PRLOG_ERROR("Could not get socket options");
-    return EXIT_FAILURE;
+    PRLOG_ERROR("Set scan parameters failed (0x%02x)\n", status);
+    mainloop_exit_failure();
   }
+}
 
-  hci_filter_clear(&nf);
-  hci_filter_set_ptype(HCI_EVENT_PKT, &nf);
-  hci_filter_set_event(EVT_LE_META_EVENT, &nf);
+static void scan_enable_cb(const void *data, uint8_t size, void *user_data)
+{
+  uint8_t status = hci_cmd_status(data, size);
 
-  if (setsockopt(dd, SOL_HCI, HCI_FILTER, &nf, sizeof(nf)) < 0)
+  if (status != 0)
   {
-    PRLOG_ERROR("Could not set socket options");
-    return EXIT_FAILURE;
+    PRLOG_ERROR("Enable scan failed (0x%02x)\n", status);
+    mainloop_exit_failure();
   }
+}
 
-  memset(&sa, 0, sizeof(sa));
-  sa.sa_flags = SA_NOCLDSTOP;
-  sa.sa_handler = sig_handler;
-  sigaction(SIGINT, &sa, NULL); //listen if crt-c is pressed.
-
-  while (1)
-  {
-    evt_le_meta_event *meta;
-    le_advertising_info *info;
-    char addr[18];
+/** scan_disable() --  stop the BLE scan
+ * Input : callback -- called when the command is completed, can be NULL.
+ *                     The command fails if the scan is not enabled, which is not an error here.
+ **/
+static void scan_disable(bt_hci_callback_func_t callback)
+{
+  le_set_scan_enable_cp enable_cp;
 
-    while ((len = read(dd, buf, sizeof(buf))) < 0)
-    {
-      if (errno == EINTR && signal_received == SIGINT)
-      {
-        len = 0;
-        goto done;
-      }
+  memset(&enable_cp, 0, sizeof(enable_cp));
+  enable_cp.enable = 0x00;
+  enable_cp.filter_dup = 0x00;
+  bt_hci_send(m_hci, cmd_opcode_pack(OGF_LE_CTL, OCF_LE_SET_SCAN_ENABLE),
+              &enable_cp, sizeof(enable_cp), callback, NULL, NULL);
+}
 
-      if (errno == EAGAIN || errno == EINTR)
-        continue;
-      goto done;
-    }
+/** cmd_lescan() --  start a BLE scan
+ * Explanation : The commands are queued on the HCI socket and sent as soon as the controller
+ * has command credits. Advertising reports are received in le_meta_event_cb().
+ **/
+static void cmd_lescan(void)
+{
+  le_set_scan_parameters_cp param_cp;
+  le_set_scan_enable_cp enable_cp;
+
+  memset(&param_cp, 0, sizeof(param_cp));
+  param_cp.type = 0x01; /* active scan */
+  param_cp.interval = htobs(0x0010);
+  param_cp.window = htobs(0x0010);
+  param_cp.own_bdaddr_type = LE_PUBLIC_ADDRESS;
+  param_cp.filter = 0x00;
+
+  memset(&enable_cp, 0, sizeof(enable_cp));
+  enable_cp.enable = 0x01;
+  enable_cp.filter_dup = 0x01;
+
+  /* the parameters can not be changed while a scan is enabled */
+  scan_disable(NULL);
+  bt_hci_send(m_hci, cmd_opcode_pack(OGF_LE_CTL, OCF_LE_SET_SCAN_PARAMETERS),
+              &param_cp, sizeof(param_cp), scan_params_cb, NULL, NULL);
+  bt_hci_send(m_hci, cmd_opcode_pack(OGF_LE_CTL, OCF_LE_SET_SCAN_ENABLE),
+              &enable_cp, sizeof(enable_cp), scan_enable_cb, NULL, NULL);
 
-    ptr = buf + (1 + HCI_EVENT_HDR_SIZE);
-    len -= (1 + HCI_EVENT_HDR_SIZE);
+  PRLOG("LE Scan ...\n");
+}
 
-    meta = (void *)ptr;
+static void create_conn_timeout_cb(int id, void *user_data)
+{
+  mainloop_remove_timeout(id);
+  m_conn_timeout_id = -1;
 
-    if (meta->subevent != 0x02)
-      goto done;
+  PRLOG_ERROR("Connection timeout\n");
+  /* the controller answers with a LE Connection Complete event in error */
+  bt_hci_send(m_hci, cmd_opcode_pack(OGF_LE_CTL, OCF_LE_CREATE_CONN_CANCEL),
+              NULL, 0, NULL, NULL, NULL);
+}
 
-    /* Ignoring multiple reports */
-    info = (le_advertising_info *)(meta->data + 1);
-    if (check_report_filter(filter_type, info))
-    {
-      char name[30];
+static void create_conn_cb(const void *data, uint8_t size, void *user_data)
+{
+  uint8_t status = hci_cmd_status(data, size);
 
-      memset(name, 0, sizeof(name));
+  if (status == 0)
+    return;
 
-      ba2str(&info->bdaddr, addr);
-      eir_parse_name(info->data, info->length,
-                     name, sizeof(name) - 1);
-      bool research_slate_success = false;
-      slate_research(addr, &research_slate_success, slate_addr);
-      if (research_slate_success)
-      {
-        *out_success = true;
-        return EXIT_SUCCESS;
-      }
-    }
+  PRLOG_ERROR("Could not create connection (0x%02x)\n", status);
+  if (m_conn_timeout_id >= 0)
+  {
+    mainloop_remove_timeout(m_conn_timeout_id);
+    m_conn_timeout_id = -1;
   }
+  if (ble_con_step == BLE_SLATE_FOUND)
+    scan_restart();
+}
 
-done:
-  setsockopt(dd, SOL_HCI, HCI_FILTER, &of, sizeof(of));
+/** link_profile_select() --  load the link profile of the SLATE to connect
+ * Input : slate_addr -- address of the SLATE
+ **/
+static void link_profile_select(const bdaddr_t *slate_addr)
+{
+  char addr[18];
 
-  if (len < 0)
-    return EXIT_FAILURE;
+  if (link_profile_load(slate_addr, &m_link_profile) != 0 || m_link_profile.sessions == 0)
+    return;
 
-  return EXIT_SUCCESS;
+  ba2str(slate_addr, addr);
+  PRLOG("Link profile of %s: interval 0x%04x, packets of %u bytes, window %u, %u bytes/s\n", addr,
+        m_link_profile.conn_interval, m_link_profile.kermit_maxlen, m_link_profile.kermit_window,
+        m_link_profile.best_goodput);
 }
 
-/** cmd_lescan() --  start a BLE scan
- * Input : dev_id -- identifier to the local adapter (hci0)
- *         slate_addr -- pointer to the SLATE MAC address on wich we want to connect
- * Return : True if SLATE was found, else false
- **/
-static void cmd_lescan(int dev_id, char *slate_addr)
-{
-  bool out_success = false;
-  int err, dd;
-  uint8_t own_type = LE_PUBLIC_ADDRESS;
-  uint8_t scan_type = 0x01;
-  uint8_t filter_type = 0;
-  uint8_t filter_policy = 0x00;
-  uint16_t interval = htobs(0x0010);
-  uint16_t window = htobs(0x0010);
-  uint8_t filter_dup = 0x01;
+/** le_connection() --  start a BLE connection
+ * Input : slate_addr -- pointer to the SLATE MAC address on wich we want to connect
+ * Explanation : The result is received in le_conn_complete(). The connection interval
+ * learned on the SLATE is asked instead of the shortest one.
+ **/
+static void le_connection(const bdaddr_t *slate_addr)
+{
+  uint16_t interval = 0x0006;
+  le_create_connection_cp cp;
+
+  link_profile_select(slate_addr);
+  if (m_link_profile.conn_interval != 0)
+    interval = m_link_profile.conn_interval;
+
+  memset(&cp, 0, sizeof(cp));
+  cp.interval = htobs(0x0006);
+  cp.window = htobs(0x0006);
+  cp.initiator_filter = 0; /* Use peer address */
+  cp.peer_bdaddr_type = LE_PUBLIC_ADDRESS;
+  bacpy(&cp.peer_bdaddr, slate_addr);
+  cp.own_bdaddr_type = LE_PUBLIC_ADDRESS;
+  cp.min_interval = htobs(interval);
+  cp.max_interval = htobs(interval);
+  cp.latency = htobs(0x0000);
+  cp.supervision_timeout = htobs(0x0C80);
+  cp.min_ce_length = htobs(0x0001);
+  cp.max_ce_length = htobs(0xffff);
+
+  ble_con_step = BLE_SLATE_FOUND;
+  bt_hci_send(m_hci, cmd_opcode_pack(OGF_LE_CTL, OCF_LE_CREATE_CONN),
+              &cp, sizeof(cp), create_conn_cb, NULL, NULL);
+  m_conn_timeout_id = mainloop_add_timeout(LE_CONNECTION_TIMEOUT_MS, create_conn_timeout_cb, NULL, NULL);
+}
 
-  if (dev_id < 0)
-    dev_id = hci_get_route(NULL);
+/** le_deconnection() --  Stop a BLE connection
+ * Explanation : If the HCI handle of the connection is unknown (connection created by the kernel
+ * before the LE Connection Complete event was received), the ATT socket is shut down instead.
+ **/
+static void le_deconnection(void)
+{
+  disconnect_cp cp;
+  uint16_t handle = m_conn_handle;
 
-  dd = hci_open_dev(dev_id);
-  if (dd < 0)
+  if (handle == HCI_CONN_HANDLE_INVALID && bacmp(&m_conn_complete_addr, &m_slate_addr) == 0)
+    handle = m_conn_complete_handle;
+
+  if (handle != HCI_CONN_HANDLE_INVALID)
   {
-    perror("Could not open device");
-    exit(1);
+    cp.handle = htobs(handle);
+    cp.reason = HCI_OE_USER_ENDED_CONNECTION;
+    bt_hci_send(m_hci, cmd_opcode_pack(OGF_LINK_CTL, OCF_DISCONNECT),
+                &cp, sizeof(cp), NULL, NULL, NULL);
   }
-
-  err = hci_le_set_scan_parameters(dd, scan_type, interval, window,
-                                   own_type, filter_policy, 10000);
-  if (err < 0)
+  else if (m_gatt_central)
   {
-    perror("Set scan parameters failed");
-    exit(1);
+    shutdown(m_gatt_central->fd, SHUT_RDWR);
   }
+}
+
+/** le_adv_report() --  look for a SLATE of the allowlist in advertising reports
+ * Input : data, size -- parameters of the LE Advertising Report event, without the subevent
+ **/
+static void le_adv_report(const uint8_t *data, uint8_t size)
+{
+  const uint8_t *ptr = data + 1, *end = data + size;
+  uint8_t num_reports;
 
-  err = hci_le_set_scan_enable(dd, 0x01, filter_dup, 10000);
-  if (err < 0)
+  if (ble_con_step != BLE_SCANNING || m_auto_connect || presence_is_running() || size < 1)
+    return;
+
+  num_reports = data[0];
+  while (num_reports-- > 0 && ptr + LE_ADVERTISING_INFO_SIZE < end)
   {
-    perror("Enable scan failed");
-    exit(1);
+    le_advertising_info *info = (le_advertising_info *)ptr;
+    bool research_slate_success = false;
+
+    /* data is followed by one byte of RSSI */
+    if (ptr + LE_ADVERTISING_INFO_SIZE + info->length + 1 > end)
+      break;
+    ptr += LE_ADVERTISING_INFO_SIZE + info->length + 1;
+
+    if (!check_report_filter(0, info))
+      continue;
+
+    slate_research(&info->bdaddr, &research_slate_success);
+    if (research_slate_success)
+    {
+      char addr[18];
+
+      bacpy(&m_slate_addr, &info->bdaddr);
+      ba2str(&m_slate_addr, addr);
+      PRLOG("SLATE found: %s\n", addr);
+      scan_disable(NULL);
+      le_connection(&m_slate_addr);
+      return;
+    }
   }
+}
 
-  PRLOG("LE Scan ...\n");
+/** le_conn_complete() --  result of le_connection()
+ * Input : data, size -- parameters of the LE Connection Complete event, without the subevent
+ **/
+static void le_conn_complete(const uint8_t *data, uint8_t size)
+{
+  const evt_le_connection_complete *evt = (const void *)data;
 
-  err = scan_result(dd, filter_type, &out_success, slate_addr);
+  if (size < sizeof(*evt))
+    return;
 
-  if (err < 0)
+  if (evt->status == 0)
   {
-    perror("Could not receive advertising events");
-    exit(1);
+    bacpy(&m_conn_complete_addr, &evt->peer_bdaddr);
+    m_conn_complete_handle = btohs(evt->handle);
+    m_conn_complete_interval = btohs(evt->interval);
   }
-  err = hci_le_set_scan_enable(dd, 0x00, filter_dup, 10000);
-  if (err < 0)
+
+  if (ble_con_step != BLE_SLATE_FOUND)
+    return;
+
+  if (m_conn_timeout_id >= 0)
   {
-    perror("Disable scan failed");
-    exit(1);
+    mainloop_remove_timeout(m_conn_timeout_id);
+    m_conn_timeout_id = -1;
   }
-  if (out_success)
+
+  if (evt->status != 0)
   {
-    hci_close_dev(dd);
-    ble_con_step = BLE_SLATE_FOUND;
+    PRLOG_ERROR("Could not create connection (0x%02x)\n", evt->status);
+    if (m_link_profile.conn_interval != 0 && (evt->status == HCI_STATUS_UNACCEPTABLE_CONN_PARAMS ||
+                                              evt->status == HCI_STATUS_CONN_FAILED_ESTABLISHMENT))
+    {
+      /* the next connection is made with the default parameters */
+      link_profile_remove(&m_slate_addr);
+      memset(&m_link_profile, 0, sizeof(m_link_profile));
+    }
+    scan_restart();
+    return;
   }
+
+  m_conn_handle = btohs(evt->handle);
+  m_slate_addr_type = evt->peer_bdaddr_type == LE_PUBLIC_ADDRESS ? BDADDR_LE_PUBLIC : BDADDR_LE_RANDOM;
+  ble_con_step = BLE_CONNECTED;
+  att_connect();
 }
 
-/** le_connection() --  start a BLE connection
- * Input : dev_id -- identifier to the local adapter (hci0)
- *         slate_addr -- pointer to the SLATE MAC address on wich we want to connect
+/** le_conn_update_complete() --  the connection parameters have been changed
+ * Input : data, size -- parameters of the LE Connection Update Complete event, without the subevent
  **/
-static void le_connection(int dev_id, char *slate_addr)
+static void le_conn_update_complete(const uint8_t *data, uint8_t size)
 {
-  char *argv;
-  argv = slate_addr;
-  int err, dd;
-  bdaddr_t bdaddr;
-  uint16_t interval, latency, max_ce_length, max_interval, min_ce_length;
-  uint16_t min_interval, supervision_timeout, window, handle;
-  uint8_t initiator_filter, own_bdaddr_type, peer_bdaddr_type;
+  const evt_le_connection_update_complete *evt = (const void *)data;
 
-  own_bdaddr_type = LE_PUBLIC_ADDRESS;
-  peer_bdaddr_type = LE_PUBLIC_ADDRESS;
-  initiator_filter = 0; /* Use peer address */
+  if (size < sizeof(*evt) || evt->status != 0)
+    return;
 
-  if (dev_id < 0)
-    dev_id = hci_get_route(NULL);
+  if (btohs(evt->handle) == m_conn_complete_handle)
+    m_conn_complete_interval = btohs(evt->interval);
+}
+
+/** le_meta_event_cb() --  LE Meta events received on the HCI socket
+ **/
+static void le_meta_event_cb(const void *data, uint8_t size, void *user_data)
+{
+  const evt_le_meta_event *meta = data;
+
+  if (size < 1)
+    return;
 
-  dd = hci_open_dev(dev_id);
-  if (dd < 0)
+  switch (meta->subevent)
   {
-    perror("Could not open device");
-    exit(1);
+  case EVT_LE_ADVERTISING_REPORT:
+    le_adv_report(meta->data, size - 1);
+    break;
+  case EVT_LE_CONN_COMPLETE:
+    le_conn_complete(meta->data, size - 1);
+    break;
+  case EVT_LE_CONN_UPDATE_COMPLETE:
+    le_conn_update_complete(meta->data, size - 1);
+    break;
   }
+}
+
+static void disconn_complete_cb(const void *data, uint8_t size, void *user_data)
+{
+  const evt_disconn_complete *evt = data;
 
-  memset(&bdaddr, 0, sizeof(bdaddr_t));
-  if (argv)
-    str2ba(argv, &bdaddr);
+  if (size < sizeof(*evt) || evt->status != 0)
+    return;
+
+  if (btohs(evt->handle) == m_conn_handle)
+    m_conn_handle = HCI_CONN_HANDLE_INVALID;
+  if (btohs(evt->handle) == m_conn_complete_handle)
+    bacpy(&m_conn_complete_addr, BDADDR_ANY);
+}
+
+/*-----------------------------------------------------------------------------
+ * Display client and server services, read characteristics data
+ *-----------------------------------------------------------------------------*/
 
-  interval = htobs(0x0006);
-  window = htobs(0x0006);
-  min_interval = htobs(0x0006);
-  max_interval = htobs(0x0006);
-  latency = htobs(0x0000);
-  supervision_timeout = htobs(0x0C80);
-  min_ce_length = htobs(0x0001);
-  max_ce_length = htobs(0xffff);
+/** session_acquire() --  Take a free session of the pool
+ * Return : pointer to the central structure, NULL if all the sessions are used
+ **/
+static struct gatt_central *session_acquire(void)
+{
+  struct gatt_central *central;
+  int i;
 
-  err = hci_le_create_conn(dd, interval, window, initiator_filter,
-                           peer_bdaddr_type, bdaddr, own_bdaddr_type, min_interval,
-                           max_interval, latency, supervision_timeout,
-                           min_ce_length, max_ce_length, &handle, 25000);
-  if (err < 0)
+  for (i = 0; i < SESSION_POOL_SIZE; i++)
   {
-    perror("Could not create connection");
-    exit(1);
+    central = &m_sessions[i];
+    if (central->in_use || central->ft_started)
+      continue;
+
+    central->fd = -1;
+    central->coc_fd = -1;
+    central->connect_fd = -1;
+    central->eatt_bearers = 0;
+    central->mldp_write_len = BLE_MLDP_MAX_DATA_LEN;
+    central->sps_writes = 0;
+    central->att = NULL;
+    central->db_c = NULL;
+    memset(&central->cli, 0, sizeof(central->cli));
+    central->srv.gatt = NULL;
+    fifo_flush(&central->mldp_fifo_rx);
+    fifo_flush(&central->mldp_fifo_tx);
+    central->in_use = true;
+    return central;
   }
-  ble_con_step = BLE_CONNECTED;
+  return NULL;
+}
+
+/** sessions_busy() --  Look for a file transfer not done yet
+ * Return : true if a released session still waits for the ft thread
+ **/
+static bool sessions_busy(void)
+{
+  int i;
 
-  hci_close_dev(dd);
+  for (i = 0; i < SESSION_POOL_SIZE; i++)
+  {
+    if (m_sessions[i].ft_started)
+      return true;
+  }
+  return false;
 }
 
-/** le_deconnection() --  Stop a BLE connection
- * Input : dev_id -- identifier to the local adapter (hci0)
+/** gatt_central_destroy() --  Close the ATT socket and give the central structure back to the pool
+ * Explanation : Does not wait for the file transfer: once att is released, the Kermit callbacks of
+ * the ft thread fail and its transfer ends by itself.
  **/
-static void le_deconnection(int dev_id)
+static void gatt_central_destroy(struct gatt_central *central)
 {
-  int err = 0, dd = 0, argc = 0;
-  uint16_t handle;
-  uint8_t reason;
-  char **argv = NULL;
+  if (central->cli.gatt)
+    bt_gatt_client_unref(central->cli.gatt);
+  else
+  {
+    gatt_targeted_cancel();
+    gatt_db_unref(central->db_c);
+  }
+  bt_gatt_server_unref(central->srv.gatt);
 
-  if (dev_id < 0)
-    dev_id = hci_get_route(NULL);
+  if (central->connect_fd >= 0)
+  {
+    mainloop_remove_fd(central->connect_fd);
+    close(central->connect_fd);
+    central->connect_fd = -1;
+  }
 
-  dd = hci_open_dev(dev_id);
-  if (dd < 0)
+  pthread_mutex_lock(&central->att_lock);
+  bt_att_unref(central->att);
+  central->att = NULL;
+  central->cli.gatt = NULL;
+  if (central->coc_fd >= 0)
   {
-    perror("Could not open device");
-    exit(1);
+    mainloop_remove_fd(central->coc_fd);
+    close(central->coc_fd);
+    central->coc_fd = -1;
   }
+  pthread_mutex_unlock(&central->att_lock);
+
+  central->srv.gatt = NULL;
+  central->db_c = NULL;
+  central->in_use = false;
+}
+
+/** session_release_cb() --  Release the session once the ATT callbacks have returned
+ **/
+static void session_release_cb(int id, void *user_data)
+{
+  struct gatt_central *central = m_gatt_central;
 
-  handle = atoi(argv[0]);
+  mainloop_remove_timeout(id);
+  if (central == NULL)
+    return;
 
-  reason = (argc > 1) ? atoi(argv[1]) : HCI_OE_USER_ENDED_CONNECTION;
+  m_gatt_central = NULL;
+  gatt_central_destroy(central);
+  scan_restart();
+}
 
-  err = hci_disconnect(dd, handle, reason, 10000);
-  if (err < 0)
+/** log_transfer_allocs() --  Print the queue entries and ATT operations allocated during the transfer of a session,
+ * and the system calls of the ATT socket
+ **/
+static void log_transfer_allocs(struct gatt_central *central)
+{
+  unsigned int allocs, reuses, syscalls, pdus;
+  uint32_t kbytes = (central->ft_rx_bytes + central->ft_tx_bytes + 1023) / 1024;
+
+  queue_get_entry_stats(&allocs, &reuses);
+  allocs -= central->ft_queue_allocs;
+  reuses -= central->ft_queue_reuses;
+  PRLOG("queue: %u entries allocated, %u reused for %u KB (%.2f allocations per KB)\n",
+        allocs, reuses, kbytes, kbytes ? (double)allocs / kbytes : 0.0);
+
+  bt_att_get_op_stats(&allocs, &reuses);
+  allocs -= central->ft_op_allocs;
+  reuses -= central->ft_op_reuses;
+  PRLOG("att: %u operations allocated, %u reused for %u KB (%.2f allocations per KB)\n",
+        allocs, reuses, kbytes, kbytes ? (double)allocs / kbytes : 0.0);
+
+  bt_att_get_io_stats(&syscalls, &pdus);
+  syscalls -= central->ft_syscalls;
+  pdus -= central->ft_pdus;
+  PRLOG("att: %u system calls for %u PDUs (%.2f system calls per KB)\n",
+        syscalls, pdus, kbytes ? (double)syscalls / kbytes : 0.0);
+
+  PRLOG("mldp: received %u Write Requests, %u Write Commands, %u Notifications\n",
+        central->ft_rx_write_reqs, central->ft_rx_write_cmds, central->ft_rx_notifications);
+  if (central->ft_rx_sdus)
   {
-    perror("Could not disconnect");
-    exit(1);
+    PRLOG("coc: received %u SDUs\n", central->ft_rx_sdus);
   }
-
-  hci_close_dev(dd);
 }
 
-/** sig_handler -- signal handler
- * Input: signum -- number of the signal received
+/** link_profile_learn() --  update the link profile of the SLATE from its transfer
+ * Input : central -- session whose transfer is done
+ * Explanation : The goodput is the one of the data phase of the transaction whose packet length
+ * and window are learned, see ft_session(). A transfer that failed on a timeout or with too many
+ * resends removes the learned profile, so that the next connection is made with the default
+ * settings; the other errors (disconnection, refused file...) say nothing about them.
  **/
-static void sig_handler(int signum)
+static void link_profile_learn(struct gatt_central *central)
 {
-  int dev_id = hci_get_route(NULL);
-  if (signum == SIGINT)
+  const ft_t *p_ft_s = &central->ft_s;
+  const ft_stats_t *stats = &p_ft_s->stats;
+  presence_info_t info;
+  int8_t rssi = 127;
+
+  if (p_ft_s->err != 0)
   {
-    if (ble_con_step == BLE_SCANNING)
-    {
-      signal_received = signum;
-      end_of_state_machine = 1;
-    }
-    else
+    if (central->ft_profile.sessions != 0 &&
+        (p_ft_s->err == FT_ETIME || stats->nresend * 100 > LINK_PROFILE_MAX_RESENDS * (stats->dpkts + 1)))
     {
-      le_deconnection(dev_id);
-      end_of_state_machine = 1;
+      PRLOG("Link profile removed after a failed transfer\n");
+      link_profile_remove(&central->ft_addr);
     }
+    return;
   }
+
+  /* too short to measure the goodput */
+  if (stats->dbytes < LINK_PROFILE_MIN_BYTES || stats->dms <= 0 || stats->maxlen == 0)
+    return;
+
+  if (presence_is_running() && presence_get(&central->ft_addr, &info))
+    rssi = info.rssi;
+
+  link_profile_update(&central->ft_profile, central->ft_interval, stats->maxlen, stats->window,
+                      (uint32_t)(stats->dbytes * 1000ULL / stats->dms), rssi);
+  link_profile_store(&central->ft_addr, &central->ft_profile);
 }
 
-/*-----------------------------------------------------------------------------
- * Display client and server services, read characteristics data
- *-----------------------------------------------------------------------------*/
+/** ft_done_cb() --  The ft thread has ended the transfer of a session
+ * Explanation : The session can be used again by the next connection.
+ **/
+static void ft_done_cb(int fd, uint32_t events, void *user_data)
+{
+  ft_t *p_ft_s = file_transfer_get_done(fd);
+  struct gatt_central *central;
+
+  if (p_ft_s == NULL)
+    return;
+
+  central = p_ft_s->user_data;
+  central->ft_started = false;
+  log_transfer_allocs(central);
+  link_profile_learn(central);
+
+  /* the stop was waiting for the end of the transfer */
+  if (end_of_state_machine && ble_con_step == BLE_SCANNING && !sessions_busy())
+    state_machine_stop();
+}
 
 /** att_disconnect_cb() --  Callback function of bt_att_register_disconnect()
- * Explanation : Function called when the Bluetooth connection is stopped. Then it stop the mainloop.
+ * Explanation : Function called when the Bluetooth connection is stopped.
+ * The session is released from the mainloop, then the scan is restarted.
  **/
 static void att_disconnect_cb(int err, void *user_data)
 {
-  pthread_join(m_gatt_central->ft_s.ft_task_id, NULL); //wait the end of file transfer
   PRLOG("Device disconnected: %s\n", strerror(err));
-  ble_con_step = BLE_SCANNING;
-  mainloop_quit();
+  ble_con_step = BLE_DISCONNECTING;
+  mainloop_add_timeout(1, session_release_cb, NULL, NULL);
 }
 
 /** log_service_event() --  Log service information when an event occur on him (modification or supression)
@@ -677,37 +996,30 @@ static void client_store_handle(struct gatt_db_attribute *attr, void *user_data)
 {
   uint16_t handle, value_handle, ext_prop;
   uint8_t properties;
-  bt_uuid_t uuid, uuid1, uuid2, uuid3, uuid4, uuid5;
+  bt_uuid_t uuid;
   struct gatt_central *central = user_data;
   ble_con_step = BLE_SPS_DISCOVERING;
   if (!gatt_db_attribute_get_char_data(attr, &handle, &value_handle, &properties, &ext_prop, &uuid))
     return;
 
-  bt_string_to_uuid(&uuid1, CENTRAL_IDENTIFICATION_CHARACTERISTIC_UUID);
-  bt_string_to_uuid(&uuid2, PERIPHERAL_AUTHENTICATION_CHARACTERISTIC_UUID);
-  bt_string_to_uuid(&uuid3, MISC_CHARACTERISTIC_UUID);
-  bt_string_to_uuid(&uuid4, MLDP_DATA_CHARAC_UUID);
-  bt_string_to_uuid(&uuid5, MLDP_CTRL_CHARAC_UUID);
-
-  if (bt_uuid_cmp(&uuid, &uuid1) == 0)
+  if (bt_uuid_cmp(&uuid, &m_uuids[UUID_CENTRAL_IDENTIFICATION_CHAR]) == 0)
   {
     central->cli.central_identification_char_handle = value_handle;
   }
-
-  if (bt_uuid_cmp(&uuid, &uuid2) == 0)
+  else if (bt_uuid_cmp(&uuid, &m_uuids[UUID_PERIPHERAL_AUTHENTICATION_CHAR]) == 0)
   {
     central->cli.peripheral_authentication_char_handle = value_handle;
   }
-  if (bt_uuid_cmp(&uuid, &uuid3) == 0)
+  else if (bt_uuid_cmp(&uuid, &m_uuids[UUID_MISC_CHAR]) == 0)
   {
     central->cli.misc_char_handle = value_handle;
   }
-  if (bt_uuid_cmp(&uuid, &uuid4) == 0)
+  else if (bt_uuid_cmp(&uuid, &m_uuids[UUID_MLDP_DATA_CHAR]) == 0)
   {
     central->cli.mldp_data_char_handle = value_handle;
     central->cli.mldp_data_desc_handle = value_handle + 1;
   }
-  if (bt_uuid_cmp(&uuid, &uuid5) == 0)
+  else if (bt_uuid_cmp(&uuid, &m_uuids[UUID_MLDP_CTRL_CHAR]) == 0)
   {
     central->cli.mldp_ctrl_char_handle = value_handle;
   }
@@ -750,111 +1062,97 @@ static void get_handle_from_uuid(struct gatt_central *central)
  * Write value in client BLE SPS
  *-----------------------------------------------------------------------------*/
 
-/** client_write_cb_misc_char() -- Callback function of write_misc_char()
- * Input:   success -- true on success to write in misc char and false on fail
- *          att_ecode -- unused here
- *          user_data -- pointer to the central structure
- * Output:  /
- * Return:  /
- * Explanation : In case of error, process is stoped and scan restart
- **/
-static void client_write_cb_misc_char(bool success, uint8_t att_ecode, void *user_data)
-{
-  struct gatt_central *central = user_data;
-  if (!success)
-  {
-    retry_scan(central);
-    return;
-  }
-  ble_con_step = BLE_WAIT_MLDP_DATA;
-}
-
-/** client_write_cb_misc_char() -- write in misc characteristic
- * Input:   central -- pointer to the central structure
- *          handle -- handle value of the misc characteristic
- *          value -- pointer to value to write
- *          length -- length of value (in bytes)
- * Return:  EXIT_SUCCESS on  success, EXIT_FAILURE on error
+/** central_write_value() -- Write Request through bt_gatt_client, or directly on the ATT bearer
+ * when the services were discovered with gatt_targeted_discover()
+ * Return:  the request identifier, 0 on error
  **/
-static int write_misc_char(struct gatt_central *central, uint16_t handle, const uint8_t *value, uint16_t length)
+static unsigned int central_write_value(struct gatt_central *central, uint16_t handle, const uint8_t *value, uint16_t length,
+                                        bt_gatt_client_callback_t callback)
 {
-  if (bt_gatt_client_write_value(central->cli.gatt, central->cli.misc_char_handle, value, length, client_write_cb_misc_char, central, NULL) != 0)
-    return EXIT_FAILURE;
-  return EXIT_SUCCESS;
+  if (central->cli.gatt)
+    return bt_gatt_client_write_value(central->cli.gatt, handle, value, length, callback, central, NULL);
+  return gatt_targeted_write(central->att, handle, value, length, callback, central);
 }
 
-/** client_write_cb_authentication_char() -- Callback function of write_authentication_char()
- * Input:   success -- true on success to write in authentification char and false on fail
- *          att_ecode -- unused here
- *          user_data -- pointer to the central structure
- * Output:  /
- * Return:  /
- * Explanation : In case of error, process is stoped and scan restart
+/** central_write_cmd() -- Write Command, see central_write_value()
+ * Return:  the identifier of the command, 0 on error
  **/
-static void client_write_cb_authentication_char(bool success, uint8_t att_ecode, void *user_data)
+static unsigned int central_write_cmd(struct gatt_central *central, uint16_t handle, const uint8_t *value, uint16_t length)
 {
-  struct gatt_central *central = user_data;
-  if (!success)
-  {
-    retry_scan(central);
-    return;
-  }
-  write_misc_char(central, central->cli.misc_char_handle, BLE_SPS_MISC_CHAR_VALUE, BLE_SPS_MISC_CHAR_VALUE_LENGTH);
+  if (central->cli.gatt)
+    return bt_gatt_client_write_without_response(central->cli.gatt, handle, false, value, length);
+  return gatt_targeted_write_cmd(central->att, handle, value, length);
 }
 
-/** write_authentication_char() -- write in authentication characteristic
+/** sps_write_failed() -- Abort the SPS handshake
  * Input:   central -- pointer to the central structure
- *          handle -- handle value of the authentication characteristic
- *          value -- pointer to value to write
- *          length -- length of value (in bytes)
- * Return:  EXIT_SUCCESS on  success, EXIT_FAILURE on error
+ * Explanation : The writes still queued are cancelled, process is stoped and scan restart
  **/
-static int write_authentication_char(struct gatt_central *central, uint16_t handle, const uint8_t *value, uint16_t length)
+static void sps_write_failed(struct gatt_central *central)
 {
-  if (bt_gatt_client_write_value(central->cli.gatt, central->cli.peripheral_authentication_char_handle, value, length, client_write_cb_authentication_char, central, NULL) != 0)
-    return EXIT_FAILURE;
-  return EXIT_SUCCESS;
+  if (central->cli.gatt)
+    bt_gatt_client_cancel_all(central->cli.gatt);
+  else
+    bt_att_cancel_all(central->att);
+  le_deconnection();
 }
 
-/** client_write_cb_identification_char() -- Callback function of write_identification_char()
- * Input:   success -- true on success to write in identification char and false on fail
+/** client_write_cb_sps_char() -- Callback function of the handshake writes
+ * Input:   success -- true on success to write in the characteristic and false on fail
  *          att_ecode -- unused here
  *          user_data -- pointer to the central structure
  * Output:  /
  * Return:  /
- * Explanation : In case of error, process is stoped and scan restart
+ * Explanation : The handshake is done once the three writes are. On the first error, the other
+ * writes are cancelled, process is stoped and scan restart
  **/
-static void client_write_cb_identification_char(bool success, uint8_t att_ecode, void *user_data)
+static void client_write_cb_sps_char(bool success, uint8_t att_ecode, void *user_data)
 {
   struct gatt_central *central = user_data;
+
+  if (central->sps_writes == 0) /* the handshake has already failed */
+    return;
   if (!success)
   {
-    retry_scan(central);
+    central->sps_writes = 0;
+    sps_write_failed(central);
     return;
   }
-  write_authentication_char(central, central->cli.peripheral_authentication_char_handle, BLE_SPS_AUTHEN_CHAR_VALUE, BLE_SPS_AUTHEN_CHAR_VALUE_LENGTH);
-}
-
-/** write_identification_char() -- write in identification characteristic
- * Input:   central -- pointer to the central structure
- *          handle -- handle value of the identification characteristic
- *          value -- pointer to value to write
- *          length -- length of value (in bytes)
- * Return:  EXIT_SUCCESS on  success, EXIT_FAILURE on error
- **/
-static int write_identification_char(struct gatt_central *central, uint16_t handle, const uint8_t *value, uint16_t length)
-{
-  if (bt_gatt_client_write_value(central->cli.gatt, central->cli.central_identification_char_handle, value, length, client_write_cb_identification_char, central, NULL) != 0)
-    return EXIT_FAILURE;
-  return EXIT_SUCCESS;
+  if (--central->sps_writes == 0)
+    ble_con_step = BLE_WAIT_MLDP_DATA;
 }
 
 /** write_ble_sps() -- start the connexion process with the SLATE
  * Input:   central -- pointer to the central structure
+ * Explanation : The identification, authentication and misc writes are Write Requests sent at once,
+ * not from the callback of the previous one. On the ATT bearer alone, bt_att sends each one as soon
+ * as the previous one is answered, in this order; with EATT they go on the request bearers together.
  **/
 static void write_ble_sps(struct gatt_central *central)
 {
-  write_identification_char(central, central->cli.central_identification_char_handle, BLE_SPS_IDENT_CHAR_VALUE, BLE_SPS_IDENT_CHAR_VALUE_LENGTH);
+  const struct
+  {
+    uint16_t handle;
+    const uint8_t *value;
+    uint16_t length;
+  } writes[] = {
+      {central->cli.central_identification_char_handle, BLE_SPS_IDENT_CHAR_VALUE, BLE_SPS_IDENT_CHAR_VALUE_LENGTH},
+      {central->cli.peripheral_authentication_char_handle, BLE_SPS_AUTHEN_CHAR_VALUE, BLE_SPS_AUTHEN_CHAR_VALUE_LENGTH},
+      {central->cli.misc_char_handle, BLE_SPS_MISC_CHAR_VALUE, BLE_SPS_MISC_CHAR_VALUE_LENGTH},
+  };
+  unsigned int i;
+
+  central->sps_writes = 0;
+  for (i = 0; i < sizeof(writes) / sizeof(writes[0]); i++)
+  {
+    if (central_write_value(central, writes[i].handle, writes[i].value, writes[i].length, client_write_cb_sps_char) == 0)
+    {
+      central->sps_writes = 0;
+      sps_write_failed(central);
+      return;
+    }
+    central->sps_writes++;
+  }
 }
 
 /*-----------------------------------------------------------------------------
@@ -869,31 +1167,52 @@ static void write_ble_sps(struct gatt_central *central)
 static int mldp_fifos_init(struct gatt_central *central)
 {
   int err_rx = 0, err_tx = 0;
-  static uint8_t mldp_rx_buff[MLDP_RX_BUFF_SIZE]; // Buffer for MLDP RX FIFO instance
-  static uint8_t mldp_tx_buff[MLDP_TX_BUFF_SIZE]; // Buffer for MLDP TX FIFO instance
 
-  err_rx = fifo_init(&central->mldp_fifo_rx, mldp_rx_buff, sizeof(mldp_rx_buff));
-  err_tx = fifo_init(&central->mldp_fifo_tx, mldp_tx_buff, sizeof(mldp_tx_buff));
+  /* each session of the pool has its own buffers: a released one can still be read by the ft thread */
+  err_rx = fifo_init(&central->mldp_fifo_rx, central->mldp_fifo_rx.fifo, sizeof(central->mldp_fifo_rx.fifo));
+  err_tx = fifo_init(&central->mldp_fifo_tx, central->mldp_fifo_tx.fifo, sizeof(central->mldp_fifo_tx.fifo));
 
   if (err_rx != 0 || err_tx != 0)
     return EXIT_FAILURE;
   return EXIT_SUCCESS;
 }
 
+/** ft_central -- Session of the transfer running in the ft thread
+ * Return:  pointer to the central structure
+ **/
+static struct gatt_central *ft_central(void)
+{
+  return file_transfer_current()->user_data;
+}
+
+/** ft_write_cmd -- Write Command from the ft thread
+ * Return:  the identifier of the command, 0 on error or if the session was released
+ **/
+static unsigned int ft_write_cmd(struct gatt_central *central, const uint8_t *value, uint16_t length)
+{
+  unsigned int id = 0;
+
+  pthread_mutex_lock(&central->att_lock);
+  if (central->att)
+    id = central_write_cmd(central, central->cli.mldp_data_char_handle, value, length);
+  pthread_mutex_unlock(&central->att_lock);
+  return id;
+}
+
 /** tx_fifo_send_bytes -- Write data in MLDP characteristics
- * Input:   /
+ * Input:   central -- session of the transfer
  * Output:  /
  * Return:  EXIT_SUCCESS on success, EXIT_FAILURE on error
  **/
-static int tx_fifo_send_bytes()
+static int tx_fifo_send_bytes(struct gatt_central *central)
 {
   uint32_t nbReadableBytes = 0;
   uint32_t lengthToSend = 0;
   uint32_t length = 0;
-  static uint8_t data_array[BLE_MLDP_MAX_DATA_LEN];
+  static uint8_t data_array[BLE_MLDP_MAX_WRITE_LEN];
   bool signed_write = false;
 
-  nbReadableBytes = fifo_length(&m_gatt_central->mldp_fifo_tx);
+  nbReadableBytes = fifo_length(&central->mldp_fifo_tx);
 
   if (nbReadableBytes == 0)
   {
@@ -903,19 +1222,19 @@ static int tx_fifo_send_bytes()
   unsigned int repeatOnErrorCount = 0;
   while (nbReadableBytes)
   {
-    length = MIN(nbReadableBytes, BLE_MLDP_MAX_DATA_LEN);
+    length = MIN(nbReadableBytes, central->mldp_write_len);
     lengthToSend = length;
 
     if (repeatOnErrorCount == 0)
     {
-      if (fifo_read(&m_gatt_central->mldp_fifo_tx, data_array, &length) != 0)
+      if (fifo_read(&central->mldp_fifo_tx, data_array, &length) != 0)
         return EXIT_FAILURE;
 
       if (length != lengthToSend)
         return EXIT_FAILURE;
     }
 
-    if (!bt_gatt_client_write_without_response(m_gatt_central->cli.gatt, m_gatt_central->cli.mldp_data_char_handle, false, data_array, length))
+    if (!ft_write_cmd(central, data_array, length))
     {
       PRLOG_ERROR("PACKET NOT SENT\n");
       if (repeatOnErrorCount >= 3)
@@ -938,7 +1257,7 @@ static int tx_fifo_send_bytes()
  **/
 static int ble_mldp_get_byte(uint8_t *p_byte)
 {
-  int err = fifo_get(&m_gatt_central->mldp_fifo_rx, p_byte);
+  int err = fifo_get(&ft_central()->mldp_fifo_rx, p_byte);
   if (err != 0)
     return EXIT_FAILURE;
 
@@ -954,35 +1273,77 @@ static int ble_mldp_get_byte(uint8_t *p_byte)
 static int ble_mldp_send_bytes(const uint8_t *p_string, uint32_t length)
 {
   PRLOG_DEBUG("Begining Send Bytes : %u bytes\n", length)
+  struct gatt_central *central = ft_central();
   int err = 0;
-  if (ble_con_step != BLE_FILE_TRANSFER)
+  if (ble_con_step != BLE_FILE_TRANSFER || !central->in_use)
     return EXIT_FAILURE;
 
-  err = fifo_write(&m_gatt_central->mldp_fifo_tx, p_string, &length);
+  err = fifo_write(&central->mldp_fifo_tx, p_string, &length);
   if (err != 0)
     return err;
 
-  if (tx_fifo_send_bytes() != 0)
+  if (tx_fifo_send_bytes(central) != 0)
     return EXIT_FAILURE;
+  central->ft_tx_bytes += length;
 
   return EXIT_SUCCESS;
 }
 
-/** FT_WAIT_MS -- Standby function
- * Input:   timeMS -- time to wait before returning to the file transfer thread
- * Output:  /
- * Return: /
- * Explanation :Returns to the main thread and remains on standby for timeMS.
- * Listens if data from the MLDP DATA characteristic are received
- **/
-static void ft_wait_ms(uint32_t timeMS)
+/** coc_send_bytes -- Send a Kermit packet as one SDU of the LE credit based channel
+ * Input:   p_string -- pointer to the data to send
+ *          length -- length in byte
+ * Return: EXIT_SUCCESS on success, EXIT_FAILURE on error
+ * Explanation : The kernel segments the SDU and waits for the credits of the SLATE. The socket is not
+ * written while blocking, the mainloop could not release the session meanwhile.
+ * Once the channel is closed, the packets are sent on MLDP like the ones of the SLATE.
+ **/
+static int coc_send_bytes(const uint8_t *p_string, uint32_t length)
+{
+  struct gatt_central *central = ft_central();
+  unsigned int retries = 0;
+  ssize_t ret = -1;
+
+  if (ble_con_step != BLE_FILE_TRANSFER || !central->in_use)
+    return EXIT_FAILURE;
+
+  while (retries++ < COC_SEND_RETRIES)
+  {
+    pthread_mutex_lock(&central->att_lock);
+    if (central->coc_fd < 0)
+      errno = ENOTCONN;
+    else
+      ret = send(central->coc_fd, p_string, length, MSG_DONTWAIT | MSG_NOSIGNAL);
+    pthread_mutex_unlock(&central->att_lock);
+
+    if (ret >= 0 || errno != EAGAIN)
+      break;
+    usleep(1000);
+  }
+
+  if (ret < 0 && (errno == ENOTCONN || errno == EPIPE || errno == ECONNRESET))
+    return ble_mldp_send_bytes(p_string, length);
+  if (ret != (ssize_t)length)
+    return EXIT_FAILURE;
+  central->ft_tx_bytes += length;
+  return EXIT_SUCCESS;
+}
+
+/** FT_WAIT_MS -- Standby function
+ * Input:   timeMS -- time to wait before returning to the file transfer thread
+ * Output:  /
+ * Return: /
+ * Explanation :Returns to the main thread and remains on standby for timeMS.
+ * Listens if data from the MLDP DATA characteristic are received
+ **/
+static void ft_wait_ms(uint32_t timeMS)
 {
+  struct gatt_central *central = ft_central();
   struct timespec ts;
   clock_gettime(CLOCK_MONOTONIC, &ts);
   ts.tv_nsec += (timeMS * 1000000);
 
-  pthread_cond_timedwait(&m_gatt_central->ft_s.condition, &m_gatt_central->ft_s.mutex, &ts);
-  pthread_mutex_unlock(&m_gatt_central->ft_s.mutex);
+  pthread_cond_timedwait(&central->ft_s.condition, &central->ft_s.mutex, &ts);
+  pthread_mutex_unlock(&central->ft_s.mutex);
 }
 
 /** fifos_flush -- Reset fifos
@@ -996,49 +1357,113 @@ static void fifos_flush(struct gatt_central *central)
 
 /** start_file_transfer -- Start file transfer
  * Input:   central -- pointer to the central structure
+ *          coc -- the first data was received on the LE credit based channel
+ * Return:  EXIT_SUCCESS on success, EXIT_FAILURE on error
  * Explanation : Called when the first MLDP data is received.
- *               This function initializes the function that link the bluetooth part to the Kermit program.
+ *               The session is given to the ft thread, its Kermit callbacks are set by session_pool_init().
  **/
-static void *start_file_transfer(struct gatt_central *central)
+static int start_file_transfer(struct gatt_central *central, bool coc)
 {
-  int err = 0;
-  fifos_flush(central);
-
-  memset(&central->ft_s.kermit_handler_s, 0, sizeof(central->ft_s.kermit_handler_s));
-  central->ft_s.kermit_handler_s.ble_mldp_get_byte = ble_mldp_get_byte;
-  central->ft_s.kermit_handler_s.ble_mldp_send_bytes = ble_mldp_send_bytes;
-  central->ft_s.kermit_handler_s.ft_wait_ms = ft_wait_ms;
+  /* a Write Command carries up to the ATT MTU of its bearer, less its header */
+  central->mldp_write_len = MIN(MAX(bt_att_get_write_mtu(central->att) - 3, BLE_MLDP_MAX_DATA_LEN), BLE_MLDP_MAX_WRITE_LEN);
 
-  err = file_transfer_start_server(&central->ft_s);
-  if (err != 0)
+  /* the packets go back on the transport on which the SLATE has started */
+  if (coc)
+  {
+    central->ft_s.kermit_handler_s.ble_mldp_send_bytes = coc_send_bytes;
+    central->ft_s.kermit_handler_s.link_mtu = COC_SDU_LEN;
+  }
+  else
   {
-    exit(1); //failed to create file transfer thread
+    central->ft_s.kermit_handler_s.ble_mldp_send_bytes = ble_mldp_send_bytes;
+    central->ft_s.kermit_handler_s.link_mtu = central->mldp_write_len;
   }
+  /* the Kermit window and packet length are tuned from them, starting from the learned ones */
+  central->ft_s.kermit_handler_s.link_interval_ms = (m_conn_complete_interval * 5 + 3) / 4;
+  central->ft_s.kermit_handler_s.link_maxlen = m_link_profile.kermit_maxlen;
+  central->ft_s.kermit_handler_s.link_window = m_link_profile.kermit_window;
+  bacpy(&central->ft_addr, &m_slate_addr);
+  central->ft_profile = m_link_profile;
+  central->ft_interval = m_conn_complete_interval;
+  central->ft_s.batch = m_batch;
+
+  fifos_flush(central);
+  central->ft_rx_bytes = 0;
+  central->ft_tx_bytes = 0;
+  central->ft_rx_write_reqs = 0;
+  central->ft_rx_write_cmds = 0;
+  central->ft_rx_notifications = 0;
+  central->ft_rx_sdus = 0;
+  queue_get_entry_stats(&central->ft_queue_allocs, &central->ft_queue_reuses);
+  bt_att_get_op_stats(&central->ft_op_allocs, &central->ft_op_reuses);
+  bt_att_get_io_stats(&central->ft_syscalls, &central->ft_pdus);
+
+  if (file_transfer_start_server(&central->ft_s) != 0)
+    return EXIT_FAILURE;
+  central->ft_started = true;
+  return EXIT_SUCCESS;
 }
 
 /*-----------------------------------------------------------------------------
  * Populate central server database
  *-----------------------------------------------------------------------------*/
 
+/** mldp_data_received -- Data sent by the SLATE on MLDP
+ * Input:   central -- pointer to the central structure
+ *          value -- data received
+ *          len -- length of value
+ *          opcode -- ATT opcode which carried the data, counted for the transfer, 0 for a CoC SDU
+ * Explanation : Each data received are put in the rx fifo.
+ * When we receive the first data, we lauch the file transfer.
+ **/
+static void mldp_data_received(struct gatt_central *central, const uint8_t *value, size_t len, uint8_t opcode)
+{
+  if (ble_con_step == BLE_WAIT_MLDP_DATA)
+  {
+    PRLOG_DEBUG("Start file transfer\n");
+    ble_con_step = BLE_FILE_TRANSFER;
+    if (start_file_transfer(central, opcode == 0) != EXIT_SUCCESS)
+    {
+      PRLOG_ERROR("Could not start the file transfer\n");
+      le_deconnection();
+    }
+  }
+
+  switch (opcode)
+  {
+  case BT_ATT_OP_WRITE_REQ:
+    central->ft_rx_write_reqs++;
+    break;
+  case BT_ATT_OP_WRITE_CMD:
+    central->ft_rx_write_cmds++;
+    break;
+  case BT_ATT_OP_HANDLE_NFY:
+    central->ft_rx_notifications++;
+    break;
+  }
+
+  fifo_write(&central->mldp_fifo_rx, value, &len);
+  central->ft_rx_bytes += len;
+}
+
 /** server_mldp_data_char_write_cb -- Callback function of the server MLDP characteristics.
  * Input:   attrib -- attribut of the server database
- *          id -- identifier of the GATT request.
+ *          id -- identifier of the GATT request, 0 for a Write Command.
  *          offset -- unused here.
  *          value -- pointer to th value just written in the server MLDP char.
  *          len -- length of value
- *          opcode -- operation code, can be used to speficie an operation to do. Not used here.
+ *          opcode -- Write Request or Write Command
  *          att --
- *          user_data -- pointer to the central structure
+ *          user_data -- unused, the database is shared by the sessions
  * Output:  /
  * Return:  /
  * Explanation : When the remote device writes in the Rpi MLDP data char, it will be notified by this function.
- * Each data received are put in the rx fifo.
- * When we receive the first data, we lauch the file transfer.
+ * A Write Command was already completed by the database, without response to send.
  **/
 static void server_mldp_data_char_write_cb(struct gatt_db_attribute *attrib, unsigned int id, uint16_t offset, const uint8_t *value, size_t len, uint8_t opcode, struct bt_att *att, void *user_data)
 {
 
-  struct gatt_central *central = user_data;
+  struct gatt_central *central = m_gatt_central;
   uint8_t ecode = 0;
 
   if (attrib == NULL)
@@ -1050,45 +1475,96 @@ static void server_mldp_data_char_write_cb(struct gatt_db_attribute *attrib, uns
     goto done;
   }
 
-  if (ble_con_step == BLE_WAIT_MLDP_DATA)
+  if (central == NULL)
   {
-    PRLOG_DEBUG("Start file transfer\n");
-    ble_con_step = BLE_FILE_TRANSFER;
-    start_file_transfer(central);
+    ecode = BT_ATT_ERROR_UNLIKELY;
+    goto done;
   }
-  fifo_write(&central->mldp_fifo_rx, value, &len);
+
+  mldp_data_received(central, value, len, opcode);
 
 done:
-  gatt_db_attribute_write_result(attrib, id, ecode);
+  if (id != 0)
+    gatt_db_attribute_write_result(attrib, id, ecode);
+}
+
+/** client_mldp_data_notify_cb -- Notification of the MLDP data characteristic of the SLATE
+ * Explanation : Registered on the ATT bearer, it is called for the notifications of all the handles
+ * whether bt_gatt_client is used or not. Like a Write Command, a notification is not acknowledged.
+ **/
+static void client_mldp_data_notify_cb(struct bt_att_chan *chan, uint8_t opcode, const void *pdu, uint16_t length, void *user_data)
+{
+  struct gatt_central *central = user_data;
+
+  if (length < 2 || central->cli.mldp_data_char_handle == 0 ||
+      get_le16(pdu) != central->cli.mldp_data_char_handle)
+    return;
+
+  mldp_data_received(central, (const uint8_t *)pdu + 2, length - 2, opcode);
+}
+
+/** coc_read_cb -- SDU received on the LE credit based channel
+ * Explanation : The SDU is a Kermit packet, put in the rx fifo like the MLDP data. If the channel is
+ * closed by the SLATE, the session goes on with MLDP, coc_send_bytes() sends there too.
+ **/
+static void coc_read_cb(int fd, uint32_t events, void *user_data)
+{
+  struct gatt_central *central = user_data;
+  uint8_t sdu[COC_SDU_LEN];
+  ssize_t len = -1;
+
+  if (events & EPOLLIN)
+    len = recv(fd, sdu, sizeof(sdu), MSG_DONTWAIT);
+
+  if (len < 0 && errno == EAGAIN && !(events & (EPOLLERR | EPOLLHUP)))
+    return;
+
+  if (len <= 0)
+  {
+    PRLOG("CoC closed, back to MLDP\n");
+    pthread_mutex_lock(&central->att_lock);
+    mainloop_remove_fd(fd);
+    close(fd);
+    central->coc_fd = -1;
+    pthread_mutex_unlock(&central->att_lock);
+    return;
+  }
+
+  central->ft_rx_sdus++;
+  mldp_data_received(central, sdu, len, 0);
 }
 
 /** populate_mldp_service -- Cretae MLDP service
- * Input: central -- pointer to the central structure
+ * Input: db -- server database
+ *        srv -- handles of the service
  **/
-static void populate_mldp_service(struct gatt_central *central)
+static void populate_mldp_service(struct gatt_db *db, struct server *srv)
 {
   bt_uuid_t uuid;
   struct gatt_db_attribute *service, *mldp_data_chr_attr, *mldp_ctrl_char_attr;
 
   /* Add MDLP Service */
   bt_uuid128_create(&uuid, mldp_service_uuid);
-  service = gatt_db_add_service(central->db_s, &uuid, true, 8);
-  central->srv.mldp_service_handle = gatt_db_attribute_get_handle(service);
+  service = gatt_db_add_service(db, &uuid, true, 8);
+  srv->mldp_service_handle = gatt_db_attribute_get_handle(service);
 
-  /* Add MLDP_DATA Characteristic */
+  /* Add MLDP_DATA Characteristic
+   * Write Request is not advertised so that the SLATE sends its data with Write Commands, without a
+   * response per chunk. The permission still accepts the Write Requests of a SLATE which ignores it.
+   */
   bt_uuid128_create(&uuid, mldp_data_char_uuid);
   mldp_data_chr_attr = gatt_db_service_add_characteristic(service, &uuid,
                                                           BT_ATT_PERM_READ | BT_ATT_PERM_WRITE,
-                                                          BT_GATT_CHRC_PROP_READ | BT_GATT_CHRC_PROP_WRITE | BT_GATT_CHRC_PROP_WRITE_WITHOUT_RESP | BT_GATT_CHRC_PROP_INDICATE | BT_GATT_CHRC_PROP_NOTIFY,
-                                                          NULL, server_mldp_data_char_write_cb, central);
-  central->srv.mldp_data_char_handle = gatt_db_attribute_get_handle(mldp_data_chr_attr);
-  central->srv.mldp_data_char_attr = mldp_data_chr_attr;
+                                                          BT_GATT_CHRC_PROP_READ | BT_GATT_CHRC_PROP_WRITE_WITHOUT_RESP | BT_GATT_CHRC_PROP_INDICATE | BT_GATT_CHRC_PROP_NOTIFY,
+                                                          NULL, server_mldp_data_char_write_cb, NULL);
+  srv->mldp_data_char_handle = gatt_db_attribute_get_handle(mldp_data_chr_attr);
+  srv->mldp_data_char_attr = mldp_data_chr_attr;
 
   bt_uuid16_create(&uuid, GATT_CLIENT_CHARAC_CFG_UUID);
   gatt_db_service_add_descriptor(service, &uuid,
                                  BT_ATT_PERM_READ | BT_ATT_PERM_WRITE,
                                  NULL,
-                                 NULL, central);
+                                 NULL, NULL);
 
   /* Add MLDP_CTRL Characteristic */
   bt_uuid128_create(&uuid, mldp_ctrl_char_uuid);
@@ -1096,18 +1572,23 @@ static void populate_mldp_service(struct gatt_central *central)
                                                            BT_ATT_PERM_READ | BT_ATT_PERM_WRITE,
                                                            BT_GATT_CHRC_PROP_READ | BT_GATT_CHRC_PROP_WRITE | BT_GATT_CHRC_PROP_WRITE_WITHOUT_RESP,
                                                            NULL, NULL, NULL);
-  central->srv.mldp_ctrl_char_handle = gatt_db_attribute_get_handle(mldp_ctrl_char_attr);
-  central->srv.mldp_ctrl_char_attr = mldp_ctrl_char_attr;
+  srv->mldp_ctrl_char_handle = gatt_db_attribute_get_handle(mldp_ctrl_char_attr);
+  srv->mldp_ctrl_char_attr = mldp_ctrl_char_attr;
 
   gatt_db_service_set_active(service, true);
 }
 
-/** populate_db -- add services in the server database
- * Input: central -- pointer to the central structure
+/** populate_db -- Create the server database, shared by all the sessions
+ * Return: EXIT_SUCCESS on success, EXIT_FAILURE on error
  **/
-static void populate_db(struct gatt_central *central)
+static int populate_db(void)
 {
-  populate_mldp_service(central);
+  m_server_db = gatt_db_new();
+  if (!m_server_db)
+    return EXIT_FAILURE;
+
+  populate_mldp_service(m_server_db, &m_server);
+  return EXIT_SUCCESS;
 }
 
 /** service_changed_cb -- Callback function used to modify a server service
@@ -1138,8 +1619,19 @@ static void service_changed_cb(uint16_t start_handle, uint16_t end_handle, void
 static void ready_cb(bool success, uint8_t att_ecode, void *user_data)
 {
   struct gatt_central *central = user_data;
+  uint8_t hash[GATT_CACHE_HASH_LEN];
+
   if (!success)
+  {
+    if (central->cli.cache_loaded)
+      gatt_cache_remove(&m_slate_addr); //discover again on the next connection
     return;
+  }
+
+  /* save the database if it was discovered */
+  if (gatt_cache_get_peer_hash(central->db_c, hash) &&
+      (!central->cli.cache_loaded || memcmp(hash, central->cli.cache_hash, sizeof(hash)) != 0))
+    gatt_cache_store(central->db_c, &m_slate_addr);
 
   get_handle_from_uuid(central);
   ble_con_step = BLE_ALL_SERVICE_DISCOVERY_COMPLETE;
@@ -1159,21 +1651,23 @@ void att_debug_func(const char *str, void *user_data)
 /** gatt_central_create -- Create Central structure with client and server.
  * Input: fd -- file descriptor of the socket
  *        mtu -- length of ATT packet (default 23 bytes)
- * Explanation : activate the ATT debugging tool in gatt_central_create()
+ * Explanation : The central structure is taken from the pool, the server uses the shared database.
  **/
 static struct gatt_central *gatt_central_create(int fd, uint16_t mtu)
 {
   struct gatt_central *central;
 
-  central = new0(struct gatt_central, 1);
+  central = session_acquire();
   if (!central)
+  {
+    PRLOG_ERROR("No session available\n");
     return NULL;
+  }
 
   central->att = bt_att_new(fd, false);
   if (!central->att)
   {
-    bt_att_unref(central->att);
-    free(central);
+    central->in_use = false;
     return NULL;
   }
 
@@ -1187,7 +1681,7 @@ static struct gatt_central *gatt_central_create(int fd, uint16_t mtu)
   if (!bt_att_set_close_on_unref(central->att, true))
   {
     bt_att_unref(central->att);
-    free(central);
+    central->in_use = false;
     return NULL;
   }
 
@@ -1195,67 +1689,160 @@ static struct gatt_central *gatt_central_create(int fd, uint16_t mtu)
                                   NULL))
   {
     bt_att_unref(central->att);
-    free(central);
+    central->in_use = false;
     return NULL;
   }
 
-  central->fd = fd;
-  central->db_c = gatt_db_new();
-  central->db_s = gatt_db_new();
-
-  if (!central->db_c)
-  {
-    bt_att_unref(central->att);
-    free(central);
-    return NULL;
-  }
-  if (!central->db_s)
+  /* the SLATE may also send its data as notifications of its MLDP data characteristic */
+  if (!bt_att_register(central->att, BT_ATT_OP_HANDLE_NFY, client_mldp_data_notify_cb, central, NULL))
   {
     bt_att_unref(central->att);
-    free(central);
+    central->in_use = false;
     return NULL;
   }
 
-  central->srv.gatt = bt_gatt_server_new(central->db_s, central->att, mtu, 0);
-  if (!central->srv.gatt)
+  central->fd = fd;
+  central->db_c = gatt_db_new();
+
+  if (!central->db_c)
   {
-    gatt_db_unref(central->db_s);
     bt_att_unref(central->att);
-    free(central);
+    central->in_use = false;
     return NULL;
   }
 
-  central->cli.gatt = bt_gatt_client_new(central->db_c, central->att, mtu, 0);
-  if (!central->cli.gatt)
+  /* the discovery is skipped if the Database Hash of the SLATE did not change */
+  if (!m_uuid_discovery)
+    central->cli.cache_loaded = (gatt_cache_load(central->db_c, &m_slate_addr, central->cli.cache_hash) == 0);
+
+  central->srv.gatt = bt_gatt_server_new(m_server_db, central->att, mtu, 0);
+  if (!central->srv.gatt)
   {
     gatt_db_unref(central->db_c);
     bt_att_unref(central->att);
-    free(central);
+    central->in_use = false;
     return NULL;
   }
 
   gatt_db_register(central->db_c, service_added_cb, service_removed_cb,
                    NULL, NULL);
 
-  bt_gatt_client_ready_register(central->cli.gatt, ready_cb, central, NULL);
-  bt_gatt_client_set_service_changed(central->cli.gatt, service_changed_cb, central, NULL);
+  if (m_uuid_discovery)
+  {
+    /* the database is kept until gatt_central_destroy() */
+    if (!gatt_targeted_discover(central->att, central->db_c, &m_uuids[UUID_SLATE_SERVICE], 2, ready_cb, central))
+    {
+      gatt_db_unref(central->db_c);
+      bt_gatt_server_unref(central->srv.gatt);
+      bt_att_unref(central->att);
+      central->in_use = false;
+      return NULL;
+    }
+  }
+  else
+  {
+    central->cli.gatt = bt_gatt_client_new(central->db_c, central->att, mtu, 0);
+    if (!central->cli.gatt)
+    {
+      gatt_db_unref(central->db_c);
+      bt_gatt_server_unref(central->srv.gatt);
+      bt_att_unref(central->att);
+      central->in_use = false;
+      return NULL;
+    }
 
-  /* bt_gatt_client already holds a reference */
-  gatt_db_unref(central->db_c);
-  gatt_db_unref(central->db_s);
+    bt_gatt_client_ready_register(central->cli.gatt, ready_cb, central, NULL);
+    bt_gatt_client_set_service_changed(central->cli.gatt, service_changed_cb, central, NULL);
 
-  populate_db(central);
+    /* bt_gatt_client already holds a reference */
+    gatt_db_unref(central->db_c);
+  }
 
   return central;
 }
 
+/** session_pool_init -- Initialize the sessions once for all the connections
+ * Return: EXIT_SUCCESS on success, EXIT_FAILURE on error
+ **/
+static int session_pool_init(void)
+{
+  struct gatt_central *central;
+  int i;
+
+  for (i = 0; i < SESSION_POOL_SIZE; i++)
+  {
+    central = &m_sessions[i];
+    central->fd = -1;
+    central->srv = m_server;
+
+    central->ft_s.user_data = central;
+    central->ft_s.kermit_handler_s.ble_mldp_get_byte = ble_mldp_get_byte;
+    central->ft_s.kermit_handler_s.ble_mldp_send_bytes = ble_mldp_send_bytes;
+    central->ft_s.kermit_handler_s.ft_wait_ms = ft_wait_ms;
+
+    pthread_condattr_init(&central->ft_s.attr);
+    pthread_condattr_setclock(&central->ft_s.attr, CLOCK_MONOTONIC);
+    if (pthread_cond_init(&central->ft_s.condition, &central->ft_s.attr) != 0 ||
+        pthread_mutex_init(&central->ft_s.mutex, NULL) != 0 ||
+        pthread_mutex_init(&central->att_lock, NULL) != 0)
+      return EXIT_FAILURE;
+
+    if (mldp_fifos_init(central) != EXIT_SUCCESS)
+      return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
+
+/** l2cap_connect_start -- Start the connect() of an L2CAP socket without waiting for the SLATE
+ * Input:   sock -- the socket, bound
+ *          dstaddr -- pointer to the destination address
+ * Return:  0 if the connection is in progress, -1 on error
+ * Explanation : The socket becomes writable once the connection is done or has failed, see l2cap_connect_done().
+ **/
+static int l2cap_connect_start(int sock, struct sockaddr_l2 *dstaddr)
+{
+  int flags;
+
+  flags = fcntl(sock, F_GETFL);
+  if (flags < 0 || fcntl(sock, F_SETFL, flags | O_NONBLOCK) < 0)
+    return -1;
+
+  if (connect(sock, (struct sockaddr *)dstaddr, sizeof(*dstaddr)) < 0 && errno != EINPROGRESS)
+    return -1;
+  return 0;
+}
+
+/** l2cap_connect_done -- Get the result of l2cap_connect_start() once the socket is writable
+ * Input:   sock -- the socket
+ * Return:  0 if connected, -1 with errno set otherwise
+ * Explanation : The socket is put back in blocking mode, as bt_att and the CoC reads expect it.
+ **/
+static int l2cap_connect_done(int sock)
+{
+  int err = 0, flags;
+  socklen_t len = sizeof(err);
+
+  if (getsockopt(sock, SOL_SOCKET, SO_ERROR, &err, &len) < 0)
+    return -1;
+  if (err != 0)
+  {
+    errno = err;
+    return -1;
+  }
+
+  flags = fcntl(sock, F_GETFL);
+  if (flags < 0 || fcntl(sock, F_SETFL, flags & ~O_NONBLOCK) < 0)
+    return -1;
+  return 0;
+}
+
 /** l2cap_le_att_connect -- Open a Bluetooth socket base on the L2CAP layer.
  * Input:   src -- pointer to the source address (the address of the Rpi).
  *          dst -- pointer to the destination address (address of the remote device).
  *          dst_type -- type of the destination address : public or private.
  *          sec -- specifies the level of security of the socket.
  * Output:  /
- * Return:  /
+ * Return:  the socket, its connection in progress, -1 on error
  * Explanation : This function allows to create a bluetooth socket. The function connect() is used because it's the central that initiate the connection.
  * Otherwise, you must use the listen() function and wait for a remote device to connect to the socket
  **/
@@ -1267,7 +1854,7 @@ static int l2cap_le_att_connect(bdaddr_t *src, bdaddr_t *dst, uint8_t dst_type,
 
   sock = socket(PF_BLUETOOTH, SOCK_SEQPACKET, BTPROTO_L2CAP);
   if (sock < 0)
-    return EXIT_FAILURE;
+    return -1;
 
   /* Set up source address */
   memset(&srcaddr, 0, sizeof(srcaddr));
@@ -1279,7 +1866,7 @@ static int l2cap_le_att_connect(bdaddr_t *src, bdaddr_t *dst, uint8_t dst_type,
   if (bind(sock, (struct sockaddr *)&srcaddr, sizeof(srcaddr)) < 0)
   {
     close(sock);
-    return EXIT_FAILURE;
+    return -1;
   }
 
   /* Set the security level */
@@ -1289,7 +1876,7 @@ static int l2cap_le_att_connect(bdaddr_t *src, bdaddr_t *dst, uint8_t dst_type,
                  sizeof(btsec)) != 0)
   {
     close(sock);
-    return EXIT_FAILURE;
+    return -1;
   }
 
   /* Set up destination address */
@@ -1302,136 +1889,617 @@ static int l2cap_le_att_connect(bdaddr_t *src, bdaddr_t *dst, uint8_t dst_type,
   PRLOG("Connecting to device...");
   fflush(stdout);
 
-  if (connect(sock, (struct sockaddr *)&dstaddr, sizeof(dstaddr)) < 0)
+  if (l2cap_connect_start(sock, &dstaddr) < 0)
   {
     perror(" Failed to connect");
     close(sock);
     return -1;
   }
-  PRLOG(" Done\n");
   return sock;
 }
 
-/** retry_scan -- Function to restart scan on error
- * Input: central -- pointer to the central structure
+/** l2cap_le_eatt_connect -- Open an EATT bearer, an LE credit based channel on the EATT PSM
+ * Input:   src -- pointer to the source address (the address of the Rpi).
+ *          dst -- pointer to the destination address (address of the remote device).
+ *          dst_type -- type of the destination address : public or private.
+ *          sec -- specifies the level of security of the socket.
+ * Return:  the socket, its connection in progress, -1 on error
+ * Explanation : Fails if the kernel has no enhanced credit based mode. If the SLATE has no EATT server,
+ * l2cap_connect_done() fails.
  **/
-static void retry_scan(struct gatt_central *central)
+static int l2cap_le_eatt_connect(bdaddr_t *src, bdaddr_t *dst, uint8_t dst_type, int sec)
 {
-  mainloop_quit();
-  ble_con_step = BLE_SCANNING;
+  int sock;
+  struct sockaddr_l2 srcaddr, dstaddr;
+  struct bt_security btsec;
+  uint8_t mode = BT_MODE_EXT_FLOWCTL;
+
+  sock = socket(PF_BLUETOOTH, SOCK_SEQPACKET, BTPROTO_L2CAP);
+  if (sock < 0)
+    return -1;
+
+  memset(&srcaddr, 0, sizeof(srcaddr));
+  srcaddr.l2_family = AF_BLUETOOTH;
+  srcaddr.l2_bdaddr_type = BDADDR_LE_PUBLIC; //the adapter
+  bacpy(&srcaddr.l2_bdaddr, src);
+
+  memset(&btsec, 0, sizeof(btsec));
+  btsec.level = sec;
+
+  if (bind(sock, (struct sockaddr *)&srcaddr, sizeof(srcaddr)) < 0 ||
+      setsockopt(sock, SOL_BLUETOOTH, BT_SECURITY, &btsec, sizeof(btsec)) != 0 ||
+      setsockopt(sock, SOL_BLUETOOTH, BT_MODE, &mode, sizeof(mode)) != 0)
+  {
+    close(sock);
+    return -1;
+  }
+
+  memset(&dstaddr, 0, sizeof(dstaddr));
+  dstaddr.l2_family = AF_BLUETOOTH;
+  dstaddr.l2_psm = htobs(EATT_PSM);
+  dstaddr.l2_bdaddr_type = dst_type;
+  bacpy(&dstaddr.l2_bdaddr, dst);
+
+  if (l2cap_connect_start(sock, &dstaddr) < 0)
+  {
+    close(sock);
+    return -1;
+  }
+  return sock;
 }
 
-/** address_usage -- Print the format of address to respect
+/** eatt_connect_end -- No more EATT bearer to open, open the CoC
+ * Input:   central -- pointer to the central structure
  **/
-static void address_usage()
+static void eatt_connect_end(struct gatt_central *central)
 {
-  PRLOG("INVALID ADDRESS\n");
-  PRLOG("Address must be in this form : xx:xx:xx:xx:xx:xx (where 'x' are hexadecimals symbols)\n");
+  if (central->eatt_bearers == 0)
+  {
+    PRLOG("EATT not available: %s\n", strerror(errno));
+  }
+  else
+  {
+    PRLOG("%d EATT bearers opened\n", central->eatt_bearers);
+  }
+
+  if (m_coc_psm != 0)
+    coc_connect(central);
 }
 
-/** parse_given_address -- Watch if address is in the MAC address format
- * Input: address -- address to parse
- * Return : 0 on succes, else -1
+/** eatt_connect_cb -- The connect() of an EATT bearer is done
+ * Explanation : The bearer is attached and the next one is opened, unless the SLATE has refused it.
  **/
-static int parse_given_address(char *address)
+static void eatt_connect_cb(int fd, uint32_t events, void *user_data)
 {
-  regex_t reg;
-  const char *str_regex = "^[a-fA-F0-9:]{17}|[a-fA-F0-9]{12}$";
-  int err;
+  struct gatt_central *central = user_data;
+
+  mainloop_remove_fd(fd);
+  central->connect_fd = -1;
 
-  // Creation of regEx
-  err = regcomp(&reg, str_regex, REG_NOSUB | REG_EXTENDED);
-  if (err == 0) //regex compiled successfully
+  if (l2cap_connect_done(fd) < 0 || bt_att_attach_fd(central->att, fd) < 0)
   {
-    int match;
-    match = regexec(&reg, address, 0, NULL, 0);
-    regfree(&reg);
-    if (match == 0)
-    {
-      ble_con_step = BLE_SCANNING;
-      return 0;
-    }
-    else
-    {
-      address_usage();
-      return -1;
-    }
+    close(fd);
+    eatt_connect_end(central);
+    return;
   }
-  else
+
+  if (++central->eatt_bearers == 1)
+    bt_att_set_split_bearers(central->att, true);
+  eatt_connect(central);
+}
+
+/** eatt_connect -- Add the next EATT bearer to the ATT bearer of the central
+ * Input:   central -- pointer to the central structure
+ * Explanation : The requests and indications (SPS writes, discovery, reads) are sent on the EATT bearers
+ * and the MLDP Write Commands on the ATT bearer, so that they never wait behind the data. Without
+ * EATT, everything stays on the ATT bearer. The bearers are opened one after the other from the
+ * mainloop, the discovery goes on meanwhile with the bearers already attached.
+ **/
+static void eatt_connect(struct gatt_central *central)
+{
+  int fd;
+
+  if (central->eatt_bearers >= m_eatt_bearers)
+  {
+    eatt_connect_end(central);
+    return;
+  }
+
+  fd = l2cap_le_eatt_connect(&m_src_addr, &m_slate_addr, m_slate_addr_type, BT_SECURITY_LOW);
+  if (fd < 0)
+  {
+    eatt_connect_end(central);
+    return;
+  }
+
+  if (mainloop_add_fd(fd, EPOLLOUT, eatt_connect_cb, central, NULL) < 0)
+  {
+    close(fd);
+    eatt_connect_end(central);
+    return;
+  }
+  central->connect_fd = fd;
+}
+
+/** l2cap_le_coc_connect -- Open an LE credit based channel on m_coc_psm
+ * Input:   src -- pointer to the source address (the address of the Rpi).
+ *          dst -- pointer to the destination address (address of the remote device).
+ *          dst_type -- type of the destination address : public or private.
+ *          sec -- specifies the level of security of the socket.
+ * Return:  the socket, its connection in progress, -1 on error
+ * Explanation : The receive MTU is a whole Kermit packet, the kernel reassembles the SDU.
+ **/
+static int l2cap_le_coc_connect(bdaddr_t *src, bdaddr_t *dst, uint8_t dst_type, int sec)
+{
+  int sock;
+  struct sockaddr_l2 srcaddr, dstaddr;
+  struct bt_security btsec;
+  uint16_t mtu = COC_SDU_LEN;
+
+  sock = socket(PF_BLUETOOTH, SOCK_SEQPACKET, BTPROTO_L2CAP);
+  if (sock < 0)
+    return -1;
+
+  memset(&srcaddr, 0, sizeof(srcaddr));
+  srcaddr.l2_family = AF_BLUETOOTH;
+  srcaddr.l2_bdaddr_type = BDADDR_LE_PUBLIC; //the adapter
+  bacpy(&srcaddr.l2_bdaddr, src);
+
+  memset(&btsec, 0, sizeof(btsec));
+  btsec.level = sec;
+
+  if (bind(sock, (struct sockaddr *)&srcaddr, sizeof(srcaddr)) < 0 ||
+      setsockopt(sock, SOL_BLUETOOTH, BT_SECURITY, &btsec, sizeof(btsec)) != 0 ||
+      setsockopt(sock, SOL_BLUETOOTH, BT_RCVMTU, &mtu, sizeof(mtu)) != 0)
+  {
+    close(sock);
+    return -1;
+  }
+
+  memset(&dstaddr, 0, sizeof(dstaddr));
+  dstaddr.l2_family = AF_BLUETOOTH;
+  dstaddr.l2_psm = htobs(m_coc_psm);
+  dstaddr.l2_bdaddr_type = dst_type;
+  bacpy(&dstaddr.l2_bdaddr, dst);
+
+  if (l2cap_connect_start(sock, &dstaddr) < 0)
   {
-    PRLOG("Error in regular expression compilation\n");
+    close(sock);
     return -1;
   }
+  return sock;
 }
 
-int main(int argc, char *argv[])
+/** coc_connect_cb -- The connect() of the LE credit based channel is done
+ **/
+static void coc_connect_cb(int fd, uint32_t events, void *user_data)
+{
+  struct gatt_central *central = user_data;
+
+  mainloop_remove_fd(fd);
+  central->connect_fd = -1;
+
+  if (l2cap_connect_done(fd) < 0)
+  {
+    PRLOG("CoC not available on PSM 0x%04x, MLDP is used: %s\n", m_coc_psm, strerror(errno));
+    close(fd);
+    return;
+  }
+
+  if (mainloop_add_fd(fd, EPOLLIN, coc_read_cb, central, NULL) < 0)
+  {
+    close(fd);
+    return;
+  }
+  pthread_mutex_lock(&central->att_lock);
+  central->coc_fd = fd;
+  pthread_mutex_unlock(&central->att_lock);
+  PRLOG("CoC opened on PSM 0x%04x\n", m_coc_psm);
+}
+
+/** coc_connect -- Open the LE credit based channel of the Kermit packets
+ * Input:   central -- pointer to the central structure
+ * Explanation : If the SLATE has no server on the PSM, the file transfer uses MLDP. Until the channel
+ * is opened, the Kermit packets received on MLDP are answered on MLDP.
+ **/
+static void coc_connect(struct gatt_central *central)
+{
+  int fd;
+
+  fd = l2cap_le_coc_connect(&m_src_addr, &m_slate_addr, m_slate_addr_type, BT_SECURITY_LOW);
+  if (fd < 0)
+  {
+    PRLOG("CoC not available on PSM 0x%04x, MLDP is used: %s\n", m_coc_psm, strerror(errno));
+    return;
+  }
+
+  if (mainloop_add_fd(fd, EPOLLOUT, coc_connect_cb, central, NULL) < 0)
+  {
+    close(fd);
+    return;
+  }
+  central->connect_fd = fd;
+}
+
+/** att_connect_cb -- The connect() of the ATT socket is done
+ * Explanation : Creates the central, then opens the EATT bearers and the CoC, one connect() at a time.
+ **/
+static void att_connect_cb(int fd, uint32_t events, void *user_data)
 {
-  int dev_id = hci_get_route(NULL);
-  bdaddr_t src_addr, dst_addr;
-  int fd = 0, err_mutex = 0, err_cond = 0;
-  uint16_t mtu = 0;
   struct gatt_central *central;
 
-  if (parse_given_address(argv[1]) != 0)
-  { /* INVALID address */
-    exit(1);
+  mainloop_remove_fd(fd);
+
+  if (ble_con_step != BLE_CONNECTED)
+  {
+    /* the connection has been closed meanwhile */
+    close(fd);
+    return;
   }
 
-  while (end_of_state_machine == 0)
+  if (l2cap_connect_done(fd) < 0)
   {
-    signal(SIGINT, &sig_handler); //listen if ctrl-c is pressed
-    if (ble_con_step == BLE_SCANNING)
+    perror("Failed to connect");
+    close(fd);
+    le_deconnection();
+    scan_restart();
+    return;
+  }
+  PRLOG("Connected to device\n");
+  ble_con_step = BLE_SOCKET_OPEN;
+
+  central = gatt_central_create(fd, 0);
+  if (!central)
+  {
+    close(fd);
+    le_deconnection();
+    scan_restart();
+    return;
+  }
+  m_gatt_central = central; //access to the central instance everywhere
+
+  if (m_eatt_bearers > 0)
+    eatt_connect(central);
+  else if (m_coc_psm != 0)
+    coc_connect(central);
+}
+
+/** att_connect -- Start the connection of the ATT socket once the SLATE is connected
+ * Explanation : The mainloop goes on while the SLATE answers, see att_connect_cb().
+ **/
+static void att_connect(void)
+{
+  int fd;
+
+  if (m_dev_id == -1)
+    bacpy(&m_src_addr, BDADDR_ANY);
+  else if (hci_devba(m_dev_id, &m_src_addr) < 0)
+  {
+    perror("Adapter not available");
+    mainloop_exit_failure();
+    return;
+  }
+
+  fd = l2cap_le_att_connect(&m_src_addr, &m_slate_addr, m_slate_addr_type, BT_SECURITY_LOW);
+  if (fd < 0 || mainloop_add_fd(fd, EPOLLOUT, att_connect_cb, NULL, NULL) < 0)
+  {
+    if (fd >= 0)
+      close(fd);
+    le_deconnection();
+    scan_restart();
+  }
+}
+
+/** presence_event_cb -- A connectable SLATE was reported by the background scan
+ **/
+static void presence_event_cb(int fd, uint32_t events, void *user_data)
+{
+  presence_info_t info;
+  uint64_t value;
+
+  if (read(fd, &value, sizeof(value)) < 0)
+    return;
+
+  if (ble_con_step != BLE_SCANNING || end_of_state_machine || !presence_get_connectable(PRESENCE_MAX_AGE_MS, &info))
+    return;
+
+  bacpy(&m_slate_addr, &info.addr);
+  le_connection(&m_slate_addr);
+}
+
+/** autoconnect_connected_cb -- The kernel has connected a SLATE of the allowlist
+ **/
+static void autoconnect_connected_cb(const bdaddr_t *addr, uint8_t addr_type, void *user_data)
+{
+  if (ble_con_step != BLE_SCANNING || end_of_state_machine)
+    return;
+
+  bacpy(&m_slate_addr, addr);
+  m_slate_addr_type = addr_type; //the mgmt address types are the BDADDR_LE_* ones
+  link_profile_select(addr); //the kernel has chosen the connection parameters
+  ble_con_step = BLE_CONNECTED;
+  att_connect();
+}
+
+static void quit_cb(const void *data, uint8_t size, void *user_data)
+{
+  mainloop_quit();
+}
+
+static void autoconnect_done_cb(void *user_data)
+{
+  mainloop_quit();
+}
+
+/** state_machine_stop -- Stop the scan of the current mode, then the mainloop
+ **/
+static void state_machine_stop(void)
+{
+  if (m_auto_connect)
+    autoconnect_stop(autoconnect_done_cb, NULL);
+  else if (presence_is_running())
+    mainloop_quit();
+  else
+    scan_disable(quit_cb);
+}
+
+/** scan_restart -- Look for the next SLATE, with the scan of the current mode
+ **/
+static void scan_restart(void)
+{
+  ble_con_step = BLE_SCANNING;
+  m_conn_handle = HCI_CONN_HANDLE_INVALID;
+
+  if (end_of_state_machine)
+  {
+    if (!sessions_busy()) //otherwise stopped by ft_done_cb()
+      state_machine_stop();
+  }
+  else if (m_auto_connect)
+    autoconnect_check();
+  else if (presence_is_running())
+  {
+    presence_info_t info;
+
+    /* a SLATE may have been reported while the previous one was connected */
+    if (presence_get_connectable(PRESENCE_MAX_AGE_MS, &info))
     {
-      cmd_lescan(dev_id, argv[1]);
+      bacpy(&m_slate_addr, &info.addr);
+      le_connection(&m_slate_addr);
     }
-    else if (ble_con_step == BLE_SLATE_FOUND)
+  }
+  else
+    cmd_lescan();
+}
+
+/** signal_cb -- Signals received by the mainloop
+ * Explanation : SIGINT/SIGTERM ends the current connection then stops the program, a second one
+ * stops it immediately. SIGHUP reloads the allowlist.
+ **/
+static void signal_cb(int signum, void *user_data)
+{
+  switch (signum)
+  {
+  case SIGINT:
+  case SIGTERM:
+    if (end_of_state_machine)
     {
-      le_connection(dev_id, argv[1]);
+      mainloop_quit();
+      break;
     }
-    else if (ble_con_step == BLE_CONNECTED)
+    end_of_state_machine = 1;
+    if (ble_con_step == BLE_SCANNING)
+      state_machine_stop();
+    else if (ble_con_step == BLE_SLATE_FOUND)
+      bt_hci_send(m_hci, cmd_opcode_pack(OGF_LE_CTL, OCF_LE_CREATE_CONN_CANCEL),
+                  NULL, 0, NULL, NULL, NULL);
+    else if (ble_con_step != BLE_DISCONNECTING)
+      le_deconnection();
+    break;
+  case SIGHUP:
+    allowlist_reload();
+    if (m_auto_connect)
+      autoconnect_update();
+    break;
+  }
+}
+
+/** uuids_init -- Parse the UUIDs of the SLATE services and characteristics
+ **/
+static void uuids_init(void)
+{
+  bt_string_to_uuid(&m_uuids[UUID_SLATE_SERVICE], SLATE_SERVICE_UUID);
+  bt_string_to_uuid(&m_uuids[UUID_MLDP_SERVICE], MLDP_SERVICE_UUID);
+  bt_string_to_uuid(&m_uuids[UUID_CENTRAL_IDENTIFICATION_CHAR], CENTRAL_IDENTIFICATION_CHARACTERISTIC_UUID);
+  bt_string_to_uuid(&m_uuids[UUID_PERIPHERAL_AUTHENTICATION_CHAR], PERIPHERAL_AUTHENTICATION_CHARACTERISTIC_UUID);
+  bt_string_to_uuid(&m_uuids[UUID_MISC_CHAR], MISC_CHARACTERISTIC_UUID);
+  bt_string_to_uuid(&m_uuids[UUID_MLDP_DATA_CHAR], MLDP_DATA_CHARAC_UUID);
+  bt_string_to_uuid(&m_uuids[UUID_MLDP_CTRL_CHAR], MLDP_CTRL_CHARAC_UUID);
+}
+
+/** address_usage -- Print the format of address to respect
+ **/
+static void address_usage()
+{
+  PRLOG("INVALID ADDRESS\n");
+  PRLOG("Argument must be a MAC address in this form : xx:xx:xx:xx:xx:xx (where 'x' are hexadecimals symbols)\n");
+  PRLOG("or the path to an allowlist file, with one MAC address per line\n");
+}
+
+/** usage -- Print the command line options
+ **/
+static void usage()
+{
+  PRLOG("Usage:\n\tbluez_server_file_transfer [options] <MAC address | allowlist file>\n");
+  PRLOG("Options:\n"
+        "\t-t, --tracker\t\t\tKeep a passive scan running in background\n"
+        "\t-i, --scan-interval <ms>\tBackground scan interval (default %d)\n"
+        "\t-w, --scan-window <ms>\t\tBackground scan window (default %d)\n"
+        "\t-a, --auto-connect\t\tLet the kernel scan and connect the SLATE\n"
+        "\t-c, --cache-dir <dir>\t\tDirectory of the GATT database cache (default %s)\n"
+        "\t-u, --uuid-discovery\t\tDiscover the SLATE and MLDP services only (no cache)\n"
+        "\t-e, --eatt <count>\t\tOpen up to %d EATT bearers for the requests (default 0)\n"
+        "\t-p, --coc-psm <psm>\t\tSend the Kermit packets on an LE credit based channel, MLDP if refused\n"
+        "\t-b, --batch\t\t\tServe all the requests of the SLATE in one Kermit session\n"
+        "\t-h, --help\t\t\tDisplay help\n",
+        PRESENCE_SCAN_INTERVAL_MS, PRESENCE_SCAN_WINDOW_MS, GATT_CACHE_DIR, EATT_MAX_BEARERS);
+}
+
+static struct option main_options[] = {
+    {"tracker", 0, 0, 't'},
+    {"scan-interval", 1, 0, 'i'},
+    {"scan-window", 1, 0, 'w'},
+    {"auto-connect", 0, 0, 'a'},
+    {"cache-dir", 1, 0, 'c'},
+    {"uuid-discovery", 0, 0, 'u'},
+    {"eatt", 1, 0, 'e'},
+    {"coc-psm", 1, 0, 'p'},
+    {"batch", 0, 0, 'b'},
+    {"help", 0, 0, 'h'},
+    {}};
+
+int main(int argc, char *argv[])
+{
+  int dev_id = hci_get_route(NULL);
+  int err = 0;
+  bool tracker = false;
+  uint16_t scan_interval = PRESENCE_SCAN_INTERVAL_MS;
+  uint16_t scan_window = PRESENCE_SCAN_WINDOW_MS;
+  const char *cache_dir = GATT_CACHE_DIR;
+  sigset_t mask;
+  char *end;
+  int opt, fd;
+
+  while ((opt = getopt_long(argc, argv, "+ti:w:ac:ue:p:bh", main_options, NULL)) != -1)
+  {
+    switch (opt)
     {
-      if (str2ba(argv[1], &dst_addr))
-      {
-        break;
-      }
-      if (dev_id == -1)
-        bacpy(&src_addr, BDADDR_ANY);
-      else if (hci_devba(dev_id, &src_addr) < 0)
-      {
-        perror("Adapter not available");
-        break;
-      }
-      fd = l2cap_le_att_connect(&src_addr, &dst_addr, BDADDR_LE_PUBLIC, BT_SECURITY_LOW);
-      if (fd < 0)
+    case 't':
+      tracker = true;
+      break;
+    case 'i':
+      scan_interval = atoi(optarg);
+      break;
+    case 'w':
+      scan_window = atoi(optarg);
+      break;
+    case 'a':
+      m_auto_connect = true;
+      break;
+    case 'c':
+      cache_dir = optarg;
+      break;
+    case 'u':
+      m_uuid_discovery = true;
+      break;
+    case 'e':
+      m_eatt_bearers = strtol(optarg, &end, 10);
+      if (*optarg == '\0' || *end != '\0' || m_eatt_bearers < 0 || m_eatt_bearers > EATT_MAX_BEARERS)
       {
-        ble_con_step = BLE_SCANNING;
-        break;
+        PRLOG_ERROR("Invalid number of EATT bearers: %s (0 to %d)\n", optarg, EATT_MAX_BEARERS);
+        exit(1);
       }
-      ble_con_step = BLE_SOCKET_OPEN;
+      break;
+    case 'p':
+      m_coc_psm = strtoul(optarg, NULL, 0);
+      break;
+    case 'b':
+      m_batch = true;
+      break;
+    case 'h':
+      usage();
+      exit(0);
+    default:
+      usage();
+      exit(1);
     }
-    else if (ble_con_step == BLE_SOCKET_OPEN)
+  }
+
+  if (optind >= argc || allowlist_init(argv[optind]) != 0)
+  { /* INVALID address or allowlist file */
+    address_usage();
+    exit(1);
+  }
+
+  if (tracker && m_auto_connect)
+  {
+    PRLOG_ERROR("The background scan and the kernel auto-connect can not be used together\n");
+    exit(1);
+  }
+
+  if (dev_id < 0)
+  {
+    PRLOG_ERROR("No adapter available\n");
+    exit(1);
+  }
+  m_dev_id = dev_id;
+  uuids_init();
+
+  err = gatt_cache_init(cache_dir);
+  if (err != 0)
+  {
+    PRLOG_ERROR("GATT cache disabled (%s: %s)\n", cache_dir, strerror(-err));
+  }
+  err = link_profile_init(cache_dir);
+  if (err != 0)
+  {
+    PRLOG_ERROR("Link profiles disabled (%s: %s)\n", cache_dir, strerror(-err));
+  }
+
+  /* blocked before the threads are created: only the mainloop receives them */
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGINT);
+  sigaddset(&mask, SIGTERM);
+  sigaddset(&mask, SIGHUP);
+  pthread_sigmask(SIG_BLOCK, &mask, NULL);
+
+  mainloop_init();
+  mainloop_set_signal(&mask, signal_cb, NULL, NULL);
+
+  if (populate_db() != EXIT_SUCCESS || session_pool_init() != EXIT_SUCCESS)
+  {
+    PRLOG_ERROR("Could not initialize the sessions\n");
+    exit(1);
+  }
+
+  fd = file_transfer_init_thread();
+  if (fd < 0)
+  {
+    PRLOG_ERROR("Could not create the file transfer thread\n");
+    exit(1);
+  }
+  mainloop_add_fd(fd, EPOLLIN, ft_done_cb, NULL, NULL);
+
+  m_hci = bt_hci_new_raw_device(dev_id);
+  if (!m_hci)
+  {
+    PRLOG_ERROR("Could not open the HCI device\n");
+    exit(1);
+  }
+  bt_hci_register(m_hci, EVT_LE_META_EVENT, le_meta_event_cb, NULL, NULL);
+  bt_hci_register(m_hci, EVT_DISCONN_COMPLETE, disconn_complete_cb, NULL, NULL);
+
+  if (tracker)
+  {
+    err = presence_start(dev_id, scan_interval, scan_window);
+    if (err != 0)
     {
-      mainloop_init();
-      central = gatt_central_create(fd, mtu);
-      if (!central)
-      {
-        ble_con_step = BLE_SCANNING;
-        close(fd);
-        break;
-      }
-      m_gatt_central = central; //access to the central instance everywhere
-      pthread_condattr_init(&central->ft_s.attr);
-      pthread_condattr_setclock(&central->ft_s.attr, CLOCK_MONOTONIC);
-      err_cond = pthread_cond_init(&central->ft_s.condition, &central->ft_s.attr);
-      err_mutex = pthread_mutex_init(&central->ft_s.mutex, NULL);
-      if (err_cond != 0 || err_mutex != 0)
-      {
-        break;
-      }
-      mldp_fifos_init(central);
-      mainloop_run();
+      PRLOG_ERROR("Could not start the background scan: %s\n", strerror(-err));
+      exit(1);
     }
+    mainloop_add_fd(presence_get_fd(), EPOLLIN, presence_event_cb, NULL, NULL);
   }
-  pthread_exit(NULL);
-  return 0;
+
+  if (m_auto_connect && autoconnect_start(dev_id, autoconnect_connected_cb, NULL) != 0)
+  {
+    PRLOG_ERROR("No adapter available for the kernel auto-connect\n");
+    exit(1);
+  }
+
+  scan_restart();
+  err = mainloop_run();
+
+  presence_stop();
+  bt_hci_unref(m_hci);
+  return err;
 }
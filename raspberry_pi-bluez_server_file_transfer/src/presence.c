@@ -0,0 +1,409 @@
+/**
+ * Copyright (c) 2016, Innes SA,
+ * All Rights Reserved
+ *
+ * The copyright notice above does not evidence any
+ * actual or intended publication of such source code.
+ */
+
+/**
+ * @file   	presence.c
+ * @brief  	Background passive scan and table of the SLATE in range
+ * @author 	K. AUDIERNE
+ * @date 	2020-09-10
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+
+#include <bluetooth/bluetooth.h>
+#include <bluetooth/hci.h>
+#include <bluetooth/hci_lib.h>
+
+#include "presence.h"
+#include "allowlist.h"
+
+/* Bit 48 marks a used slot, so that 00:00:00:00:00:00 is not an empty slot */
+#define PRESENCE_KEY_USED (1ULL << 48)
+
+/* The table is insert only: stop inserting when it is half full */
+#define PRESENCE_MAX_ENTRIES (PRESENCE_TABLE_SIZE / 2)
+
+#define PRESENCE_FLAGS_AD_TYPE 0x01
+#define PRESENCE_POLL_MS 200
+#define PRESENCE_HCI_TIMEOUT_MS 1000
+
+/** presence_slot -- one device of the table
+ * key -- address | PRESENCE_KEY_USED, written once when the slot is taken
+ * seq -- odd while the fields below are written, readers retry on change
+ **/
+struct presence_slot
+{
+  uint64_t key;
+  uint32_t seq;
+  int8_t rssi;
+  uint8_t ad_flags;
+  uint8_t flags;
+  uint64_t last_seen_ms;
+};
+
+/* Single writer (the scan thread), lock-free readers */
+static struct presence_slot m_table[PRESENCE_TABLE_SIZE];
+static uint32_t m_count = 0;
+static uint64_t m_latest_key = 0; //last connectable device reported
+
+static pthread_t m_thread;
+static int m_dd = -1;
+static int m_event_fd = -1;
+static volatile int m_stop = 0;
+static bool m_running = false;
+
+/** presence_now_ms() --  monotonic time in ms
+ **/
+uint64_t presence_now_ms(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static inline uint32_t presence_hash(uint64_t key)
+{
+  return (uint32_t)((key * 0x9E3779B97F4A7C15ULL) >> (64 - PRESENCE_TABLE_BITS));
+}
+
+static void key_to_addr(uint64_t key, bdaddr_t *addr)
+{
+  int i;
+
+  for (i = 0; i < 6; i++)
+    addr->b[i] = (key >> (8 * i)) & 0xff;
+}
+
+/** presence_find_slot() --  look for the slot of a device
+ * Input : key -- address of the device
+ *         create -- true to take a free slot if the device is unknown (writer only)
+ * Return : the slot, NULL if not found
+ **/
+static struct presence_slot *presence_find_slot(uint64_t key, bool create)
+{
+  struct presence_slot *slot;
+  uint64_t slot_key;
+  uint32_t idx;
+
+  key |= PRESENCE_KEY_USED;
+  for (idx = presence_hash(key);; idx = (idx + 1) & (PRESENCE_TABLE_SIZE - 1))
+  {
+    slot = &m_table[idx];
+    slot_key = __atomic_load_n(&slot->key, __ATOMIC_ACQUIRE);
+    if (slot_key == key)
+      return slot;
+    if (slot_key != 0)
+      continue;
+
+    if (!create || m_count >= PRESENCE_MAX_ENTRIES)
+      return NULL;
+
+    /* fields are written before the key is published */
+    slot->seq = 0;
+    m_count++;
+    __atomic_store_n(&slot->key, key, __ATOMIC_RELEASE);
+    return slot;
+  }
+}
+
+static int read_ad_flags(uint8_t *flags, const uint8_t *data, size_t size)
+{
+  size_t offset = 0;
+
+  while (offset < size)
+  {
+    uint8_t len = data[offset];
+
+    if (len == 0 || len + offset >= size)
+      break;
+
+    if (data[offset + 1] == PRESENCE_FLAGS_AD_TYPE)
+    {
+      *flags = data[offset + 2];
+      return 0;
+    }
+    offset += 1 + len;
+  }
+
+  return -ENOENT;
+}
+
+/** presence_report() --  update the table with an advertising report
+ * Only the devices of the allowlist are tracked.
+ **/
+static void presence_report(le_advertising_info *info)
+{
+  struct presence_slot *slot;
+  uint64_t key;
+  uint8_t ad_flags = 0;
+  uint8_t flags = 0;
+  uint64_t value = 1;
+
+  if (!allowlist_contains(&info->bdaddr))
+    return;
+
+  key = allowlist_addr_to_key(&info->bdaddr);
+  slot = presence_find_slot(key, true);
+  if (slot == NULL)
+    return;
+
+  /* ADV_IND and ADV_DIRECT_IND are connectable */
+  if (info->evt_type == 0x00 || info->evt_type == 0x01)
+    flags |= PRESENCE_FLAG_CONNECTABLE;
+  if (read_ad_flags(&ad_flags, info->data, info->length) == 0)
+    flags |= PRESENCE_FLAG_AD_FLAGS;
+
+  __atomic_store_n(&slot->seq, slot->seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  slot->rssi = (int8_t)info->data[info->length];
+  slot->ad_flags = ad_flags;
+  slot->flags = flags;
+  slot->last_seen_ms = presence_now_ms();
+  __atomic_store_n(&slot->seq, slot->seq + 1, __ATOMIC_RELEASE);
+
+  if (flags & PRESENCE_FLAG_CONNECTABLE)
+  {
+    __atomic_store_n(&m_latest_key, key | PRESENCE_KEY_USED, __ATOMIC_RELEASE);
+    if (write(m_event_fd, &value, sizeof(value)) < 0)
+    {
+      /* counter overflow only, the scheduler is already woken up */
+    }
+  }
+}
+
+/** presence_read_slot() --  consistent copy of a slot
+ **/
+static void presence_read_slot(struct presence_slot *slot, presence_info_t *info)
+{
+  uint32_t seq;
+
+  do
+  {
+    seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+    info->rssi = slot->rssi;
+    info->ad_flags = slot->ad_flags;
+    info->flags = slot->flags;
+    info->last_seen_ms = slot->last_seen_ms;
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  } while ((seq & 1) != 0 || __atomic_load_n(&slot->seq, __ATOMIC_RELAXED) != seq);
+
+  key_to_addr(slot->key, &info->addr);
+}
+
+/** presence_task() --  function executed by the thread created in presence_start()
+ **/
+static void *presence_task(void *arg)
+{
+  unsigned char buf[HCI_MAX_EVENT_SIZE];
+  struct pollfd pfd;
+  int len;
+
+  pfd.fd = m_dd;
+  pfd.events = POLLIN;
+
+  while (!m_stop)
+  {
+    evt_le_meta_event *meta;
+    unsigned char *ptr, *end;
+    uint8_t num_reports;
+
+    if (poll(&pfd, 1, PRESENCE_POLL_MS) <= 0)
+      continue;
+
+    len = read(m_dd, buf, sizeof(buf));
+    if (len < 0)
+    {
+      if (errno == EAGAIN || errno == EINTR)
+        continue;
+      perror("Presence scan read failed");
+      break;
+    }
+
+    if (len < 1 + HCI_EVENT_HDR_SIZE + 2)
+      continue;
+
+    meta = (void *)(buf + (1 + HCI_EVENT_HDR_SIZE));
+    if (meta->subevent != EVT_LE_ADVERTISING_REPORT)
+      continue;
+
+    num_reports = meta->data[0];
+    ptr = meta->data + 1;
+    end = buf + len;
+    while (num_reports-- > 0 && ptr + LE_ADVERTISING_INFO_SIZE < end)
+    {
+      le_advertising_info *info = (le_advertising_info *)ptr;
+
+      /* data is followed by one byte of RSSI */
+      if (ptr + LE_ADVERTISING_INFO_SIZE + info->length + 1 > end)
+        break;
+      presence_report(info);
+      ptr += LE_ADVERTISING_INFO_SIZE + info->length + 1;
+    }
+  }
+
+  return NULL;
+}
+
+/** presence_start() --  start the background passive scan
+ * Input : dev_id -- identifier to the local adapter (hci0)
+ *         interval_ms -- scan interval
+ *         window_ms -- scan window, the duty cycle is window_ms / interval_ms
+ * Return : 0 on success, negative errno otherwise
+ **/
+int presence_start(int dev_id, uint16_t interval_ms, uint16_t window_ms)
+{
+  struct hci_filter nf;
+  uint16_t interval, window;
+  int err;
+
+  if (m_running)
+    return -EALREADY;
+
+  if (window_ms == 0 || window_ms > interval_ms)
+    return -EINVAL;
+
+  /* HCI unit is 0.625 ms, valid range is 0x0004 - 0x4000 */
+  interval = interval_ms * 8 / 5;
+  window = window_ms * 8 / 5;
+  if (window < 0x0004 || interval > 0x4000)
+    return -EINVAL;
+
+  if (dev_id < 0)
+    dev_id = hci_get_route(NULL);
+
+  m_dd = hci_open_dev(dev_id);
+  if (m_dd < 0)
+    return -errno;
+
+  /* a scan may have been left enabled by a previous run */
+  hci_le_set_scan_enable(m_dd, 0x00, 0x00, PRESENCE_HCI_TIMEOUT_MS);
+
+  /* passive scan, own public address, accept all advertising packets */
+  err = hci_le_set_scan_parameters(m_dd, 0x00, htobs(interval), htobs(window),
+                                   LE_PUBLIC_ADDRESS, 0x00, PRESENCE_HCI_TIMEOUT_MS);
+  if (err < 0)
+    goto failed;
+
+  /* duplicates are kept to refresh last seen time and RSSI */
+  err = hci_le_set_scan_enable(m_dd, 0x01, 0x00, PRESENCE_HCI_TIMEOUT_MS);
+  if (err < 0)
+    goto failed;
+
+  hci_filter_clear(&nf);
+  hci_filter_set_ptype(HCI_EVENT_PKT, &nf);
+  hci_filter_set_event(EVT_LE_META_EVENT, &nf);
+  if (setsockopt(m_dd, SOL_HCI, HCI_FILTER, &nf, sizeof(nf)) < 0)
+    goto failed;
+
+  m_event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (m_event_fd < 0)
+    goto failed;
+
+  m_stop = 0;
+  err = pthread_create(&m_thread, NULL, presence_task, NULL);
+  if (err != 0)
+  {
+    errno = err;
+    close(m_event_fd);
+    m_event_fd = -1;
+    goto failed;
+  }
+
+  m_running = true;
+  printf("Presence scan started (interval %u ms, window %u ms)\n", interval_ms, window_ms);
+  return 0;
+
+failed:
+  err = -errno;
+  hci_le_set_scan_enable(m_dd, 0x00, 0x00, PRESENCE_HCI_TIMEOUT_MS);
+  hci_close_dev(m_dd);
+  m_dd = -1;
+  return err;
+}
+
+/** presence_stop() --  stop the background passive scan
+ **/
+void presence_stop(void)
+{
+  if (!m_running)
+    return;
+
+  m_stop = 1;
+  pthread_join(m_thread, NULL);
+
+  hci_le_set_scan_enable(m_dd, 0x00, 0x00, PRESENCE_HCI_TIMEOUT_MS);
+  hci_close_dev(m_dd);
+  m_dd = -1;
+  close(m_event_fd);
+  m_event_fd = -1;
+  m_running = false;
+}
+
+bool presence_is_running(void)
+{
+  return m_running;
+}
+
+/** presence_get() --  last report of a device
+ * Input : addr -- address of the device
+ * Output : info -- last report
+ * Return : true if the device has been seen
+ **/
+bool presence_get(const bdaddr_t *addr, presence_info_t *info)
+{
+  struct presence_slot *slot;
+
+  slot = presence_find_slot(allowlist_addr_to_key(addr), false);
+  if (slot == NULL)
+    return false;
+
+  presence_read_slot(slot, info);
+  return true;
+}
+
+/** presence_get_fd() --  file descriptor readable when a connectable device is reported
+ * The descriptor is an eventfd: read it to clear the event.
+ * Return : the file descriptor, -1 if the background scan is not running
+ **/
+int presence_get_fd(void)
+{
+  return m_event_fd;
+}
+
+/** presence_get_connectable() --  last connectable device of the allowlist reported
+ * Input : max_age_ms -- maximum age of the last report of the device
+ * Output : info -- last report of the device
+ * Return : true if such a device is in range
+ **/
+bool presence_get_connectable(uint32_t max_age_ms, presence_info_t *info)
+{
+  struct presence_slot *slot;
+  uint64_t key;
+
+  key = __atomic_load_n(&m_latest_key, __ATOMIC_ACQUIRE);
+  if (key == 0)
+    return false;
+
+  slot = presence_find_slot(key & ~PRESENCE_KEY_USED, false);
+  if (slot == NULL)
+    return false;
+
+  presence_read_slot(slot, info);
+  return (info->flags & PRESENCE_FLAG_CONNECTABLE) &&
+         presence_now_ms() - info->last_seen_ms <= max_age_ms &&
+         allowlist_contains(&info->addr);
+}